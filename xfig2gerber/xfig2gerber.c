@@ -35,10 +35,16 @@
    - filled polygons and lines
    - rectangular objects (filled and not filled)
    - circles (filled and not filled)
-   - arcs (not filled)
-   Text entries are specifically not implemented, but may be later if there
-   is an obvious vectorization of fonts possible. Fillings are supposed to
-   take place without fancy filling fractions or patterns.
+   - arcs, open or pie wedge shaped. Filled arcs are written as regions
+     made of the arc and straight closing edges.
+   - splines (approximated, interpolated and X-splines, open or closed).
+     They are tessellated into lines or filled polygons with a flatness
+     tolerance set by option -e.
+   - text, rendered with a built-in stroke font. Font size, angle and
+     justification are taken from the text object, the font face is
+     ignored. The pen width follows from the font size.
+   Fillings are supposed to take place without fancy filling fractions or
+   patterns.
 
    To allow for a proper assignment between various manufacturing files 
    (metalized layers, solder stop layers, silk screen layers), the following 
@@ -47,7 +53,11 @@
    layer 00: contains hole information as white circles
    layer 02: contains comment info. not transferred to silk screen
    layer 03: as layer 02 
-   layer 04: as layer 02
+   layer 04: as layer 02. Text on this layer names the components
+             in the pick and place list.
+   layer 05: board outline. Lines, polygons, circles and arcs on this layer
+             are the path of the routing bit for the outside contour, with
+	     a line width matching the bit as for slots in layer 0.
    layer 06: silk screen layer, component side
    layer 07: silk screen layer, solder side
    layer 08: additional solder mask, component side
@@ -87,6 +97,8 @@
              solder side solder mask, pads on layer 95-99 will not.
 	     Color code is white for 80, green for 81-94, and green3 for 95-99.
 	     layer 80 is knockout layer for removing copper.
+	     As on the component side, layer 81-82 go on the stencil mask,
+	     layer 83 does not.
 
    layers 100- : may contain arbitrary more inner layers. Suggested
              layer spacing is 20 xfig layers per physical layer. The first
@@ -140,6 +152,14 @@
    -F        same as -f, but with solder masks and top silk screen
    -s        create top silk screen (same as -8)
    -S        create bottom silk screen (same as -9)
+   -p        create top paste stencil from layers 21-22
+   -P        create bottom paste stencil from layers 81-82
+   -k        create a pick and place list (.placement.csv) from the pads
+             on layer 21: each top level compound is one part, placed at
+	     the center of its pads, rotated along the main axis of the
+	     pads with pin 1 (its first pad) on the left, and named by
+	     the nearest text on layer 4 no other part is closer to
+   -K        same as -k, but as IPC style XY list (.placement.xy)
    -a        create a separate aperture definition file
    -o fname  create outfile name not from infilename; use stdout if fname
              is "-"
@@ -152,7 +172,168 @@
 	     fulfill different insulation annulus requirements in inner layers.
 	     currently, the minimum insulation spacing in inner layers is
 	     set to 16mil. This is a dirty option, but necessary for a local
-	     supplier to have high density of pads. 
+	     supplier to have high density of pads.
+   -m        merge (stitch) line segments in gerber files. Lines of the same
+             width whose end points coincide are joined into single paths,
+	     and collinear interior points are removed. This reduces the
+	     number of pen lifts for traces drawn as many short lines.
+   -e tol    flatness tolerance for the tessellation of splines in mil;
+             defaults to 0.5 mil.
+   -c        create contour routing files from layer 5: an excellon rout
+             program and a gerber profile layer
+   -b dia    use a routing bit of dia mil for the contour instead of the
+             tool matching the line width (a width without a tool gets
+	     the default tool, with a warning)
+   -u n,w    leave n tabs of width w mil on every closed contour; a
+             contour too short for its tabs is reported and left out
+   -U p,d    perforate tabs with mouse bite holes of about d mil diameter
+             at a pitch of p mil
+   --preview dpi
+             render all drill and gerber files produced into bitmaps
+	     (PBM, named after the output file with .pbm appended) at dpi
+	     pixels per inch, and report the copper area and fill ratio
+	     of each layer on stderr
+   --drc w,c,a,h
+             design rule check of the copper layers (2..5, with their
+	     knockouts in RS274X mode) and the drill file: minimum trace
+	     width w, copper clearance c, annular ring a of pads on holes
+	     and hole to hole spacing h, all in mil. Values left out keep
+	     their defaults 6,6,5,10. Copper items which touch form a
+	     net, and the clearance is only checked between different
+	     nets. Violations are listed on stderr. Needs a source file,
+	     as the check parses it again.
+   --stencil-reduce r
+             reduce stencil openings of pads by r percent of their size
+	     if r ends with %, or else by r mil on each side. Filled
+	     circles are reduced the same way; filled polygons and
+	     splines are scaled about their center to the reduced width
+	     and height. Filled arcs and text keep their size.
+   --stencil-pane p,w
+             split rectangular stencil openings with a side longer than
+	     p mil into window panes separated by webs of w mil
+   --netlist write the connectivity of the copper layers as IPC-D-356
+             netlist for bare board testing into a file with the suffix
+	     .netlist.ipc. Copper on layers 2..5 is joined where it touches
+	     and through the plated holes; knockouts are honoured in RS274X
+	     mode. Test points are the holes and the outer layer pads.
+   --pour d,c,s
+             fill closed polygons and boxes on depth d of the gerber layers
+	     as copper pour zones: copper of other nets keeps a clearance
+	     of c mil, pads of the zone net get a thermal relief with four
+	     spokes of s mil. Values left out default to 10 mil. The option
+	     may be given up to 8 times and needs -X. Objects are assigned
+	     to a net with a comment "net name" in xfig; a compound passes
+	     its net on to its members. Zones without a net are clear of
+	     all copper.
+   --flatten write the gerber layers as the union of their copper, with
+             knockouts and clearances taken out, in non-overlapping
+	     regions. Flashes which touch nothing else are kept.
+   --stackup n
+             create n inner layers from depth 100 on in a single pass,
+	     one per block of 20 depths, into files with the suffix
+	     .innerNN.lgx. In RS274X mode, the first depth of a block and
+	     layers 10 and 11 are its knockout, else they are left out.
+	     Layers 15 and 16 go to all of them unless switched off
+	     with -T. Joining of lines
+	     and previews do not cover these files.
+   --compile-library file
+             compile the library figs given as the remaining arguments
+	     into the footprint cache file. Each fig is stored parsed
+	     and classified, moved to the origin of its extent and keyed
+	     by a hash of its objects. Figs with splines, pictures or
+	     arrows are left out.
+   --library file
+             use the footprint cache file: top level compounds of the
+	     source with the same objects as a cached footprint, in any
+	     order and at any place but not rotated, are taken from the
+	     cache instead of being parsed in each pass. A comment
+	     "footprint NAME" in xfig restricts the match to the footprint
+	     NAME (the library file name without .fig) and reports if the
+	     compound differs from it. Compounds with net comments inside
+	     are always parsed.
+   --watch   stay resident and convert the source again each time it is
+             saved. Objects are compared with the last version, and only
+	     the files with a changed layer are written again; with
+	     --pour a changed hole also rewrites the gerber files. Files are
+	     written under a temporary name and renamed when complete, so
+	     viewers reloading them never see half a file. This holds
+	     without --watch, too.
+   --bundle file
+             write all files into one archive instead: a zip (stored,
+	     not compressed) if file ends in .zip, a tar otherwise, and a
+	     tar on stdout for "-". Files are named after their paths
+	     without directory, and a manifest.txt lists each file with
+	     its layer role, size and crc32. Zip members are streamed
+	     directly; tar members are kept in memory until complete.
+   --stream  read the source only once for all files: each object is
+             written to every file whose layers hold its depth, and the
+	     punch layer content of RS274X files goes to a temporary file
+	     appended at the end. Memory use does not grow with the size
+	     of the source, except for previews. Does not combine with
+	     -m, --pour or --flatten, which need whole layers.
+   --parallel
+             tokenize the source once on all processor cores before the
+	     conversion: the body is split into chunks at object lines,
+	     and all passes then work on the parsed objects. The output is
+	     the same as without. Not for a source on stdin.
+   --extents report the extents of each depth and of the board in mil on
+             stderr. Coordinates are scaled in bulk per object, and the
+	     extents are collected on the way; coordinates which do not
+	     fit the 5 digit output format are warned about in any case.
+	     When the source is read into a table first (--parallel,
+	     --window, --diff, --origin), the gerber and drill headers
+	     also give the size and lower left corner of the board: the
+	     box of the objects on the profile depth 5, or of all objects
+	     if there are none there.
+   --origin  move the lower left corner of the board to 0,0 in all
+             output files, so coordinates are positive and small. Reads
+	     the source into a table first, as --parallel.
+   --clearance o[,i]
+             knock out pads in the punch layers (-X) with their own
+	     aperture grown by o mil on each side for the outer copper
+	     and by i mil (default o) for inner layers, instead of the
+	     fixed insulation pads of -i; rectangular pads and circles
+	     without an aperture are grown, too. Implies -i.
+   --mask e[,w]
+             write the solder masks (-D, -F, -j) from the copper pads and
+	     tracks already classified for the copper files instead of
+	     parsing the copper layers again: pads and lines are grown by
+	     e mil on each side, regions get an outline of that width, and
+	     openings closer than w mil are joined into one. Layers 8, 9,
+	     34 and 94 are added as drawn.
+   --diff old
+             compare the drill and copper layers with those of the
+	     revision old instead of writing the files. Both sources
+	     are tokenized once (as with --parallel); primitives are
+	     matched by a hash of their aperture and points, and the
+	     added, removed and moved ones are reported on stderr per
+	     layer, clustered into regions of touching 0.1 inch cells.
+	     root.diff.lgx shows the changes, one RS274X layer per layer
+	     of the board. Exits with "Boards differ." if there are any.
+   --window x0,y0,x1,y1[,mil][,clip]
+             convert only the objects meeting the window, given in xfig
+	     units or, with mil, in the plot coordinates of the output.
+	     Objects are found with a bucket grid over the tokenized
+	     source (as with --parallel), and compounds outside the
+	     window are left out whole; splines are always converted.
+	     With clip the gerber layers are flattened (--flatten) and
+	     cut exactly at the window edges. Not for a source on stdin.
+   --slots g85|rout
+             write the drill file grouped by tool, slots with their holes
+	     of the same tool, instead of in drawing order. Repeated
+	     points of a slot are dropped and collinear segments joined;
+	     then each segment is a canned slot (g85) or the slot is
+	     routed with plunge and retract (rout: M15, G01, M16, G05).
+	     Without it every segment is a G85 move plus a hit.
+
+   LIBRARY:
+
+   make libxfig2gerber.a builds the converter without main(). The
+   interface in xfig2gerber.h takes the options as above, the source from
+   a file or a memory buffer, and writes each job to a file, to memory, to
+   a file descriptor or to a callback. Each context keeps its own converter
+   state: different contexts may convert at the same time on different
+   threads, and a context is used by one thread at a time.
 
    MISCELLANEOUS:
 
@@ -160,7 +341,7 @@
    www.apcircuits.com 
 
    TODO:
-   better documentation, implement text rendering, outside contour routing
+   better documentation
 
    HISTORY:
 
@@ -181,13 +362,49 @@
    removed doubling of hole data, fixed buggy layer 16 assoc 17.10.09chk
    added some pads and drills for csBGA cases; changed meaning of layers
      34 and 94 to be excluded for copper, but included for sld mask 5/2019chk
+   added track stitching for line segments (option -m)          10/2026
+   added spline objects with adaptive tessellation              10/2026
+   added text rendering with a stroke font                      10/2026
+   added filled arcs and pie wedges                             10/2026
+   added outside contour routing with tabs and mouse bites      10/2026
+   added raster previews with copper area report (--preview)    10/2026
+   added design rule check (--drc)                              10/2026
+   added IPC-D-356 netlist extraction (--netlist)               10/2026
+   added paste stencil layers (options -p, -P)                  10/2026
+   added pick and place list (options -k, -K)                   10/2026
+   added copper pour zones with thermal reliefs (--pour)        10/2026
+   added flattening of overlapping copper into regions (--flatten) 10/2026
+   added single pass inner layer stackup (--stackup)            10/2026
+   added precompiled footprint cache (--compile-library, --library) 10/2026
+   added watch mode with incremental conversion (--watch)       10/2026
+   added conversion library with output sinks (xfig2gerber.h)   10/2026
+   added zip/tar fab bundle with manifest (--bundle)            10/2026
+   added single pass streaming of all jobs (--stream)           10/2026
+   added parallel tokenizing of the source (--parallel)         10/2026
+   added bulk coordinate scaling with layer extents (--extents) 10/2026
+   added rule driven pad clearances for knockouts (--clearance) 10/2026
+   added solder masks derived from the copper pads (--mask)     10/2026
+   added revision diff against an old source (--diff)           10/2026
+   added conversion of a window of the drawing (--window)       10/2026
+   added merged G85 or routed slots, grouped by tool (--slots)  10/2026
+   added board origin and size headers (--origin)               10/2026
 */
 
+#define _GNU_SOURCE /* fopencookie, open_memstream */
 #include<stdio.h>
+#include<stdlib.h>
 #include<string.h>
+#include<math.h>
 #include<time.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/wait.h>
+#include "xfig2gerber.h"
 
 
 #define maxaperture 35
@@ -202,7 +419,7 @@
 typedef struct {
     float diameter; int graph_units, route_width, tool_index;
 } drill_table;
-drill_table drilltab[]={
+static drill_table drilltab[]={
     {0.028,65,8,1},                              /* #70, .028" = 0.711mm */
     {0.035,66,11,2},    /* standard pin size */  /* #65, .035" = 0.889mm */
     {0.042,83,12,3},                             /* consistency? .042" */
@@ -221,7 +438,6 @@ drill_table drilltab[]={
     {0.024,55,7,15},    /* for 0.6mm slots */    /* #73, .024" = 0.610mm */
 };
 
-int tool_counts[tool_number+1];    /* counts number of tool usages */
 
 
 /* here, some special aperture definitions are given */
@@ -234,7 +450,7 @@ int tool_counts[tool_number+1];    /* counts number of tool usages */
 typedef struct {
     int xfig_rad, aperture_idx; double real_dia;  /* in inches */
     char * description; int knockout_idx; } roundap_table;
-roundap_table  rnd_apt_tab[] = 
+static roundap_table  rnd_apt_tab[] = 
     {{135, 102, 0.060, "standard round pad", 151}, /* 0 */
      {125, 103, 0.055, "small round pad", 102},
      {101, 108, 0.045, "small round pad, 45 mil dia", 102},
@@ -263,7 +479,7 @@ roundap_table  rnd_apt_tab[] =
 typedef struct rectap_table {
     int xfig_x, xfig_y, aperture_idx; double real_x, real_y;
     char* description;} rectap_table;
-rectap_table rectap_tab[]=
+static rectap_table rectap_tab[]=
 {{216, 324, 100, 0.072, 0.048, "DIL standard rect pad 72x48 mil"}, /* 1 */
  {324, 216, 101, 0.048, 0.072, "DIL standard rect pad 48x72 mil"},
  {90, 360, 104, 0.080, 0.020, "SOIC pad (50 mil sep) 80x20 mil"}, 
@@ -382,7 +598,11 @@ static int * readlayerlist[]={
     (int []){-1}, /* empty_list (10) (reserved: tool cnt)*/
     (int []) {8,9,10,15,16,21,22,23,24,25,26,27,28,29,
 	      30,31,32,33,34,81,82,83,84,85,86,87,88,89,
-	      90,91,92,93,94,-1} /* bott&top soldermask (11) */
+	      90,91,92,93,94,-1}, /* bott&top soldermask (11) */
+    (int []){5,-1}, /* contour rout program (12) */
+    (int []){5,-1}, /* profile layer (13) */
+    (int []){21,22,-1}, /* comp stencil (14) */
+    (int []){81,82,-1}, /* bott stencil (15) */
 };
 static int * punchlayerlist [] ={
     (int []){-1},(int []){-1}, /* 0, 1 */
@@ -392,10 +612,12 @@ static int * punchlayerlist [] ={
     (int []) {10,11,12,60,-1},  /* cutout innersold */
     (int []){-1},(int []){-1},   /* 6, 7 solder masks */
     (int []){-1},(int []){-1},   /* 8, 9 silk layers - layer 10? */
-    (int []){-1},(int []){-1}   /* 10, 11 */ 
+    (int []){-1},(int []){-1},  /* 10, 11 */
+    (int []){-1},(int []){-1},  /* 12, 13 outline */
+    (int []){-1},(int []){-1}   /* 14, 15 stencils */
 };
 /* predefined name lists */
-char * suffixlist[]= {
+static char * suffixlist[]= {
     ".arb.lgx", /* 0 */
     ".holes.drl", /* 1 */
     ".comp.lgx", /* 2 */
@@ -408,75 +630,375 @@ char * suffixlist[]= {
     ".bottsilk.lgx",
     ".tools.mfg",  /* 10 */
     ".jointsldmask.lgx", /* 11 */
+    ".outline.rou", /* 12 */
+    ".profile.lgx", /* 13 */
+    ".compstencil.lgx", /* 14 */
+    ".bottstencil.lgx", /* 15 */
 };
-char * file_interpretation[]= {
+static char * file_interpretation[]= {
     "SOMELAYER",
     "",
     "COMPONENTSIDE", /* 2 */
     "BOTTOMSIDE", /* 3 */
     "COMP_INNER", /* 4 */
-    "BOTTOM_INNER" /* 5 */
+    "BOTTOM_INNER", /* 5 */
     "COMP_SOLDERMASK",
     "BOTT_SOLDERMASK",
     "COMP_LEGEND", /* 8 */
     "BOTT_LEGEND",
     "", /* 10 */
     "JOINT_SOLDERMASK", /* 11 */
+    "",
+    "PROFILE", /* 13 */
+    "COMP_STENCIL",
+    "BOTT_STENCIL", /* 15 */
 };
-/* which type is a specific job: 1:drill, 2:gerber, 4:toolcnt, 
-                                 5:RS274X firstlayer, 6:RS274X lastlayer */
-int filetypetable[]={2,1,2,2,2,2,2,2,2,2,4,2};
+/* which type is a specific job: 1:drill, 2:gerber, 3:rout, 4:toolcnt, 
+                                 5:stencil gerber */
+static int filetypetable[]={2,1,2,2,2,2,2,2,2,2,4,2,3,2,5,5};
 
 #define TARGETNAMELEN 200
 
 /* variable definitions */
-FILE *infile;
-char fnam[200];   /* file name */
-char inbuffer[10000];  /* input read buffer */
-char constring[1000];
-char *ibb;
-char *varp;
-char ifn[200]="stdin";
-char ofn[200]="stdout";
+static char ifn[200]="stdin";
+static char ofn[200]="stdout";
 
 typedef struct {int class, type, type2, width, pencolor, fillcolor, depth,
 	utype1, fillmode, int11, int12, int13, int14, int15,
 	int16, cx1, cx2, r1, r2, ax1, ax2, ex1, ex2, mx1, mx2; 
     float float1, float2, fx1, fx2; } obstruct;
-obstruct ob;   /* actual object structure */
 
-int whattodo(obstruct *ob, int *layerlist, int filetype);
+static int whattodo(obstruct *ob, int *layerlist, int filetype);
+static int parse_object(obstruct *o, char *line);
+static int parse_object_r(obstruct *o, char *line, char **rest);
+
+/* track stitching: with stitchmode set, line segments of one output layer
+   are collected and joined into longer paths when the layer is finished */
+typedef struct {int x0, y0, x1, y1, aperture, used;} stitch_seg;
+
+/* in-memory image of the primitives of one output file, recorded by
+   do_parsing() while capture is set. Coordinates are plot units (mil). */
+#define PRIM_FLASH 1  /* flash of an aperture at one point */
+#define PRIM_STROKE 2 /* line with a round aperture through the points */
+#define PRIM_REGION 3 /* filled polygon */
+#define PRIM_HOLE 4   /* drill hit or slot, aperture is the drilltab index */
+typedef struct {int kind, clear, aperture, depth, first, num, net;} primitive;
+typedef struct {
+    primitive *prim; int num, max; /* primitives */
+    int *x, *y; int npts, maxpts;  /* their points */
+    int jobtype, failed;
+} layer_image;
+
+/* slots in the drill file: with slot_mode set, hits and slots of the
+   drill job are collected in drill_buf (drill units) and written at the
+   end grouped by tool, slots with collinear segments merged as canned
+   G85 slots (SLOT_G85) or as routed paths with plunge and retract
+   (SLOT_ROUT). 0 keeps the per-segment output in file order. */
+#define SLOT_G85 1
+#define SLOT_ROUT 2
+static int drill_flush(FILE *f);
+
+/* paste stencils: pads are reduced by stencil_percent of their size and
+   by stencil_shrink mil on each side. Rectangular pads with a side longer
+   than stencil_pane mil are split into window panes separated by webs of
+   stencil_web mil. The derived aperture of a pad aperture is worked out
+   once and gets a D code higher by STENCIL_DCODE. */
+#define STENCIL_DCODE 300
+typedef struct {int done, rect, nx, ny; double w, h, px, py;} stencil_entry;
+
+/* clearance rule: with --clearance the punch passes (-i) knock out each
+   pad with its aperture grown by clear_mil on each side, instead of the
+   fixed knockout_idx of the round pads. Outer copper (class 0) and inner
+   layers (class 1) have their own clearance; solder masks (class 2) use
+   the same grown apertures for their expansion. The grown aperture of a
+   pad aperture (D codes 100..219) is worked out once per class and gets
+   the D code 600+120*class+(ap-100), so they are 600..959 and stay three
+   digit codes like all others. A new pad aperture must stay in that
+   range, or it gets no clearance aperture. */
+#define CLEAR_DCODE 600
+#define CLEAR_CLASSES 3
+#define CLEAR_PAD0 100
+#define CLEAR_PADS 120
+typedef struct {int done, rect; double w, h;} clear_entry;
+
+/* placement list: while place_collect is set, do_parsing() records the
+   pads on layer 21 with the top level compound they belong to, and the
+   component indices written as text on layer 4. seq keeps the source
+   order of the pads, the first pad of a part is its pin 1. */
+typedef struct {int group, seq, x, y, w, h;} place_pad;
+typedef struct {int x, y; char *text;} place_label;
+
+/* copper pour: closed polygons on a pour depth are zones which are filled
+   in RS274X mode. Copper of other nets and holes are cut out with the
+   clearance of the rule, pads of the zone net get thermal spokes. */
+#define MAXPOURS 8
+typedef struct {int depth; double clearance, spoke;} pour_rule;
+typedef struct {int rule, net, n; int *x, *y;} pour_zone;
+
+
+/* inner layer stackup: depths from 100 on are cut into blocks of 20, one
+   per inner layer, which are all written in a single parsing pass. The
+   first depth of a block is its knockout, as are 10 and 11 for all of
+   them; 15 and 16 go to all of them in transfer mode. */
+#define STACKBASE 100
+#define MAXSTACK 45 /* blocks up to the xfig depth limit of 999 */
+typedef struct {FILE *f, *clear;} stack_layer;
+
+/* streaming: with --stream all jobs are written in one pass over the
+   source. An object goes to each job whose layers hold its depth; the
+   punch content of RS274X gerber jobs is spilled to a temporary stream
+   and appended when the pass is done, as are jobs written to stdout. */
+#define MAXDEPTH 1000
+typedef struct {FILE *f, *clear, *out; int job, filetype, drill;
+    int *layers, *punch; layer_image *img, clearimg;
+    char dark[MAXDEPTH], knock[MAXDEPTH];} stream_job;
+
+/* coordinate pool: the points of an object are read into separate x[]
+   and y[] arrays and scaled in one go, which widens the extents of the
+   depth being interpreted on the way. Extents are in mil and kept per
+   depth for the whole conversion; --extents reports them, and any
+   coordinate beyond the 5 digit output format is warned about. */
+#define EXT_LIMIT 99999 /* X%05d in mil, X%06d in 0.1 mil */
+
+/* footprint cache: library figs compiled with --compile-library hold the
+   parsed objects of each footprint, moved to the origin of their extent
+   and classified for all file types. A top level compound of the board
+   with the same members (in any order and place) is parsed once; later
+   passes skip its text and splice in the cached objects, found by the
+   file position of the compound. A comment "footprint NAME" in front of
+   a compound restricts the match to that footprint. */
+#define FP_MAGIC "XFGFPL1"
+#define FP_NAMELEN 64
+typedef struct {obstruct ob; int kind[6]; int pts, npts, text;} fp_object;
+typedef struct {char name[FP_NAMELEN]; unsigned long long hash;
+    int nobj, npts, ntext; fp_object *obj; int *pts; char *text;} footprint;
+typedef struct {long pos, end; int fp, dx, dy;} fp_place;
+
+/* parallel tokenizer: with --parallel the body of the source is split
+   at object boundaries into a chunk per core, and the chunks are parsed
+   concurrently into tables of objects with their points and texts. The
+   tables are joined in file order, and the passes of do_parsing() read
+   the table instead of the file. Splines are left to the spline cache,
+   which reads their points from the file once. */
+#define BODY_OBJECT 0
+#define BODY_BLANK 1
+#define BODY_COMMENT 2 /* net or footprint tag, the line is in the text */
+typedef struct {obstruct ob; long pos, cont; int kind, pts, npts, text;}
+    body_entry;
+static int body_read(char *sourcename);
+static int body_find(long pos);
+static void body_free(void);
+
+/* window (--window): only objects whose box meets the window are
+   converted. The boxes of the objects of the table are sorted into the
+   buckets of a grid, so a window looks at the objects near it only; a
+   compound outside the window is dropped as a whole. With window_clip
+   the gerber layers are flattened and cut at the window edges. */
+static int window_parse(char *arg);
+static int window_select(void);
+static void board_setup(void);
+
+/* tessellated splines are kept in a cache keyed by their position in the
+   source file, so passes for further layers do not recompute them */
+typedef struct {long offset; int num; int *x, *y;} spline_entry;
+
+/* stroke font for text objects. Glyphs for ASCII 32..126 are drawn on a
+   grid with the base line at y=0, capital height 8, x height 5 and
+   descenders down to -3. Each glyph has a width and a list of strokes;
+   points are given as "x,y" separated by blanks, strokes by ';'. */
+#define FONT_CAPHEIGHT 8
+#define FONT_SPACING 2 /* extra advance between glyphs */
+typedef struct {int width; char *strokes;} font_glyph;
+static font_glyph stroke_font[95]={
+    {2,""},                                               /* space */
+    {0,"0,8 0,3;0,1 0,0"},                                /* ! */
+    {2,"0,8 0,6;2,8 2,6"},
+    {5,"1,0 2,8;3,0 4,8;0,2 5,2;0,6 5,6"},                 /* # */
+    {4,"4,7 3,8 1,8 0,7 0,5 1,4 3,4 4,3 4,1 3,0 1,0 0,1;2,9 2,-1"},
+    {4,"0,0 4,8;0,8 0,6 1,6 1,8 0,8;3,0 3,2 4,2 4,0 3,0"},   /* % */
+    {4,"4,0 0,6 0,7 1,8 2,8 3,7 3,6 0,3 0,1 1,0 2,0 4,3"},
+    {0,"0,8 0,6"},                                        /* ' */
+    {2,"2,9 1,8 0,6 0,2 1,0 2,-1"},
+    {2,"0,9 1,8 2,6 2,2 1,0 0,-1"},
+    {4,"2,7 2,1;0,6 4,2;0,2 4,6"},                         /* * */
+    {4,"2,6 2,2;0,4 4,4"},
+    {1,"1,1 1,0 0,-2"},                                   /* , */
+    {4,"0,4 4,4"},
+    {0,"0,1 0,0"},                                        /* . */
+    {4,"0,0 4,8"},
+    {4,"1,0 0,1 0,7 1,8 3,8 4,7 4,1 3,0 1,0;4,7 0,1"},       /* 0 */
+    {3,"0,6 2,8 2,0;0,0 3,0"},
+    {4,"0,7 1,8 3,8 4,7 4,5 0,0 4,0"},
+    {4,"0,7 1,8 3,8 4,7 4,5 3,4 1,4;3,4 4,3 4,1 3,0 1,0 0,1"},
+    {4,"3,0 3,8 0,2 4,2"},
+    {4,"4,8 0,8 0,4 3,4 4,3 4,1 3,0 1,0 0,1"},               /* 5 */
+    {4,"4,7 3,8 1,8 0,7 0,1 1,0 3,0 4,1 4,3 3,4 0,4"},
+    {4,"0,8 4,8 1,0"},
+    {4,"1,4 0,5 0,7 1,8 3,8 4,7 4,5 3,4 1,4 0,3 0,1 1,0 3,0 4,1 4,3 3,4"},
+    {4,"4,4 1,4 0,5 0,7 1,8 3,8 4,7 4,1 3,0 1,0 0,1"},
+    {0,"0,5 0,4;0,1 0,0"},                                /* : */
+    {1,"1,5 1,4;1,1 1,0 0,-2"},
+    {4,"4,7 0,4 4,1"},                                    /* < */
+    {4,"0,5 4,5;0,3 4,3"},
+    {4,"0,7 4,4 0,1"},
+    {4,"0,7 1,8 3,8 4,7 4,6 2,4 2,3;2,1 2,0"},              /* ? */
+    {5,"4,3 3,2 2,3 2,5 3,6 4,5 4,2 5,2 5,6 4,8 1,8 0,6 0,1 1,0 4,0"},
+    {4,"0,0 2,8 4,0;1,4 3,4"},                             /* A */
+    {4,"0,0 0,8 3,8 4,7 4,5 3,4 0,4;3,4 4,3 4,1 3,0 0,0"},
+    {4,"4,7 3,8 1,8 0,7 0,1 1,0 3,0 4,1"},
+    {4,"0,0 0,8 2,8 4,6 4,2 2,0 0,0"},
+    {4,"4,8 0,8 0,0 4,0;0,4 3,4"},                         /* E */
+    {4,"4,8 0,8 0,0;0,4 3,4"},
+    {4,"4,7 3,8 1,8 0,7 0,1 1,0 3,0 4,1 4,4 2,4"},
+    {4,"0,0 0,8;4,0 4,8;0,4 4,4"},
+    {2,"0,8 2,8;1,8 1,0;0,0 2,0"},
+    {4,"1,8 4,8;3,8 3,1 2,0 1,0 0,1"},                     /* J */
+    {4,"0,0 0,8;4,8 0,3;1,4 4,0"},
+    {4,"0,8 0,0 4,0"},
+    {4,"0,0 0,8 2,4 4,8 4,0"},
+    {4,"0,0 0,8 4,0 4,8"},
+    {4,"1,0 0,1 0,7 1,8 3,8 4,7 4,1 3,0 1,0"},             /* O */
+    {4,"0,0 0,8 3,8 4,7 4,5 3,4 0,4"},
+    {4,"1,0 0,1 0,7 1,8 3,8 4,7 4,1 3,0 1,0;2,2 4,0"},
+    {4,"0,0 0,8 3,8 4,7 4,5 3,4 0,4;2,4 4,0"},
+    {4,"4,7 3,8 1,8 0,7 0,5 1,4 3,4 4,3 4,1 3,0 1,0 0,1"},
+    {4,"0,8 4,8;2,8 2,0"},                                /* T */
+    {4,"0,8 0,1 1,0 3,0 4,1 4,8"},
+    {4,"0,8 2,0 4,8"},
+    {4,"0,8 1,0 2,4 3,0 4,8"},
+    {4,"0,0 4,8;0,8 4,0"},
+    {4,"0,8 2,4 4,8;2,4 2,0"},                             /* Y */
+    {4,"0,8 4,8 0,0 4,0"},
+    {2,"2,9 0,9 0,-1 2,-1"},                               /* [ */
+    {4,"0,8 4,0"},
+    {2,"0,9 2,9 2,-1 0,-1"},
+    {4,"0,5 2,8 4,5"},                                    /* ^ */
+    {4,"0,-1 4,-1"},
+    {1,"0,8 1,6"},
+    {4,"0,4 1,5 3,5 4,4 4,0;4,3 1,3 0,2 0,1 1,0 3,0 4,1"},   /* a */
+    {4,"0,8 0,0;0,3 2,5 3,5 4,4 4,1 3,0 2,0 0,2"},
+    {4,"4,4 3,5 1,5 0,4 0,1 1,0 3,0 4,1"},
+    {4,"4,8 4,0;4,3 2,5 1,5 0,4 0,1 1,0 2,0 4,2"},
+    {4,"0,3 4,3 4,4 3,5 1,5 0,4 0,1 1,0 4,0"},               /* e */
+    {3,"3,8 2,8 1,7 1,0;0,5 3,5"},
+    {4,"4,5 4,-2 3,-3 1,-3 0,-2;4,4 3,5 1,5 0,4 0,2 1,1 3,1 4,2"},
+    {4,"0,8 0,0;0,3 2,5 3,5 4,4 4,0"},
+    {0,"0,5 0,0;0,7 0,8"},
+    {2,"2,5 2,-2 1,-3 0,-3;2,7 2,8"},                       /* j */
+    {4,"0,8 0,0;4,5 0,2;1,3 4,0"},
+    {0,"0,8 0,0"},
+    {6,"0,5 0,0;0,4 1,5 2,5 3,4 3,0;3,4 4,5 5,5 6,4 6,0"},
+    {4,"0,5 0,0;0,3 2,5 3,5 4,4 4,0"},
+    {4,"1,0 0,1 0,4 1,5 3,5 4,4 4,1 3,0 1,0"},             /* o */
+    {4,"0,5 0,-3;0,3 2,5 3,5 4,4 4,1 3,0 2,0 0,2"},
+    {4,"4,5 4,-3;4,3 2,5 1,5 0,4 0,1 1,0 2,0 4,2"},
+    {3,"0,5 0,0;0,3 2,5 3,5"},
+    {4,"4,4 3,5 1,5 0,4 1,3 3,2 4,1 3,0 1,0 0,1"},
+    {3,"1,8 1,1 2,0 3,0;0,5 3,5"},                         /* t */
+    {4,"0,5 0,1 1,0 2,0 4,2;4,5 4,0"},
+    {4,"0,5 2,0 4,5"},
+    {4,"0,5 1,0 2,3 3,0 4,5"},
+    {4,"0,5 4,0;0,0 4,5"},
+    {4,"0,5 2,0;4,5 1,-3"},                               /* y */
+    {4,"0,5 4,5 0,0 4,0"},
+    {3,"3,9 2,8 2,5 0,4 2,3 2,0 3,-1"},                     /* { */
+    {0,"0,9 0,-1"},
+    {3,"0,9 1,8 1,5 3,4 1,3 1,0 0,-1"},
+    {4,"0,4 1,5 3,3 4,4"},                                /* ~ */
+};
+
+/* glyph stroke paths scaled to one font size are kept in a cache, so text
+   objects of the same size share the work. pen[] is 1 where a new stroke
+   starts. */
+typedef struct {int c, size, num, advance; int *x, *y; char *pen;} glyph_entry;
 
-int mode;   /* Filter mode */
-int i;      /* index variable */
-int aperture;
-int lastaction;   /* action flag: 0 discard, !0: keep */
 
 /* forward declarations */
-int ermsg(int ern);
+static int ermsg(int ern);
 int makedecision(obstruct *ob);
-void getpair(int *x, int *y);
-void rs_plot(int *x, int *y);
-void rs_drill(int *x, int *y);
-void drill_header(FILE *f);
-void tool_trailer(FILE *f);
-void drill_trailer(FILE *f);
-void gerber_header(FILE *f);
-void gerber_trailer(FILE *f);
-void RS274X_header_1(FILE *f, char *imagename);
-void RS274X_trailer_1(FILE *f);
-void RS274X_header_2(FILE *f, char *imagename);
-void RS274X_trailer_2(FILE *f);
-
-void rs_single(int *x);
-int get_tool_number(int radius);
-int get_route_tool(int width);
+static void getpair(int *x, int *y);
+static void getfloat(double *x);
+static spline_entry *get_spline(long offset, int closed, int npoints);
+static int decode_text(char *str, char *text, int max);
+static int render_text(FILE *f, obstruct *ob, char *text);
+static double rout_select(FILE *f, int width, int *actual_drill);
+static int rout_polyline(FILE *f, int *x, int *y, int n, int closed,
+			 double bit);
+static int rout_circle(FILE *f, int cx, int cy, int r, double bit);
+static void rout_bites(FILE *f);
+static void img_begin(layer_image *im, int kind, int aperture, int depth);
+static void img_point(layer_image *im, int x, int y);
+static void cap_begin(int kind, int aperture, int depth);
+static void cap_point(int x, int y);
+static void cap_arc(int cx, int cy, int ax, int ay, int ex, int ey, int cw);
+static void prim_size(primitive *p, double *w, double *h);
+static double stencil_size(double s);
+static void stencil_pool(int n);
+static stencil_entry *get_stencil(int ap);
+static void stencil_header(FILE *f);
+static void stencil_flash(FILE *f, int ap, int x, int y, int depth);
+static int clear_dcode(int ap);
+static clear_entry *clear_of(int dcode);
+static void clear_header(FILE *f);
+static int mask_layer(FILE *f, int jobtype, layer_image **src, int *cu, int n);
+static int preview_layers(layer_image *img, int num, char *root);
+static int drc_layers(char *sourcename, int knockouts, int punchflag);
+static int place_add_pad(int x, int y, int w, int h);
+static int net_id(char *name);
+static int pour_rule_of(int depth);
+static int pour_add_zone(int rule, int net, int *x, int *y, int n);
+static int pour_layer(FILE *f, int *layerlist);
+static int flatten_layer(FILE *f, int *layerlist, int *punchlist,
+			 int punchflag);
+static int flat_grow(void *p, int *max, int need, size_t size);
+static int stack_routes(int depth, int *route);
+static int stream_routes(int depth, int *route);
+static int stackup_layers(char *sourcename, char *root, int num,
+			  int RS274Xmode, int transfer, int punchflag);
+static int fp_place_of(long pos);
+static int fp_load(obstruct *o);
+#ifndef X2G_LIBRARY
+static int fp_compile(char *name, int num, char **files);
+#endif
+static int fp_read(char *name);
+static FILE *out_open(char *name, int job);
+static int out_close(FILE *f);
+static void out_discard(FILE *f);
+static int place_add_label(int x, int y, char *text);
+static int place_write(char *root);
+static int netlist_write(char *sourcename, char *root, int knockouts,
+			 int punchflag);
+static void rs_plot(int *x, int *y);
+static void rs_drill(int *x, int *y);
+static void rs_plot_n(int *restrict x, int *restrict y, int n);
+static void rs_drill_n(int *restrict x, int *restrict y, int n);
+static void rs_scale(int *x, int *y);
+static int get_points(int n);
+static int pool_load(int *x, int *y, int n);
+static void ext_reset(void);
+static int ext_report(int report);
+static void drill_header(FILE *f, char *format);
+static void tool_trailer(FILE *f);
+static void drill_trailer(FILE *f);
+static void gerber_header(FILE *f);
+static void gerber_trailer(FILE *f);
+static void RS274X_header_1(FILE *f, char *imagename);
+static void RS274X_trailer_1(FILE *f);
+static void RS274X_header_2(FILE *f, char *imagename);
+static void RS274X_trailer_2(FILE *f);
+
+static void rs_single(int *x);
+static int get_tool_number(int radius);
+static int get_route_tool(int width);
+static int stitch_add(int x0, int y0, int x1, int y1, int aperture);
+static void stitch_flush(FILE *f);
 /* produce one file collecting layers in layerlist (a list of ints, 
    terminated with -1) of filetype (1: drill file, 2: gerber file, 
    4: tool file) into the target stream. Has now an index for jobtype
    to indicate punch layer corrections if necessary by punchflag !=0
    */
-int do_parsing(int * layerlist, int filetype, FILE * target, int punchflag); 
+static int do_parsing(int * layerlist, int filetype, FILE * target,
+		      int punchflag);
 
 
 extern char *optarg;
@@ -487,120 +1009,371 @@ extern int optind, opterr, optopt;
 #define MAXPRINTLAYERS 100 /* max number of layers include in one file */
 #define DEFAULTRANGE 20 /* number of layers to collect per default */
 
-int main(int argc, char *argv[]){
-    int opt, i, i2, jobtype;
-    char sourcename[MAXFILNAMLEN]= "" ;
-    char targetname[MAXFILNAMLEN]="";
-    char outfileroot[MAXFILNAMLEN]=""; /* if different name root is wanted */
-    char layerfilename[MAXFILNAMLEN]=""; /* source layer file */
-    int outfilenumber;    /* number of target files to be produced */
-    int outfilejob[MAXOUTFILES];  /* type list of target files */
-    int layerlist[MAXPRINTLAYERS]; /* manual layer list, terminated with -1 */
-    int playerlist[2]; /* punch layer list or manual construction */
-    int layerrange = DEFAULTRANGE; /* manual layer list */
-    int layerstart=-1; /* manual layer start */
-    int transfermode_15 = 1; /* transfer behavior for layer 15 */
-    int RS274Xmode = 0;   /* if !=0, RS274X files instead if RS274D files */
-    int joinmode = 0;  /* join mode for solder masks */
-    int outfilemode = 0;
-    int Large_inner_insulation = 0; /* for making special inner pads */
+/* output files are written under a temporary name and renamed when they
+   are complete, so a viewer reloading them never reads half a file */
+#define MAXOUTOPEN 64
+typedef struct {int kind, fd; x2g_write_fn fn; void *user;} out_sink;
+typedef struct {FILE *f; char name[MAXFILNAMLEN+24], tmp[MAXFILNAMLEN+48];
+    out_sink sink; char *buf; size_t size; int member;} out_entry;
 
-    FILE *target;
-    FILE * layerfile; /* for reading in separate layers */
+/* fab bundle: with --bundle all files go into one archive, a zip (store
+   only) if its name ends in .zip and a tar otherwise. One zip member at a
+   time is streamed straight into the archive with its sizes after the
+   data; tar members and files open alongside are kept in memory until
+   they are complete. A manifest with the role of each file comes last. */
+#define X2G_SINK_BUNDLE 4
+typedef struct {char name[MAXFILNAMLEN]; const char *role;
+    unsigned long crc, size, offset; int flags, state; char *buf;}
+    bundle_member; /* state 0: open, 1: waiting in buf, 2: written */
+static int bundle_open(char *name);
+static int bundle_close(int failed);
+
+/* converter state: everything a conversion changes lives in the context,
+   grouped as the feature blocks above describe it. The functions reach
+   the state of the context being converted through st, which is kept per
+   thread, so contexts convert concurrently on different threads. */
+typedef struct {
+    int tool_counts[tool_number+1]; /* counts number of tool usages */
+
+    /* source being parsed */
+    FILE *infile;
+    char inbuffer[10000]; /* input read buffer */
+    char constring[1000];
+    char *ibb;
+    char *varp, *varpos; /* point tokens of constring */
+    obstruct ob; /* actual object structure */
+    int i; /* index variable */
+    int aperture;
+    int lastaction; /* action flag: 0 discard, !0: keep */
+
+    /* track stitching */
+    stitch_seg *stitch_segs;
+    int stitch_num, stitch_max;
+    int stitchmode;
+    int *sth_slot, *sth_head, *sth_deg, *sth_next, sth_mask; /* end points */
+    int *stp_x, *stp_y, stp_num; /* path under construction */
 
-    outfilenumber=0; /* start with no files */
+    /* contour routing: rout_bit (mil) overrides the tool found from the
+       line width. tab_num tabs of tab_width (mil) are left on closed
+       contours, and can be perforated with mouse bite holes which are
+       collected in bite_x/y and drilled after the contours. */
+    double rout_bit;
+    int rout_warned; /* last outline width without a tool of its own */
+    int tab_num;
+    double tab_width, bite_pitch, bite_dia;
+    int *bite_x, *bite_y, bite_num, bite_max;
+    int *ct_x, *ct_y, ct_n; /* closed polyline being routed */
+    double *ct_s, ct_len;   /* with its cumulative arc lengths */
+    int cc_x, cc_y, cc_r;   /* circle being routed */
 
+    /* images of the output files */
+    layer_image *capture; /* image to record into, or NULL */
+    int capture_clear; /* set while parsing the clear (punch) layer */
+    int preview_dpi; /* resolution of raster previews */
+    int slot_mode;
+    layer_image drill_buf;
+
+    /* stencils, clearances and masks */
+    stencil_entry stencil_cache[STENCIL_DCODE];
+    double stencil_percent, stencil_shrink;
+    double stencil_pane, stencil_web;
+    int stencil_defs; /* aperture header includes stencil openings */
+    clear_entry clear_cache[CLEAR_CLASSES][CLEAR_PADS];
+    double clear_mil[CLEAR_CLASSES];
+    int clear_mode;
+    int clear_class; /* class of the layer being written */
+    int clear_defs; /* aperture header includes clearance apertures */
+    /* solder masks: with --mask the mask jobs are written from the
+       primitives recorded by the copper jobs instead of parsing the copper
+       depths again. Pads get their aperture grown by the expansion, lines
+       a wider line aperture, and regions an outline of twice the
+       expansion. Openings closer than mask_web mil are joined. Depths only
+       the mask has are parsed. */
+    int mask_mode;
+    double mask_web;
+    layer_image *mask_src[2]; /* images of the copper jobs 2 and 3, if made */
+
+    /* placement list and net tags */
+    place_pad *place_pads;
+    int place_num, place_max;
+    place_label *place_labels;
+    int label_num, label_max;
+    int place_collect, place_format; /* 1: csv, 2: IPC style XY */
+    int compound_level, compound_id;
+    char **net_names;
+    int net_num;
+    /* net tags: a comment line "# net NAME" in front of an object (or of
+       a top level compound, for all its members) puts it into the net
+       NAME. obj_net is the net number of the object being parsed, 0 if
+       untagged. */
+    int pending_net, obj_net, compound_net;
+
+    /* copper pour and flattening */
+    pour_rule pour_rules[MAXPOURS];
+    int pour_num;
+    pour_zone *pour_zones;
+    int zone_num, zone_max;
+    int pour_collect; /* record zones instead of skipping them */
+    int flatten_mode; /* write gerber layers as non-overlapping regions */
+    int *win_tx, *win_ty, win_maxx, win_maxy; /* room for cut polygons */
+
+    /* inner layer stackup and streaming */
+    stack_layer stack_layers[MAXSTACK];
+    int stack_num; /* number of layers while routing, 0 otherwise */
+    int stack_transfer; /* route 15 and 16 to all inner layers */
+    int stack_knockout; /* route knockouts to the clear streams (RS274X) */
+    int stack_punchflag; /* insulation pads for the knockouts */
+    stream_job *stream_tab;
+    int stream_num; /* number of jobs while routing, 0 otherwise */
+    int stream_mode;
+    int stream_punchflag; /* insulation pads for the knockouts */
+    int stream_place; /* pads of the component copper to place list */
+
+    /* coordinate pool and extents */
+    int *pool_x, *pool_y, pool_max;
+    int ext_x0[MAXDEPTH], ext_y0[MAXDEPTH], ext_x1[MAXDEPTH], ext_y1[MAXDEPTH];
+    int ext_depth; /* depth of the object being interpreted */
+    int extents_mode;
+    int origin_mode; /* move the board corner to 0,0 */
+    int org_x, org_y; /* taken off all plot coordinates, mil */
+    int board_known; /* board box known before the jobs are written */
+    int board_x0, board_y0, board_x1, board_y1; /* in the output, mil */
+
+    /* footprint cache */
+    footprint *fp_lib;
+    int fp_num;
+    fp_place *fp_places;
+    int fp_place_num, fp_place_max;
+    char fp_tag[FP_NAMELEN]; /* footprint named in front of a compound */
+    footprint *fp_cur; /* footprint being spliced into do_parsing */
+    int fp_next, fp_dx, fp_dy;
+    int *fp_pts; /* points of a spliced object for getpair */
+    int *fp_buf, fp_buf_max;
+
+    /* parallel tokenizer and window */
+    body_entry *body_tab; /* NULL: parse from the file */
+    int body_num, body_next;
+    int *body_pts;
+    char *body_text;
+    int parallel_mode;
+    int window_mode, window_clip;
+    int win_x0, win_y0, win_x1, win_y1; /* window in xfig units */
+    double win_mx0, win_my0, win_mx1, win_my1; /* the same in mil */
+    char *win_keep; /* per entry of body_tab: convert it */
+
+    /* design rule check */
+    int drc_mode;
+    int netlist_mode; /* write an IPC-D-356 netlist */
+    double drc_width, drc_clearance, drc_ring, drc_holegap; /* limits, mil */
+
+    /* splines and text */
+    spline_entry *spline_cache;
+    int spline_cache_num, spline_cache_size;
+    double spline_tolerance; /* flatness tolerance in mil */
+    glyph_entry *glyph_cache;
+    int glyph_cache_num, glyph_cache_size;
+
+    /* output files and the fab bundle */
+    out_entry out_tab[MAXOUTOPEN];
+    FILE *bundle_f; /* archive being written, or NULL */
+    int bundle_zip;
+    unsigned long bundle_pos; /* bytes written to the archive */
+    time_t bundle_time;
+    bundle_member *bundle_dir;
+    int bundle_num, bundle_max;
+    int bundle_stream; /* zip member being streamed */
+
+    int watch_mode;
+} x2g_state;
+
+/* library interface: a context holds the options of one conversion, the
+   source (a file or a memory buffer), where each job writes to and the
+   converter state. Memory outputs stay with the context until it is
+   freed. */
+#define X2G_JOBS 16 /* entries of suffixlist */
+typedef struct {char *name, *data; size_t len;} out_memory;
+struct x2g_context {
+    char sourcename[MAXFILNAMLEN], outfileroot[MAXFILNAMLEN];
+    char libraryname[MAXFILNAMLEN], bundlename[MAXFILNAMLEN];
+    char diffname[MAXFILNAMLEN]; /* old source for --diff */
+    char *src_data; size_t src_len; /* memory source, or NULL */
+    int outfilenumber, outfilejob[MAXOUTFILES];
+    int layerlist[MAXPRINTLAYERS], playerlist[2];
+    int layerrange, layerstart, transfermode_15, stackup;
+    int RS274Xmode, joinmode, outfilemode, Large_inner_insulation;
+    layer_image images[MAXOUTFILES];
+    out_sink sinks[X2G_JOBS+1]; /* [0] for reports, [job+1] per job */
+    out_memory *mem; int mem_num;
+    x2g_state st;
+};
+static __thread x2g_context *x2g_cur=NULL; /* context being converted */
+static __thread x2g_state *st=NULL;        /* and its state */
+static void x2g_use(x2g_context *c);
+static FILE *src_open(char *name);
+static void src_close(FILE *f);
+static void options_default(x2g_context *c);
+static void x2g_reset(x2g_context *c);
+static int diff_boards(x2g_context *c);
+
+/* watch mode: a resident process keeps an index of the objects of the
+   source, hashed with their depth. On each save the index is compared
+   with the last one, and a child converts the jobs whose layers hold a
+   changed object. */
+typedef struct {unsigned long long hash; int depth;} watch_obj;
+#ifndef X2G_LIBRARY
+static int watch_source(char *sourcename, int *jobs, int *num, int *layerlist,
+			int *playerlist, int *stackup);
+#endif
+
+/* options without a short form */
+#define OPT_PREVIEW 256
+#define OPT_DRC 257
+#define OPT_NETLIST 258
+#define OPT_STENCIL_REDUCE 259
+#define OPT_STENCIL_PANE 260
+#define OPT_POUR 261
+#define OPT_FLATTEN 262
+#define OPT_STACKUP 263
+#define OPT_COMPILE_LIBRARY 264
+#define OPT_LIBRARY 265
+#define OPT_WATCH 266
+#define OPT_BUNDLE 267
+#define OPT_STREAM 268
+#define OPT_PARALLEL 269
+#define OPT_EXTENTS 270
+#define OPT_CLEARANCE 271
+#define OPT_MASK 272
+#define OPT_DIFF 273
+#define OPT_WINDOW 274
+#define OPT_SLOTS 275
+#define OPT_ORIGIN 276
+static struct option long_options[]={
+    {"preview", required_argument, NULL, OPT_PREVIEW},
+    {"drc", required_argument, NULL, OPT_DRC},
+    {"netlist", no_argument, NULL, OPT_NETLIST},
+    {"stencil-reduce", required_argument, NULL, OPT_STENCIL_REDUCE},
+    {"stencil-pane", required_argument, NULL, OPT_STENCIL_PANE},
+    {"pour", required_argument, NULL, OPT_POUR},
+    {"flatten", no_argument, NULL, OPT_FLATTEN},
+    {"stackup", required_argument, NULL, OPT_STACKUP},
+    {"compile-library", required_argument, NULL, OPT_COMPILE_LIBRARY},
+    {"library", required_argument, NULL, OPT_LIBRARY},
+    {"watch", no_argument, NULL, OPT_WATCH},
+    {"bundle", required_argument, NULL, OPT_BUNDLE},
+    {"stream", no_argument, NULL, OPT_STREAM},
+    {"parallel", no_argument, NULL, OPT_PARALLEL},
+    {"extents", no_argument, NULL, OPT_EXTENTS},
+    {"clearance", required_argument, NULL, OPT_CLEARANCE},
+    {"mask", required_argument, NULL, OPT_MASK},
+    {"diff", required_argument, NULL, OPT_DIFF},
+    {"window", required_argument, NULL, OPT_WINDOW},
+    {"slots", required_argument, NULL, OPT_SLOTS},
+    {"origin", no_argument, NULL, OPT_ORIGIN},
+    {NULL, 0, NULL, 0}
+};
+
+/* options into c, see x2g_options */
+static int options_parse(x2g_context *c, int argc, char **argv){
+    int opt, i;
+    char layerfilename[MAXFILNAMLEN]=""; /* source layer file */
+    double value; /* numeric option argument */
+    FILE * layerfile; /* for reading in separate layers */
+
+    options_default(c);
     /* try to interpret options */
+    optind=0; /* start over for each call */
     opterr=0; /* be quiet when there are no options */
-    while ((opt=getopt(argc, argv, "h123456789n:r:tTdDjJfFsSo:l:Xi")) != EOF) {
+    while ((opt=getopt_long(argc, argv,
+			    "h123456789n:r:tTdDjJfFsSpPkKo:l:Xime:cb:u:U:",
+			    long_options, NULL)) != EOF) {
 	switch (opt) {
 	    case 'h': /* print help text */
  		printf("print help text\n");
-		return 0;
+		return -1;
 	    case '1': /* drill and tool file */
-		if (outfilenumber>MAXOUTFILES) return -ermsg(11);
-		outfilejob[outfilenumber++]=1;
-		if (outfilenumber>MAXOUTFILES) return -ermsg(11);
-		outfilejob[outfilenumber++]=10;
+		if (c->outfilenumber>MAXOUTFILES) return -ermsg(11);
+		c->outfilejob[c->outfilenumber++]=1;
+		if (c->outfilenumber>MAXOUTFILES) return -ermsg(11);
+		c->outfilejob[c->outfilenumber++]=10;
 		break;
 	    case '2':case '3':case '4':case '5': /* create defined layers */
 	    case '6':case '7':case '8':case '9':
-		if (outfilenumber>MAXOUTFILES) return -ermsg(11);
-		outfilejob[outfilenumber++]=(opt-'0');
+		if (c->outfilenumber>MAXOUTFILES) return -ermsg(11);
+		c->outfilejob[c->outfilenumber++]=(opt-'0');
 		break;
 	    case 'r': /* set layer range to collect */
-		sscanf(optarg,"%d",&layerrange);
-		if ((layerrange<1) || (layerrange >(MAXPRINTLAYERS-2))) {
+		sscanf(optarg,"%d",&c->layerrange);
+		if ((c->layerrange<1) || (c->layerrange >(MAXPRINTLAYERS-2))) {
 		    return -ermsg(12);
 		}
 		break;
 	    case 'n': /* set start layer & setlayers */
-		sscanf(optarg,"%d",&layerstart);
-		if (layerstart<0) return -ermsg(13);
-		for (i=0;i<layerrange;i++) layerlist[i]=layerstart+i;
-		if (transfermode_15) layerlist[i++]=15;
-		layerlist[i++]=-1; /* terminate list */
-		if (outfilenumber>MAXOUTFILES) return -ermsg(11);
-		outfilejob[outfilenumber++]=0;
+		sscanf(optarg,"%d",&c->layerstart);
+		if (c->layerstart<0) return -ermsg(13);
+		for (i=0;i<c->layerrange;i++) c->layerlist[i]=c->layerstart+i;
+		if (c->transfermode_15) c->layerlist[i++]=15;
+		c->layerlist[i++]=-1; /* terminate list */
+		if (c->outfilenumber>MAXOUTFILES) return -ermsg(11);
+		c->outfilejob[c->outfilenumber++]=0;
 		break;
 	    case 't': /* switch on transfer of layer 15 */
-		transfermode_15=1;
+		c->transfermode_15=1;
 		break;
 	    case 'T': /* swizch off transfer mode */
-		transfermode_15=0;
+		c->transfermode_15=0;
 		break;
 	    case 'D': /* create bottom &top mask + top silk */
-		if (outfilenumber+2>MAXOUTFILES) return -ermsg(11);
-		if (joinmode) {
-		    outfilejob[outfilenumber++]=11; /* joint mask */
+		if (c->outfilenumber+2>MAXOUTFILES) return -ermsg(11);
+		if (c->joinmode) {
+		    c->outfilejob[c->outfilenumber++]=11; /* joint mask */
 		} else {
-		    outfilejob[outfilenumber++]=6; /* separate masks */
-		    outfilejob[outfilenumber++]=7;	
+		    c->outfilejob[c->outfilenumber++]=6; /* separate masks */
+		    c->outfilejob[c->outfilenumber++]=7;	
 		}
-		outfilejob[outfilenumber++]=8; /* silk layer */
+		c->outfilejob[c->outfilenumber++]=8; /* silk layer */
 	    case 'd': /* create hole, tool, top and bottom layer */
-		if (outfilenumber+2>MAXOUTFILES) return -ermsg(11);
-		outfilejob[outfilenumber++]=1;
-		outfilejob[outfilenumber++]=10;
-		outfilejob[outfilenumber++]=2;
-		outfilejob[outfilenumber++]=3;
+		if (c->outfilenumber+2>MAXOUTFILES) return -ermsg(11);
+		c->outfilejob[c->outfilenumber++]=1;
+		c->outfilejob[c->outfilenumber++]=10;
+		c->outfilejob[c->outfilenumber++]=2;
+		c->outfilejob[c->outfilenumber++]=3;
 		break;
-	    case 'j': /* set joinmode for soldermasks */
-		joinmode=1;
+	    case 'j': /* set c->joinmode for soldermasks */
+		c->joinmode=1;
 		break;
-	    case 'J': /* reset joinmode for soldermasks */
-		joinmode=0;
+	    case 'J': /* reset c->joinmode for soldermasks */
+		c->joinmode=0;
 		break;
 	    case 'F': /* four layer board w top&bott solder mask + topsilk */
-		if (outfilenumber+2>MAXOUTFILES) return -ermsg(11);
-		if (joinmode) {  
-		    outfilejob[outfilenumber++]=11;
+		if (c->outfilenumber+2>MAXOUTFILES) return -ermsg(11);
+		if (c->joinmode) {  
+		    c->outfilejob[c->outfilenumber++]=11;
 		} else {
-		    outfilejob[outfilenumber++]=6;
-		    outfilejob[outfilenumber++]=7;
+		    c->outfilejob[c->outfilenumber++]=6;
+		    c->outfilejob[c->outfilenumber++]=7;
 		}
-		outfilejob[outfilenumber++]=8;
+		c->outfilejob[c->outfilenumber++]=8;
 	    case 'f': /* simple four-layer board, like -12345 */
-		if (outfilenumber+5>MAXOUTFILES) return -ermsg(11);
-		outfilejob[outfilenumber++]=1;
-		outfilejob[outfilenumber++]=10;
-		outfilejob[outfilenumber++]=2;
-		outfilejob[outfilenumber++]=3;
-		outfilejob[outfilenumber++]=4;
-		outfilejob[outfilenumber++]=5;
+		if (c->outfilenumber+5>MAXOUTFILES) return -ermsg(11);
+		c->outfilejob[c->outfilenumber++]=1;
+		c->outfilejob[c->outfilenumber++]=10;
+		c->outfilejob[c->outfilenumber++]=2;
+		c->outfilejob[c->outfilenumber++]=3;
+		c->outfilejob[c->outfilenumber++]=4;
+		c->outfilejob[c->outfilenumber++]=5;
 		break;
 	    case 's':
-		if (outfilenumber>MAXOUTFILES) return -ermsg(11);
-		outfilejob[outfilenumber++]=8;
+		if (c->outfilenumber>MAXOUTFILES) return -ermsg(11);
+		c->outfilejob[c->outfilenumber++]=8;
 		break;
 	    case 'S':
-		if (outfilenumber>MAXOUTFILES) return -ermsg(11);
-		outfilejob[outfilenumber++]=9;
+		if (c->outfilenumber>MAXOUTFILES) return -ermsg(11);
+		c->outfilejob[c->outfilenumber++]=9;
 		break;
 	    case 'o': /* use separate outfile name */
-		outfilemode=1; /* special outfilemode */
-		strncpy(outfileroot,optarg,MAXFILNAMLEN-1);
-		outfileroot[MAXFILNAMLEN-1]=0; /* safe term */
+		c->outfilemode=1; /* special c->outfilemode */
+		strncpy(c->outfileroot,optarg,MAXFILNAMLEN-1);
+		c->outfileroot[MAXFILNAMLEN-1]=0; /* safe term */
 		break;
 	    case 'l': /* read layer list from file */
 		strncpy(layerfilename,optarg,MAXFILNAMLEN);
@@ -608,21 +1381,151 @@ int main(int argc, char *argv[]){
 		layerfile=fopen(layerfilename,"r");
 		if (!layerfile)  return -ermsg(14);
 		for (i=0;i<MAXPRINTLAYERS-1;i++) {
-		    if (1!=fscanf(layerfile,"%d",&layerlist[i])) break;
-		    if (layerlist[i]<0) return -ermsg(15);
+		    if (1!=fscanf(layerfile,"%d",&c->layerlist[i])) break;
+		    if (c->layerlist[i]<0) return -ermsg(15);
 		}
-		layerlist[i]=-1; /* term list */
-		playerlist[0]=layerlist[0];playerlist[1]=-1;
+		c->layerlist[i]=-1; /* term list */
+		c->playerlist[0]=c->layerlist[0];c->playerlist[1]=-1;
 		fclose(layerfile);
 		
-		if (outfilenumber>MAXOUTFILES) return -ermsg(11);
-		outfilejob[outfilenumber++]=0; /* arb list */
+		if (c->outfilenumber>MAXOUTFILES) return -ermsg(11);
+		c->outfilejob[c->outfilenumber++]=0; /* arb list */
 		break;
 	    case 'X':
-		RS274Xmode = 1; /* allow for knockout layers an X format */
+		c->RS274Xmode = 1; /* allow for knockout layers an X format */
 		break;
 	    case 'i':
-		Large_inner_insulation = 1;
+		c->Large_inner_insulation = 1;
+		break;
+	    case 'm':
+		st->stitchmode = 1; /* join line segments into paths */
+		break;
+	    case 'e': /* spline flatness tolerance */
+		sscanf(optarg,"%lf",&st->spline_tolerance);
+		if (st->spline_tolerance<0.01) return -ermsg(18);
+		break;
+	    case 'c': /* contour rout program and profile layer */
+		if (c->outfilenumber+2>MAXOUTFILES) return -ermsg(11);
+		c->outfilejob[c->outfilenumber++]=12;
+		c->outfilejob[c->outfilenumber++]=13;
+		break;
+	    case 'b': /* routing bit diameter */
+		sscanf(optarg,"%lf",&st->rout_bit);
+		if (st->rout_bit<1.0) return -ermsg(19);
+		break;
+	    case 'u': /* tabs */
+		if (2!=sscanf(optarg,"%d,%lf",&st->tab_num,&st->tab_width) ||
+		    st->tab_num<0 || st->tab_width<=0.0) return -ermsg(20);
+		break;
+	    case 'U': /* mouse bites */
+		if (2!=sscanf(optarg,"%lf,%lf",&st->bite_pitch,&st->bite_dia) ||
+		    st->bite_pitch<=0.0 || st->bite_dia<=0.0) return -ermsg(20);
+		break;
+	    case OPT_PREVIEW: /* raster previews and copper area */
+		sscanf(optarg,"%d",&st->preview_dpi);
+		if (st->preview_dpi<10 || st->preview_dpi>10000) return -ermsg(21);
+		break;
+	    case OPT_DRC: /* design rule check with limits w,c,a,h */
+		sscanf(optarg,"%lf,%lf,%lf,%lf",&st->drc_width,&st->drc_clearance,
+		       &st->drc_ring,&st->drc_holegap);
+		if (st->drc_width<0 || st->drc_clearance<0 || st->drc_ring<0 ||
+		    st->drc_holegap<0) return -ermsg(23);
+		st->drc_mode=1;
+		break;
+	    case OPT_NETLIST: /* IPC-D-356 netlist */
+		st->netlist_mode=1;
+		break;
+	    case 'p': /* paste stencils */
+	    case 'P':
+		if (c->outfilenumber>MAXOUTFILES) return -ermsg(11);
+		c->outfilejob[c->outfilenumber++]=(opt=='p')?14:15;
+		break;
+	    case 'k': /* placement list as csv or IPC style XY */
+	    case 'K':
+		st->place_format=(opt=='k')?1:2;
+		break;
+	    case OPT_STENCIL_REDUCE: /* percentage or mil per side */
+		if (1!=sscanf(optarg,"%lf",&value)) return -ermsg(26);
+		if (strchr(optarg,'%')) st->stencil_percent=value;
+		else st->stencil_shrink=value;
+		if (st->stencil_percent<0 || st->stencil_percent>=100 ||
+		    st->stencil_shrink<0) return -ermsg(26);
+		break;
+	    case OPT_STENCIL_PANE: /* max pane size, web width in mil */
+		if (2!=sscanf(optarg,"%lf,%lf",&st->stencil_pane,&st->stencil_web) ||
+		    st->stencil_pane<=0 || st->stencil_web<0) return -ermsg(26);
+		break;
+	    case OPT_POUR: /* pour depth, clearance and spoke width in mil */
+		if (st->pour_num==MAXPOURS) return -ermsg(29);
+		st->pour_rules[st->pour_num].clearance=10.0;
+		st->pour_rules[st->pour_num].spoke=10.0;
+		if (sscanf(optarg,"%d,%lf,%lf",&st->pour_rules[st->pour_num].depth,
+			   &st->pour_rules[st->pour_num].clearance,
+			   &st->pour_rules[st->pour_num].spoke)<1 ||
+		    st->pour_rules[st->pour_num].depth<0 ||
+		    st->pour_rules[st->pour_num].clearance<0 ||
+		    st->pour_rules[st->pour_num].spoke<=0) return -ermsg(29);
+		st->pour_num++;
+		break;
+	    case OPT_FLATTEN: /* union of the copper as plain regions */
+		st->flatten_mode=1;
+		break;
+	    case OPT_STACKUP: /* inner layers in blocks of 20 depths */
+		if (sscanf(optarg,"%d",&c->stackup)!=1 ||
+		    c->stackup<1 || c->stackup>MAXSTACK) return -ermsg(30);
+		break;
+	    case OPT_COMPILE_LIBRARY: /* footprint cache from library figs */
+		strncpy(c->libraryname,optarg,MAXFILNAMLEN-1);
+		c->libraryname[MAXFILNAMLEN-1]=0;
+		break;
+	    case OPT_LIBRARY: /* use a footprint cache */
+		if (fp_read(optarg)) return -ermsg(31);
+		break;
+	    case OPT_WATCH: /* stay resident, convert on each save */
+		st->watch_mode=1;
+		break;
+	    case OPT_BUNDLE: /* all files into one archive */
+		strncpy(c->bundlename,optarg,MAXFILNAMLEN-1);
+		c->bundlename[MAXFILNAMLEN-1]=0;
+		break;
+	    case OPT_STREAM: /* all jobs in one pass */
+		st->stream_mode=1;
+		break;
+	    case OPT_PARALLEL: /* tokenize the source on all cores */
+		st->parallel_mode=1;
+		break;
+	    case OPT_EXTENTS: /* report the extents of the layers */
+		st->extents_mode=1;
+		break;
+	    case OPT_ORIGIN: /* board corner to 0,0 */
+		st->origin_mode=1;
+		break;
+	    case OPT_CLEARANCE: /* outer[,inner] clearance in mil */
+		i=sscanf(optarg,"%lf,%lf",&st->clear_mil[0],&st->clear_mil[1]);
+		if (i==1) st->clear_mil[1]=st->clear_mil[0];
+		if (i<1 || st->clear_mil[0]<0 || st->clear_mil[1]<0 ||
+		    st->clear_mil[0]>1000 || st->clear_mil[1]>1000) return -ermsg(36);
+		st->clear_mode=1; c->Large_inner_insulation=1;
+		break;
+	    case OPT_MASK: /* expansion[,web] in mil */
+		st->mask_web=0.0;
+		i=sscanf(optarg,"%lf,%lf",&st->clear_mil[2],&st->mask_web);
+		if (i<1 || st->clear_mil[2]<0 || st->clear_mil[2]>100 || st->mask_web<0)
+		    return -ermsg(37);
+		st->mask_mode=1;
+		break;
+	    case OPT_DIFF: /* compare with an old revision */
+		strncpy(c->diffname,optarg,MAXFILNAMLEN-1);
+		c->diffname[MAXFILNAMLEN-1]=0;
+		break;
+	    case OPT_WINDOW: /* convert a part of the drawing */
+		if (window_parse(optarg)) return -ermsg(40);
+		if (st->window_clip) st->flatten_mode=1;
+		break;
+	    case OPT_SLOTS: /* how slots go into the drill file */
+		if (!strcmp(optarg,"g85")) st->slot_mode=SLOT_G85;
+		else if (!strcmp(optarg,"rout")) st->slot_mode=SLOT_ROUT;
+		else return -ermsg(42);
 		break;
 	    default:
 		break;
@@ -630,330 +1533,839 @@ int main(int argc, char *argv[]){
     }
 
     if (optind==argc-1) { /* try to read source name */
-	strncpy(sourcename,argv[optind],MAXFILNAMLEN);
-	sourcename[MAXFILNAMLEN-1]=0;
+	strncpy(c->sourcename,argv[optind],MAXFILNAMLEN);
+	c->sourcename[MAXFILNAMLEN-1]=0;
     };
+    return 0;
 
-    /* do the real work */
-    /* printf("outfiles: %d\n",outfilenumber); */
+}
 
-    for (i=0;i<outfilenumber;i++) {
-	jobtype=outfilejob[i];
-	/* open one particular output file */
-	strncpy(targetname,outfilemode?outfileroot:sourcename,MAXFILNAMLEN-1);
-	targetname[MAXFILNAMLEN-1]=0;
-	if (strncmp(targetname,"-",1)) {
-	    strncat(targetname,suffixlist[jobtype],MAXFILNAMLEN-1);
-	    targetname[MAXFILNAMLEN-1]=0;
-	    if (!(target=fopen(targetname,"w"))) return -ermsg(4);
-	} else {
-	    target=stdout;
+/* getopt keeps its place in globals, so one thread at a time reads
+   options */
+static pthread_mutex_t options_lock=PTHREAD_MUTEX_INITIALIZER;
+
+/* read the command line options into the context c. Returns 0, -1 if
+   there is nothing to convert, or an error number. */
+int x2g_options(x2g_context *c, int argc, char **argv){
+    int ret;
+    x2g_use(c);
+    pthread_mutex_lock(&options_lock);
+    ret=options_parse(c,argc,argv);
+    pthread_mutex_unlock(&options_lock);
+    return ret;
+}
+
+static int stream_jobs(x2g_context *c, int *place_done);
+
+/* open the output file of jobtype, stdout for "-" */
+static FILE *job_open(x2g_context *c, int jobtype){
+    char targetname[MAXFILNAMLEN]="";
+    char *root=c->outfilemode?c->outfileroot:c->sourcename;
+
+    if (st->bundle_f && !strncmp(root,"-",1)) root="stdin";
+    if (!strncmp(root,"-",1)) return stdout;
+    snprintf(targetname,sizeof(targetname),"%.*s%s",
+	     (int)(MAXFILNAMLEN-1-strlen(suffixlist[jobtype])),root,
+	     suffixlist[jobtype]);
+    return out_open(targetname,jobtype);
+}
+
+/* create destination header. Returns nonzero for a wrong file type. */
+static int job_header(x2g_context *c, FILE *target, int jobtype){
+    int i2;
+    switch(filetypetable[jobtype]){
+	case 1: /* drill file */
+	    drill_header(target, "Drill file");
+	    /* reset drill count */
+	case 4: 
+	    for (i2=0;i2<tool_number;i2++) st->tool_counts[i2]=0;
+	    break;
+	case 3: /* rout file */
+	    drill_header(target, "Rout file");
+	    break;
+	case 2: case 5: /* gerber file, stencil */
+	    st->stencil_defs=(filetypetable[jobtype]==5);
+	    st->clear_defs=st->clear_mode && c->RS274Xmode &&
+		filetypetable[jobtype]==2 && punchlayerlist[jobtype][0]>=0;
+	    st->clear_class=(jobtype==4 || jobtype==5);
+	    if (st->mask_mode && (jobtype==6 || jobtype==7 || jobtype==11)) {
+		st->clear_defs=1; st->clear_class=2;
+	    }
+	    if (c->RS274Xmode) {
+		RS274X_header_1(target, file_interpretation[jobtype]);
+	    } else {
+		gerber_header(target);
+	    }
+	    break;
+	default:
+	    return 1;
+    };
+    return 0;
+}
+
+/* create destination file trailer */
+static void job_trailer(x2g_context *c, FILE *target, int jobtype){
+    switch(filetypetable[jobtype]){
+	case 4: /* drill count file */
+	    tool_trailer(target);
+	    break;
+	case 2: case 5: /* gerber file trailer */
+	    if (c->RS274Xmode) {
+		RS274X_trailer_2(target); /* end layer 2 */
+	    } else {
+		gerber_trailer(target);
+	    }
+	    break;
+	case 1: case 3: /* drill and rout file trailer - add an M30 */
+	    drill_trailer(target);
+	    break;
+    };
+}
+
+/* append the rest of the temporary stream from to the stream to */
+static int stream_copy(FILE *from, FILE *to){
+    char buf[8192];
+    size_t n;
+    rewind(from);
+    while ((n=fread(buf,1,sizeof(buf),from))>0)
+	if (fwrite(buf,1,n,to)!=n) return 1;
+    return ferror(from);
+}
+
+/* append the primitives of image s to the image d */
+static void image_append(layer_image *d, layer_image *s){
+    primitive *p;
+    int k, n;
+    if (s->failed) d->failed=1;
+    st->capture=d;
+    for (k=0;k<s->num;k++) {
+	p=&s->prim[k];
+	st->capture_clear=p->clear;
+	cap_begin(p->kind,p->aperture,p->depth);
+	if (!d->failed) d->prim[d->num-1].net=p->net;
+	for (n=0;n<p->num;n++) cap_point(s->x[p->first+n],s->y[p->first+n]);
+    }
+    st->capture=NULL; st->capture_clear=0;
+}
+
+/* write all jobs in a single pass over the source, see stream_job.
+   Returns 0 or an error number as ermsg() does. */
+static int stream_jobs(x2g_context *c, int *place_done){
+    stream_job *s;
+    int k, n, ret=0;
+
+    st->stream_tab=calloc(c->outfilenumber+1,sizeof(stream_job));
+    if (!st->stream_tab) return ermsg(17);
+    for (n=0;n<c->outfilenumber;n++) {
+	s=&st->stream_tab[n];
+	s->job=c->outfilejob[n]; s->filetype=filetypetable[s->job];
+	s->drill=-1; /* no tool selected */
+	s->layers=s->job?readlayerlist[s->job]:&c->layerlist[1];
+	s->punch=s->job?punchlayerlist[s->job]:c->playerlist;
+	if (!(s->out=job_open(c,s->job))) {ret=ermsg(4); goto done;}
+	s->f=s->out; st->stream_num++;
+	if (s->out==stdout && !(s->f=tmpfile())) {ret=ermsg(4); goto done;}
+	if (c->RS274Xmode && s->filetype==2 && !(s->clear=tmpfile())) {
+	    ret=ermsg(4); goto done;
 	}
-	/* open infile */
-	if (strncmp(sourcename,"-",1)) {
-	    if (!(infile=fopen(sourcename,"r"))) return -ermsg(3);
-	} else {
-	    infile=stdin;
+	if (job_header(c,s->f,s->job)) {ret=ermsg(9); goto done;}
+	/* holes are found on any layer list */
+	if (s->filetype==1 || s->filetype==4) memset(s->dark,1,MAXDEPTH);
+	for (k=0;s->layers[k]>=0;k++)
+	    if (s->layers[k]<MAXDEPTH) s->dark[s->layers[k]]=1;
+	for (k=0;s->clear && s->punch[k]>=0;k++)
+	    if (s->punch[k]<MAXDEPTH) s->knock[s->punch[k]]=1;
+	/* keep the primitives of drill and gerber files for previews */
+	if (st->preview_dpi && s->filetype!=3 && s->filetype!=4) {
+	    s->img=&c->images[n]; s->img->jobtype=s->job;
+	}
+	if (st->place_format && s->job==2 && !*place_done) st->stream_place=1;
+    }
+
+    if (!(st->infile=src_open(c->sourcename))) {ret=ermsg(3); goto done;}
+    st->stream_punchflag=c->Large_inner_insulation?1:0;
+    ret=do_parsing(st->stream_tab[0].layers,st->stream_tab[0].filetype,
+		   st->stream_tab[0].f,0);
+    src_close(st->infile);
+    st->capture=NULL; st->capture_clear=0; st->place_collect=0;
+    if (st->stream_place) *place_done=1;
+    if (ret) goto done;
+
+    for (n=0;n<st->stream_num;n++) {
+	s=&st->stream_tab[n];
+	if (s->clear) { /* for X files, the punch layer as layer 2 */
+	    RS274X_trailer_1(s->f); /* end layer 1*/
+	    RS274X_header_2(s->f, file_interpretation[s->job]); /* layer2 */
+	    if (stream_copy(s->clear,s->f)) ret=ermsg(8);
+	}
+	job_trailer(c,s->f,s->job);
+	if (s->img) {
+	    image_append(s->img,&s->clearimg);
+	    if (s->img->failed && !ret) ret=ermsg(17);
 	}
+	if (s->f!=s->out && stream_copy(s->f,s->out) && !ret) ret=ermsg(8);
+    }
+ done:
+    for (n=0;n<st->stream_num;n++) {
+	s=&st->stream_tab[n];
+	if (s->clear) fclose(s->clear);
+	if (s->f!=s->out) fclose(s->f);
+	if (s->out==stdout) fflush(stdout);
+	else if (ret) out_discard(s->out);
+	else if (out_close(s->out)) ret=ermsg(8);
+	free(s->clearimg.prim); free(s->clearimg.x); free(s->clearimg.y);
+    }
+    free(st->stream_tab); st->stream_tab=NULL;
+    st->stream_num=0; st->stream_place=0;
+    return ret;
+}
+
+/* solder mask job from the copper of the jobs 2 and 3: their images of
+   this run, or else a pass which only records them. Returns nonzero
+   without memory. */
+static int mask_job(FILE *target, int jobtype){
+    layer_image own[2], *src[2], *saved=st->capture;
+    FILE *sink=NULL;
+    int cu[2], n=0, k, ret=0;
+
+    memset(own,0,sizeof(own));
+    if (jobtype!=7) cu[n++]=2;
+    if (jobtype!=6) cu[n++]=3;
+    for (k=0;k<n;k++) {
+	if ((src[k]=st->mask_src[cu[k]-2])) continue;
+	if (!sink && !(sink=fopen("/dev/null","w"))) {ret=1; break;}
+	src[k]=st->capture=&own[k]; st->capture_clear=0;
+	if (!fseek(st->infile,0L,SEEK_SET))
+	    do_parsing(readlayerlist[cu[k]],2,sink,0);
+	st->capture=saved;
+	if (own[k].failed) {ret=1; break;}
+    }
+    if (!ret) ret=mask_layer(target,jobtype,src,cu,n);
+    if (sink) fclose(sink);
+    for (k=0;k<2;k++) {free(own[k].prim); free(own[k].x); free(own[k].y);}
+    return ret;
+}
+
+/* write the files of all jobs and the reports */
+static int convert_jobs(x2g_context *c){
+    int i, jobtype, err;
+    char targetname[MAXFILNAMLEN]="";
+    int place_done=0; /* placement data collected */
+    FILE *target;
 
+    /* do the real work */
+    /* printf("outfiles: %d\n",c->outfilenumber); */
+
+    if (st->stream_mode && (i=stream_jobs(c,&place_done))) return -i;
+    st->mask_src[0]=st->mask_src[1]=NULL;
+    for (i=0;i<c->outfilenumber && !st->stream_mode;i++) {
+	jobtype=c->outfilejob[i];
+	/* open one particular output file */
+	if (!(target=job_open(c,jobtype))) return -ermsg(4);
+	/* open infile */
+	if (!(st->infile=src_open(c->sourcename))) {err=3; goto fail;}
 
 	/* new headers */
-  
-	/* create destination header */
-	switch(filetypetable[jobtype]){
-	    case 1: /* drill file */
-		drill_header(target);
-		/* reset drill count */
-	    case 4: 
-		for (i2=0;i2<tool_number;i2++) tool_counts[i2]=0;
-		break;
-	    case 2: /* gerber file */
-		if (RS274Xmode) {
-		    RS274X_header_1(target, file_interpretation[jobtype]);
-		} else {
-		    gerber_header(target);
-		}
-		break;
-	    default:
-		return -1; /* wrong file type */
-	};
+	if (job_header(c,target,jobtype)) {err=9; goto fail;}
 
 	/* printf("jobtype: %d\n",jobtype); */
-	if (fseek(infile,0L,SEEK_SET)) return -ermsg(16); /* rewind */	
+	if (fseek(st->infile,0L,SEEK_SET)) {err=16; goto fail;} /* rewind */
+
+	/* keep the primitives of drill and gerber files for previews */
+	st->capture=NULL; st->capture_clear=0;
+	if ((st->preview_dpi && (filetypetable[jobtype]==1 ||
+			     filetypetable[jobtype]==2 ||
+			     filetypetable[jobtype]==5)) ||
+	    (st->mask_mode && !st->flatten_mode && (jobtype==2 || jobtype==3))) {
+	    st->capture=&c->images[i];
+	    st->capture->jobtype=jobtype;
+	}
+	/* copper pour zones go below the copper of the layer */
+	if (st->pour_num && !st->flatten_mode && filetypetable[jobtype]==2 &&
+	    pour_layer(target,jobtype?readlayerlist[jobtype]:&c->layerlist[1]))
+	    {err=17; goto fail;}
 
-	do_parsing((jobtype?readlayerlist[jobtype]:&layerlist[1]),
-		   filetypetable[jobtype], target, 0);
+	/* the placement list comes with the component copper */
+	if (st->place_format && jobtype==2 && !place_done) st->place_collect=1;
+	if (st->mask_mode && (jobtype==6 || jobtype==7 || jobtype==11)) {
+	    if (mask_job(target,jobtype)) {err=17; goto fail;}
+	} else if (st->flatten_mode && filetypetable[jobtype]==2) {
+	    /* the knockouts are applied here; the clear layer stays empty */
+	    if (flatten_layer(target,
+			      jobtype?readlayerlist[jobtype]:&c->layerlist[1],
+			      c->RS274Xmode?(jobtype?punchlayerlist[jobtype]:
+					  c->playerlist):NULL,
+			      c->Large_inner_insulation?1:0))
+		{err=17; goto fail;}
+	} else {
+	    do_parsing((jobtype?readlayerlist[jobtype]:&c->layerlist[1]),
+		       filetypetable[jobtype], target, 0);
+	}
+	if (st->place_collect) place_done=1;
+	st->place_collect=0;
 	/* close text files for this round */
-	if (RS274Xmode && (filetypetable[jobtype]==2)) { 
+	if (c->RS274Xmode && (filetypetable[jobtype]==2)) { 
             /* for X files, go for second round */
 	    RS274X_trailer_1(target); /* end layer 1*/
-	    if (fseek(infile,0L,SEEK_SET)) return -ermsg(16); /* rewind */
+	    if (fseek(st->infile,0L,SEEK_SET)) {err=16; goto fail;} /* rewind */
 	    RS274X_header_2(target, file_interpretation[jobtype]); /* layer2 */
+	    st->capture_clear=1;
 	    /* go for second run */
-	    do_parsing((jobtype?punchlayerlist[jobtype]:playerlist),
-		       filetypetable[jobtype], target,
-		       Large_inner_insulation?1:0);
+	    if (!st->flatten_mode || filetypetable[jobtype]!=2)
+		do_parsing((jobtype?punchlayerlist[jobtype]:c->playerlist),
+			   filetypetable[jobtype], target,
+			   c->Large_inner_insulation?1:0);
 	}
 
 	/* create destination file trailers */
-	switch(filetypetable[jobtype]){
-	    case 4: /* drill count file */
-		tool_trailer(target);
-		break;
-	    case 2: /* gerber file trailer */
-		if (RS274Xmode) {
-		    RS274X_trailer_2(target); /* end layer 2 */
-		} else {
-		    gerber_trailer(target);
-		}
-		break;
-	    case 1: /* drill file trailer - add an M30 */
-		drill_trailer(target);
-		break;
-	};
-  
-	if (strncmp(sourcename,"-",1)) fclose(infile);
-	fclose(target);
+	job_trailer(c,target,jobtype);
+	src_close(st->infile);
+	if (target==stdout) fflush(target);
+	else if (out_close(target)) return -ermsg(8);
+	if (st->capture && st->capture->failed) return -ermsg(17);
+	if (st->capture && st->mask_mode && (jobtype==2 || jobtype==3))
+	    st->mask_src[jobtype-2]=st->capture; /* for the solder masks */
+	st->capture=NULL;
 	/* printf("bla; i: %d\n",i); */
     }
     /* all files are produced. */
+    strncpy(targetname,c->outfilemode?c->outfileroot:c->sourcename,
+	    MAXFILNAMLEN-1);
+    targetname[MAXFILNAMLEN-1]=0; /* name root of the reports */
+    if (!strncmp(targetname,"-",1)) strcpy(targetname,"stdin");
+    if (c->stackup) {
+	if ((i=stackup_layers(c->sourcename,targetname,c->stackup,
+			      c->RS274Xmode,c->transfermode_15,
+			      c->Large_inner_insulation?1:0)))
+	    return -i;
+    }
+    if (st->preview_dpi) {
+	if (preview_layers(c->images,c->outfilenumber,targetname))
+	    return -ermsg(22);
+    }
+    if (st->place_format) {
+	if (!place_done) { /* no component copper made: extra pass */
+	    if (!(st->infile=src_open(c->sourcename))) return -ermsg(3);
+	    if (!(target=fopen("/dev/null","w"))) {
+		src_close(st->infile); return -ermsg(27);
+	    }
+	    st->place_collect=1;
+	    if (!fseek(st->infile,0L,SEEK_SET))
+		do_parsing(readlayerlist[2],filetypetable[2],target,0);
+	    st->place_collect=0;
+	    fclose(target);
+	    src_close(st->infile);
+	}
+	if (place_write(targetname)) return -ermsg(27);
+    }
+    if (st->netlist_mode) {
+	if (netlist_write(c->sourcename,targetname,c->RS274Xmode,
+			  c->Large_inner_insulation?1:0)) return -ermsg(25);
+    }
+    if (st->drc_mode) {
+	i=drc_layers(c->sourcename,c->RS274Xmode,
+		     c->Large_inner_insulation?1:0);
+	if (i<0) return -ermsg(17);
+	if (i>0) return -ermsg(24);
+    }
     return 0;
+
+ fail: /* a job which cannot be completed leaves no file behind */
+    if (st->infile) src_close(st->infile);
+    if (target!=stdout) out_discard(target);
+    st->capture=NULL; st->place_collect=0;
+    return -ermsg(err);
+}
+
+/* produce all output files of the context c. Returns 0 or an
+   error number. */
+int x2g_convert(x2g_context *c){
+    int ret=0;
+
+    x2g_use(c);
+    if (st->pour_num && !c->RS274Xmode) return -ermsg(28);
+    if (st->stream_mode &&
+	(st->stitchmode || st->pour_num || st->flatten_mode || st->mask_mode))
+	return -ermsg(35);
+    /* the check parses the source again after the jobs */
+    if (st->drc_mode && !c->src_data &&
+	(!strncmp(c->sourcename,"-",1) || !c->sourcename[0]))
+	return -ermsg(43);
+    x2g_reset(c);
+    st->org_x=st->org_y=0; st->board_known=0;
+    if ((st->parallel_mode || st->window_mode || st->origin_mode ||
+	 c->diffname[0]) && (ret=body_read(c->sourcename))) return -ret;
+    if (st->window_mode && (ret=window_select())) {body_free(); return -ret;}
+    if (st->body_tab) board_setup();
+    if (c->bundlename[0] && bundle_open(c->bundlename)) ret=-ermsg(33);
+    if (!ret && c->diffname[0]) {
+	ret=diff_boards(c);
+    } else if (!ret) {
+	ret=convert_jobs(c);
+	if (!ret) ext_report(st->extents_mode); /* a warning only */
+    }
+    if (st->bundle_f && bundle_close(ret) && !ret) ret=-ermsg(33);
+    body_free();
+    return ret;
+}
+
+#ifndef X2G_LIBRARY
+int main(int argc, char *argv[]){
+    x2g_context *c;
+    int ret;
+
+    if (!(c=x2g_new())) return -ermsg(17);
+    ret=x2g_options(c,argc,argv);
+    if (ret<0) { /* help only */
+	ret=0;
+    } else if (!ret && c->libraryname[0]) {
+	/* the library figs are the remaining arguments */
+	ret=-fp_compile(c->libraryname,argc-optind,argv+optind);
+    } else if (!ret) {
+	/* only child processes come back, with the jobs to be done */
+	if (st->watch_mode && c->bundlename[0]) ret=-ermsg(34);
+	else if (st->watch_mode && (!strncmp(c->sourcename,"-",1) ||
+				!c->sourcename[0] ||
+				(c->outfilemode &&
+				 !strncmp(c->outfileroot,"-",1)) ||
+				watch_source(c->sourcename,c->outfilejob,
+					     &c->outfilenumber,c->layerlist,
+					     c->playerlist,&c->stackup)))
+	    ret=-ermsg(32);
+	if (!ret) ret=x2g_convert(c);
+    }
+    x2g_free(c);
+    return ret;
 }
+#endif
 
 /* do parsing; params: *layerlist contains layers to be considered and is
    a list terminated with -1, filetype is 1: drill, 2: gerber, 4: toolcnt;
    target is the (open) target file handle. This routine does not distinguish
    between a 274D file and the different 274X layers. punchflag to indicate
    possible special treatment for punch layer */
-int do_parsing(int *layerlist, int filetype, FILE * target, int punchflag) {
-  int k,x,y,xmin,xmax,ymin,ymax,padnum;
+static int do_parsing(int *layerlist, int filetype, FILE * target,
+		      int punchflag) {
+  int k,n,x,y,xmin,xmax,ymin,ymax,padnum;
   int difx,dify;
   int actual_drill=-1; /* no tool selected */
   int apindex;
   int target_aperture; /* for dealing with special requirements in inner
 			  layers for insulation */
+  long objpos=0; /* file position of a spline object */
+  long contpos=0; /* continuation lines of an object on several layers */
+  long linepos=0;
+  int *ptsave=NULL;
+  obstruct obsave;
+  int route[2*MAXOUTFILES], nroute=1, rt=0;
+  stream_job *sj=NULL;
+  body_entry *be=NULL; /* object of the table, if there is one */
+  int *rx, *ry; /* contour points */
+  double bit; /* routing bit diameter */
+  spline_entry *spl=NULL;
 
   /* reading of header of source file */
-  if (fgets(inbuffer,10000,infile)==NULL) return ermsg(6);
+  if (fgets(st->inbuffer,10000,st->infile)==NULL) return ermsg(6);
   /* changed strcmp to strncmp to be compatible with 3.2.5 plus comment */
-  if (strncmp(inbuffer,"#FIG 3.2",8)!=0) {printf(">%s<",inbuffer);return ermsg(7);};
+  if (strncmp(st->inbuffer,"#FIG 3.2",8)!=0) {
+    printf(">%s<",st->inbuffer);return ermsg(7);};
   
   /* read rest of header */
-  for (i=0;i<8;i++){
-   if (fgets(inbuffer,10000,infile)==NULL) return ermsg(6);
+  for (st->i=0;st->i<8;st->i++){
+   if (fgets(st->inbuffer,10000,st->infile)==NULL) return ermsg(6);
   };  
 
   /* main conversion loop */
-  lastaction=0;
-  while (feof(infile)==0){
-    if (fgets(inbuffer,10000,infile)==NULL) {
-      if (feof(infile)) break;
-      return ermsg(6);
-    };
+  st->lastaction=0;
+  st->compound_level=st->compound_id=0;
+  st->pending_net=st->obj_net=st->compound_net=0;
+  st->fp_cur=NULL; st->fp_pts=NULL; st->fp_tag[0]=0;
+  st->body_next=0;
+  while (st->body_tab?st->body_next<st->body_num:feof(st->infile)==0){
+    if (st->fp_cur) { /* objects of a cached footprint */
+      if (st->fp_next<st->fp_cur->nobj) {
+	if (fp_load(&st->ob)) return ermsg(17);
+	st->obj_net=st->compound_net;
+	goto interpret;
+      }
+      st->fp_cur=NULL; st->fp_pts=NULL; st->compound_level=0;
+    }
+    if (st->body_tab) { /* tokenized in advance */
+      be=&st->body_tab[st->body_next++];
+      if (st->win_keep && !st->win_keep[st->body_next-1]) { /* outside window */
+	st->pending_net=0; st->fp_tag[0]=0;
+	continue;
+      }
+      linepos=be->pos;
+      if (be->kind==BODY_OBJECT) st->inbuffer[0]=0;
+      else strcpy(st->inbuffer,
+		  (be->kind==BODY_BLANK)?"\n":st->body_text+be->text);
+    } else {
+      linepos=ftell(st->infile);
+      if (fgets(st->inbuffer,10000,st->infile)==NULL) {
+	if (feof(st->infile)) break;
+	return ermsg(6);
+      };
+    }
     /* printf("read:%s",inbuffer); */
-    if (inbuffer[0]=='\n') {fprintf(target,"\n");continue;};
+    if (st->inbuffer[0]=='\n') {
+      if (!st->stream_num) fprintf(target,"\n");
+      for (k=0;k<st->stream_num;k++) { /* to all jobs, as in separate passes */
+	fprintf(st->stream_tab[k].f,"\n");
+	if (st->stream_tab[k].clear) fprintf(st->stream_tab[k].clear,"\n");
+      }
+      continue;
+    };
     /* ignore comment lines */
-    if (inbuffer[0]=='#') {continue;};
-    if ((inbuffer[0]==' ')||(inbuffer[0]=='\t')){  /* continuation line ? */
-      if (lastaction!=0) { /* copy if interesting command */
-	i=i;
+    if (st->inbuffer[0]=='#') { /* net tags for the next object */
+      if (!strncmp(st->inbuffer,"# net ",6)) {
+	st->ibb=strtok_r(st->inbuffer+6," \t\n",&st->varpos);
+	if (st->ibb && (st->pending_net=net_id(st->ibb))<0) return ermsg(17);
+      } else if (!strncmp(st->inbuffer,"# footprint ",12)) {
+	st->ibb=strtok_r(st->inbuffer+12," \t\n",&st->varpos);
+	if (st->ibb) {
+	  strncpy(st->fp_tag,st->ibb,FP_NAMELEN-1); st->fp_tag[FP_NAMELEN-1]=0;
+	}
+      }
+      continue;
+    };
+    if ((st->inbuffer[0]==' ')||(st->inbuffer[0]=='\t')){ /* continuation ? */
+      if (st->lastaction!=0) { /* copy if interesting command */
+	st->i=st->i;
       };
     } else {
       /* get object class */
-      sscanf(inbuffer,"%d",&ob.class);
-      ibb=inbuffer;
-      switch (ob.class){
-      case 1:
-	/* circles */
-	sscanf(strtok(ibb," "),"%d",&i);
-	sscanf(strtok(NULL," "),"%d",&ob.type);
-	sscanf(strtok(NULL," "),"%d",&ob.type2);
-	sscanf(strtok(NULL," "),"%d",&ob.width);
-	sscanf(strtok(NULL," "),"%d",&ob.pencolor);
-	sscanf(strtok(NULL," "),"%d",&ob.fillcolor);
-	sscanf(strtok(NULL," "),"%d",&ob.depth);
-	sscanf(strtok(NULL," "),"%d",&ob.utype1);
-	sscanf(strtok(NULL," "),"%d",&ob.fillmode);
-	sscanf(strtok(NULL," "),"%f",&ob.float1);
-	sscanf(strtok(NULL," "),"%d",&ob.int11);
-	sscanf(strtok(NULL," "),"%f",&ob.float2);
-	sscanf(strtok(NULL," "),"%d",&ob.cx1);
-	sscanf(strtok(NULL," "),"%d",&ob.cx2);
-	sscanf(strtok(NULL," "),"%d",&ob.r1);
-	sscanf(strtok(NULL," "),"%d",&ob.r2);
-	ibb=strtok(NULL,"\n");   /* get rest... */
-	break;
-	
-      case 2:
-	/* lines */
-	sscanf(strtok(ibb," "),"%d",&i);
-	sscanf(strtok(NULL," "),"%d",&ob.type);
-	sscanf(strtok(NULL," "),"%d",&ob.type2);
-	sscanf(strtok(NULL," "),"%d",&ob.width);
-	sscanf(strtok(NULL," "),"%d",&ob.pencolor);
-	sscanf(strtok(NULL," "),"%d",&ob.fillcolor);
-	sscanf(strtok(NULL," "),"%d",&ob.depth);
-	sscanf(strtok(NULL," "),"%d",&ob.utype1);
-	sscanf(strtok(NULL," "),"%d",&ob.fillmode);
-	sscanf(strtok(NULL," "),"%f",&ob.float1);
-	sscanf(strtok(NULL," "),"%d",&ob.int11);
-	sscanf(strtok(NULL," "),"%d",&ob.int12);
-	sscanf(strtok(NULL," "),"%d",&ob.int13);
-	sscanf(strtok(NULL," "),"%d",&ob.int14);
-	sscanf(strtok(NULL," "),"%d",&ob.int15);
-	sscanf(strtok(NULL," "),"%d",&ob.int16);
-	/* ibb=strtok(NULL,"\n"); */  /* get rest... */
-	break;
-
-      case 5:
-	/* arcs */
-	sscanf(strtok(ibb," "),"%d",&i);
-	sscanf(strtok(NULL," "),"%d",&ob.type);
-	sscanf(strtok(NULL," "),"%d",&ob.type2);
-	sscanf(strtok(NULL," "),"%d",&ob.width);
-	sscanf(strtok(NULL," "),"%d",&ob.pencolor);
-	sscanf(strtok(NULL," "),"%d",&ob.fillcolor);
-	sscanf(strtok(NULL," "),"%d",&ob.depth);
-	sscanf(strtok(NULL," "),"%d",&ob.utype1);
-	sscanf(strtok(NULL," "),"%d",&ob.fillmode);
-	sscanf(strtok(NULL," "),"%f",&ob.float1);
-	sscanf(strtok(NULL," "),"%d",&ob.int11);
-	sscanf(strtok(NULL," "),"%d",&ob.int12);
-	sscanf(strtok(NULL," "),"%d",&ob.int13);
-	sscanf(strtok(NULL," "),"%d",&ob.int14);
-	sscanf(strtok(NULL," "),"%f",&ob.fx1);
-	sscanf(strtok(NULL," "),"%f",&ob.fx2);
-	sscanf(strtok(NULL," "),"%d",&ob.ax1);
-	sscanf(strtok(NULL," "),"%d",&ob.ax2);
-	sscanf(strtok(NULL," "),"%d",&ob.mx1);
-	sscanf(strtok(NULL," "),"%d",&ob.mx2);
-	sscanf(strtok(NULL," "),"%d",&ob.ex1);
-	sscanf(strtok(NULL," "),"%d",&ob.ex2);
-	/* ibb=strtok(NULL,"\n"); */  /* get rest... */
-	/* convert center position into int */
-	ob.cx1=(int)ob.fx1; ob.cx2=(int)ob.fx2;
-	break;
-
-      default: /* ignore unknown objects */
-	lastaction=1;
-      };
+      if (be) st->ob.class=be->ob.class;
+      else sscanf(st->inbuffer,"%d",&st->ob.class);
+      st->ibb=st->inbuffer;
+      if (st->ob.class==6 && !st->compound_level && st->fp_num && linepos>=0 &&
+	  (!be || !fseek(st->infile,be->cont,SEEK_SET)) &&
+	  (k=fp_place_of(linepos))>=0) { /* cached footprint */
+	st->compound_level=1; st->compound_id++;
+	st->compound_net=st->pending_net; st->pending_net=0; st->fp_tag[0]=0;
+	st->fp_cur=&st->fp_lib[st->fp_places[k].fp]; st->fp_next=0;
+	st->fp_dx=st->fp_places[k].dx; st->fp_dy=st->fp_places[k].dy;
+	if (fseek(st->infile,st->fp_places[k].end,SEEK_SET)) return ermsg(16);
+	if (be) st->body_next=body_find(st->fp_places[k].end);
+	continue;
+      }
+      st->fp_tag[0]=0;
+      if (st->ob.class==6) { /* compounds group the pads of a part */
+	if (!st->compound_level++) {
+	  st->compound_id++; st->compound_net=st->pending_net;
+	}
+      } else if (st->ob.class==-6 && st->compound_level>0) {
+	st->compound_level--;
+      }
+      st->obj_net=st->pending_net?st->pending_net:
+	(st->compound_level?st->compound_net:0);
+      st->pending_net=0;
+      if (st->ob.class==3) /* splines: remember where they are for the cache */
+	objpos=be?be->pos:ftell(st->infile)-strlen(st->inbuffer);
+      if (be) { /* points are served to getpair */
+	st->ob=be->ob;
+	st->ibb=(be->text>=0)?st->body_text+be->text:NULL;
+	st->fp_pts=(be->npts>0)?st->body_pts+be->pts:NULL;
+	if ((st->ob.class==3 || be->npts<0) && fseek(st->infile,be->cont,SEEK_SET))
+	  return ermsg(16);
+      } else if (parse_object(&st->ob,st->ibb)) st->lastaction=1;
       
+    interpret:
+      st->ext_depth=st->ob.depth;
+      /* component indices for the placement list */
+      if ((st->place_collect || st->stream_place) && st->ob.class==4 &&
+	  st->ob.depth==4 && st->ibb) {
+	x=st->ob.cx1; y=st->ob.cx2; rs_plot(&x,&y);
+	if (place_add_label(x,y,st->ibb)) return ermsg(17);
+      }
+      /* stackup: an object may go to several inner layers, the object
+	 is interpreted again from its saved state for each of them */
+      if (st->stack_num || st->stream_num) {
+	nroute=st->stack_num?stack_routes(st->ob.depth,route):
+	  stream_routes(st->ob.depth,route);
+	obsave=st->ob; contpos=ftell(st->infile); ptsave=st->fp_pts;
+      }
+      rt=0;
+    next_route:
+      if (st->stack_num && nroute) {
+	if (route[rt]&1) {
+	  target=st->stack_layers[route[rt]>>1].clear; punchflag=st->stack_punchflag;
+	} else {
+	  target=st->stack_layers[route[rt]>>1].f; punchflag=0;
+	}
+      } else if (st->stream_num && nroute) { /* state of the job */
+	sj=&st->stream_tab[route[rt]>>1];
+	filetype=sj->filetype; actual_drill=sj->drill;
+	st->place_collect=st->stream_place && sj->job==2 && !(route[rt]&1);
+	st->capture_clear=route[rt]&1;
+	if (st->capture_clear) {
+	  target=sj->clear; layerlist=sj->punch; punchflag=st->stream_punchflag;
+	  st->clear_class=(sj->job==4 || sj->job==5);
+	  st->capture=sj->img?&sj->clearimg:NULL;
+	} else {
+	  target=sj->f; layerlist=sj->layers; punchflag=0;
+	  st->capture=sj->img;
+	}
+      }
       /* do interpretation */
-      i=whattodo(&ob, layerlist, filetype);
-      switch(i){ /* aperture selection */
-	  case 2: case 3: case 4: case 5: case 7:
-	aperture=ob.width+20;
-	if (aperture>maxaperture+20) aperture=maxaperture+20;
-	if (aperture<20) aperture=20;
-	fprintf(target,"G54D%02d*\n",aperture);
+      if (st->fp_cur) { /* classified in the footprint cache */
+	st->i=st->fp_cur->obj[st->fp_next-1].kind[filetype];
+	if (filetype!=1 && filetype!=4) {
+	  for (k=0;layerlist[k]>=0 && layerlist[k]!=st->ob.depth;k++);
+	  if (layerlist[k]<0) st->i=0;
+	}
+      } else {
+	st->i=whattodo(&st->ob, layerlist, filetype);
+      }
+      if (!nroute) st->i=0;
+      /* polygons on pour depths are zones, not copper */
+      if (st->i && st->pour_num && filetype==2 && pour_rule_of(st->ob.depth)>=0)
+	  st->i=(st->pour_collect && st->ob.class==2 &&
+		 st->ob.type>1 && st->ob.type<4)?18:0;
+      /* stitched lines get their aperture selected when flushed */
+      if ((st->i==2) && st->stitchmode && (st->ob.int16>1)) st->i=9;
+      /* a spline of less than two points has no curve: left out */
+      if ((st->i==10 || st->i==11) && st->ob.int16<2) st->i=0;
+      if (st->i==10 || st->i==11) { /* splines: fetch tessellated points */
+	spl=get_spline(objpos,st->ob.type&1,st->ob.int16);
+	if (!spl) return ermsg(17);
+	if (st->i==10) {
+	  st->aperture=st->ob.width+20;
+	  if (st->aperture>maxaperture+20) st->aperture=maxaperture+20;
+	  if (st->aperture<20) st->aperture=20;
+	  if (!st->stitchmode) fprintf(target,"G54D%02d*\n",st->aperture);
+	}
+      }
+      switch(st->i){ /* aperture selection */
+	  case 2: case 3: case 4: case 5: case 7: case 11: case 13:
+	st->aperture=st->ob.width+20;
+	if (st->aperture>maxaperture+20) st->aperture=maxaperture+20;
+	if (st->aperture<20) st->aperture=20;
+	fprintf(target,"G54D%02d*\n",st->aperture);
 	break;
       default:
 	  break;
       };
-      switch(i){
+      switch(st->i){
       case 0: /* skip command */
 	break;
       case 1: /* output drill coordinates or count tools */
 	  if (filetype==1 ) { /* drill file */
-	      rs_drill(&ob.cx1,&ob.cx2);
+	      if (st->capture) {
+		  x=st->ob.cx1; y=st->ob.cx2; rs_plot(&x,&y);
+		  cap_begin(PRIM_HOLE,get_tool_number(st->ob.r1),st->ob.depth);
+		  cap_point(x,y);
+	      }
+	      rs_drill(&st->ob.cx1,&st->ob.cx2);
+	      if (st->slot_mode) { /* written by tool at the end */
+		  img_begin(&st->drill_buf,PRIM_HOLE,get_tool_number(st->ob.r1),
+			    st->ob.depth);
+		  img_point(&st->drill_buf,st->ob.cx1,st->ob.cx2);
+		  break;
+	      }
 	      /* make drill selection */
-	      if (actual_drill!=get_tool_number(ob.r1)) {
-		  actual_drill=get_tool_number(ob.r1);
+	      if (actual_drill!=get_tool_number(st->ob.r1)) {
+		  actual_drill=get_tool_number(st->ob.r1);
 		  fprintf(target,"T%01dC%05.3f\n",
 			  drilltab[actual_drill].tool_index,
 			  drilltab[actual_drill].diameter);
 	      };
-	      fprintf(target,"X%06dY%06d\n",ob.cx1,ob.cx2);
+	      fprintf(target,"X%06dY%06d\n",st->ob.cx1,st->ob.cx2);
 	      break;
 	  }
 	  /* make tool count */
-	  actual_drill=get_tool_number(ob.r1);
+	  actual_drill=get_tool_number(st->ob.r1);
 	  if (actual_drill>=0 && actual_drill<drill_number) 
-	      tool_counts[drilltab[actual_drill].tool_index]++;
+	      st->tool_counts[drilltab[actual_drill].tool_index]++;
 	  break;
       case 2: /* generate lines */
-	varp=NULL;
-	k=ob.int16; /* point count */
-	getpair(&x,&y);
-	rs_plot(&x,&y);
+	k=st->ob.int16; /* point count */
+	if (get_points((k>1)?k:1)) return ermsg(17);
+	x=st->pool_x[0]; y=st->pool_y[0];
 	fprintf(target,"G01X%05dY%05dD02*",x,y); /* first coordinates */
+	cap_begin((k==1)?PRIM_FLASH:PRIM_STROKE,st->aperture,st->ob.depth);
+	cap_point(x,y);
 	if (k==1) {
 	  fprintf(target,"D03*D02*\n");
 	} else {
-	  while (k>1) {
-	    getpair(&x,&y);
-	    rs_plot(&x,&y);
-	    fprintf(target,"X%05dY%05dD01*",x,y);
-	    k--;
+	  for (n=1;n<k;n++) {
+	    cap_point(st->pool_x[n],st->pool_y[n]);
+	    fprintf(target,"X%05dY%05dD01*",st->pool_x[n],st->pool_y[n]);
 	  };
 	  fprintf(target,"\n");
 	};
 	break;
+      case 9: /* collect line segments for stitching */
+	st->aperture=st->ob.width+20;
+	if (st->aperture>maxaperture+20) st->aperture=maxaperture+20;
+	if (st->aperture<20) st->aperture=20;
+	k=st->ob.int16; /* point count */
+	if (get_points((k>1)?k:1)) return ermsg(17);
+	cap_begin(PRIM_STROKE,st->aperture,st->ob.depth);
+	cap_point(st->pool_x[0],st->pool_y[0]);
+	for (n=1;n<k;n++) {
+	  cap_point(st->pool_x[n],st->pool_y[n]);
+	  if (stitch_add(st->pool_x[n-1],st->pool_y[n-1],st->pool_x[n],st->pool_y[n],
+			 st->aperture))
+	    return ermsg(17);
+	};
+	break;
+      case 10: /* stroked spline */
+	if (pool_load(spl->x,spl->y,spl->num)) return ermsg(17);
+	cap_begin(PRIM_STROKE,st->aperture,st->ob.depth);
+	for (k=0;k<spl->num;k++) {
+	  x=st->pool_x[k];y=st->pool_y[k];
+	  cap_point(x,y);
+	  if (st->stitchmode) {
+	    if (k>0 && stitch_add(st->pool_x[k-1],st->pool_y[k-1],x,y,st->aperture))
+	      return ermsg(17);
+	  } else {
+	    fprintf(target,k?"X%05dY%05dD01*":"G01X%05dY%05dD02*",x,y);
+	  }
+	}
+	if (!st->stitchmode) fprintf(target,"\n");
+	break;
+      case 11: /* filled spline */
+	if (pool_load(spl->x,spl->y,spl->num)) return ermsg(17);
+	if (filetype==5) stencil_pool(spl->num);
+	cap_begin(PRIM_REGION,st->aperture,st->ob.depth);
+	for (k=0;k<spl->num;k++) {
+	  x=st->pool_x[k];y=st->pool_y[k];
+	  cap_point(x,y);
+	  fprintf(target,k?"X%05dY%05dD01*":"G36*G01X%05dY%05dD02*",x,y);
+	}
+	if ((spl->x[0]!=spl->x[k-1]) || (spl->y[0]!=spl->y[k-1])) {
+	  /* close contour */
+	  fprintf(target,"X%05dY%05dD01*",st->pool_x[0],st->pool_y[0]);
+	}
+	fprintf(target,"D02*G37*\n");
+	break;
+      case 12: /* text */
+	if (st->ibb && render_text(target,&st->ob,st->ibb)) return ermsg(17);
+	break;
       case 3: /* generate polygon */
-	varp=NULL;
-	k=ob.int16; /* point count */
-	getpair(&x,&y);
-	rs_plot(&x,&y);
+	k=st->ob.int16; /* point count */
+	if (get_points((k>1)?k:1)) return ermsg(17);
+	if (filetype==5) stencil_pool(k);
+	x=st->pool_x[0]; y=st->pool_y[0];
 	fprintf(target,"G36*G01X%05dY%05dD02*",x,y); /* first coordinates */
+	cap_begin((k==1)?PRIM_FLASH:PRIM_REGION,st->aperture,st->ob.depth);
+	cap_point(x,y);
 	if (k==1) {
 	  fprintf(target,"D03*D02*G37*\n");
 	} else {
-	  while (k>1) {
-	    getpair(&x,&y);
-	    rs_plot(&x,&y);
-	    fprintf(target,"X%05dY%05dD01*",x,y);
-	    k--;
+	  for (n=1;n<k;n++) {
+	    cap_point(st->pool_x[n],st->pool_y[n]);
+	    fprintf(target,"X%05dY%05dD01*",st->pool_x[n],st->pool_y[n]);
 	  };
 	  fprintf(target,"D02*G37*\n");
 	};      
 	break;
       case 4: /* generate circle */
-	rs_plot(&ob.cx1,&ob.cx2);	
-	rs_single(&ob.r1);
+	rs_plot(&st->ob.cx1,&st->ob.cx2);	
+	rs_single(&st->ob.r1);
 	fprintf(target,
 		"G75*G01*X%05dY%05dD02*G03X%05dY%05dI%06dJ%05dD01*G01*\n",
-		ob.cx1+ob.r1,ob.cx2,ob.cx1+ob.r1,ob.cx2,-ob.r1,0);
+		st->ob.cx1+st->ob.r1,st->ob.cx2,st->ob.cx1+st->ob.r1,st->ob.cx2,-st->ob.r1,0);
+	cap_begin(PRIM_STROKE,st->aperture,st->ob.depth);
+	cap_arc(st->ob.cx1,st->ob.cx2,st->ob.cx1+st->ob.r1,st->ob.cx2,
+		st->ob.cx1+st->ob.r1,st->ob.cx2,0);
 	break;
       case 5: /* generate filled circle - and scan for pads */
-	rs_plot(&ob.cx1,&ob.cx2);
+	rs_plot(&st->ob.cx1,&st->ob.cx2);
         /* scan for pads */
 	for (apindex=0;apindex<num_round_apert;apindex++) {
-	    if (ob.r1==(rnd_apt_tab[apindex].xfig_rad)) {
+	    if (st->ob.r1==(rnd_apt_tab[apindex].xfig_rad)) {
 		/* make special considerations for known round apertures to
 		   have corrected separations in inner layers */
-		target_aperture=punchflag?
-		    rnd_apt_tab[apindex].knockout_idx:
-		    rnd_apt_tab[apindex].aperture_idx;
+		target_aperture=rnd_apt_tab[apindex].aperture_idx;
+		if (punchflag) target_aperture=st->clear_mode?
+		    clear_dcode(target_aperture):
+		    rnd_apt_tab[apindex].knockout_idx;
+		if (filetype==5) { /* reduced opening */
+		    stencil_flash(target,target_aperture,st->ob.cx1,st->ob.cx2,
+				  st->ob.depth);
+		    break;
+		}
 		fprintf(target, "G54D%03d*G01*X%05dY%05dD02*D03*\n",
-			target_aperture,ob.cx1,ob.cx2);
+			target_aperture,st->ob.cx1,st->ob.cx2);
+		cap_begin(PRIM_FLASH,target_aperture,st->ob.depth);
+		cap_point(st->ob.cx1,st->ob.cx2);
+		x=rnd_apt_tab[apindex].real_dia*1000;
+		if (st->place_collect && st->ob.depth==21 &&
+		    place_add_pad(st->ob.cx1,st->ob.cx2,x,x)) return ermsg(17);
 		break;
 	    }
 	}
 	if (apindex<num_round_apert) break;
 
 	/* do it manually if no pad was found */
-	rs_single(&ob.r1);
+	rs_single(&st->ob.r1);
+	if (filetype==5) st->ob.r1=(int)(stencil_size(2.0*st->ob.r1)/2);
+	if (punchflag && st->clear_mode)
+	  st->ob.r1+=(int)floor(st->clear_mil[st->clear_class]+0.5);
 	fprintf(target,
 		"G36*G75*G01*X%05dY%05dD02*G03X%05dY%05dI%06dJ%05dD01*G01*D02*G37*\n",
-		ob.cx1+ob.r1,ob.cx2,ob.cx1+ob.r1,ob.cx2,-ob.r1,0);
+		st->ob.cx1+st->ob.r1,st->ob.cx2,st->ob.cx1+st->ob.r1,st->ob.cx2,-st->ob.r1,0);
+	cap_begin(PRIM_REGION,st->aperture,st->ob.depth);
+	cap_arc(st->ob.cx1,st->ob.cx2,st->ob.cx1+st->ob.r1,st->ob.cx2,
+		st->ob.cx1+st->ob.r1,st->ob.cx2,0);
+	if (st->place_collect && st->ob.depth==21 &&
+	    place_add_pad(st->ob.cx1,st->ob.cx2,2*st->ob.r1,2*st->ob.r1))
+	  return ermsg(17);
 	break;
 
       case 7: /* generate open arcs */
 	  /* store cw/ccw decision in int15 */
-	  ob.int15=
-	      (ob.mx1-ob.ax1)*(ob.ex2-ob.mx2)-(ob.mx2-ob.ax2)*(ob.ex1-ob.mx1);
+	  st->ob.int15=
+	      (st->ob.mx1-st->ob.ax1)*(st->ob.ex2-st->ob.mx2)-
+	      (st->ob.mx2-st->ob.ax2)*(st->ob.ex1-st->ob.mx1);
 	  /*  convert coordinates */
-	  rs_plot(&ob.ax1,&ob.ax2);
-	  rs_plot(&ob.ex1,&ob.ex2);
-	  rs_plot(&ob.cx1,&ob.cx2);
+	  rs_plot(&st->ob.ax1,&st->ob.ax2);
+	  rs_plot(&st->ob.ex1,&st->ob.ex2);
+	  rs_plot(&st->ob.cx1,&st->ob.cx2);
 	  
 	  /* execute stroke */
 	  fprintf(target,
-		"G75*G01*X%05dY%05dD02*%sX%05dY%05dI%05dJ%05dD01*G01*D02*\n",
-		  ob.ax1,ob.ax2, /* start coordinates */
-		  (ob.int15>0)?"G02":"G03", /* which turn */
-		  ob.ex1, ob.ex2, /* end coordinates */
-		  ob.cx1-ob.ax1, ob.cx2-ob.ax2 /* center offset */);
+		"G75*G01*X%05dY%05dD02*%sX%05dY%05dI%05dJ%05dD01*G01*",
+		  st->ob.ax1,st->ob.ax2, /* start coordinates */
+		  (st->ob.int15>0)?"G02":"G03", /* which turn */
+		  st->ob.ex1, st->ob.ex2, /* end coordinates */
+		  st->ob.cx1-st->ob.ax1, st->ob.cx2-st->ob.ax2 /* center offset */);
+	  if (st->ob.type==2) /* pie wedge: both radii */
+	      fprintf(target,"X%05dY%05dD01*X%05dY%05dD01*",
+		      st->ob.cx1,st->ob.cx2,st->ob.ax1,st->ob.ax2);
+	  fprintf(target,"D02*\n");
+	  cap_begin(PRIM_STROKE,st->aperture,st->ob.depth);
+	  cap_arc(st->ob.cx1,st->ob.cx2,st->ob.ax1,st->ob.ax2,st->ob.ex1,st->ob.ex2,
+		  st->ob.int15>0);
+	  if (st->ob.type==2) {
+	    cap_point(st->ob.cx1,st->ob.cx2); cap_point(st->ob.ax1,st->ob.ax2);
+	  }
+	break;
+
+      case 13: /* generate filled arcs: pie wedge or chord */
+	  st->ob.int15=
+	      (st->ob.mx1-st->ob.ax1)*(st->ob.ex2-st->ob.mx2)-
+	      (st->ob.mx2-st->ob.ax2)*(st->ob.ex1-st->ob.mx1);
+	  rs_plot(&st->ob.ax1,&st->ob.ax2);
+	  rs_plot(&st->ob.ex1,&st->ob.ex2);
+	  rs_plot(&st->ob.cx1,&st->ob.cx2);
+
+	  /* region from the native arc, closed by straight edges */
+	  fprintf(target,
+		"G36*G75*G01*X%05dY%05dD02*%sX%05dY%05dI%05dJ%05dD01*G01*",
+		  st->ob.ax1,st->ob.ax2,
+		  (st->ob.int15>0)?"G02":"G03",
+		  st->ob.ex1, st->ob.ex2,
+		  st->ob.cx1-st->ob.ax1, st->ob.cx2-st->ob.ax2);
+	  if (st->ob.type==2) /* via the center for pie wedges */
+	      fprintf(target,"X%05dY%05dD01*",st->ob.cx1,st->ob.cx2);
+	  fprintf(target,"X%05dY%05dD01*D02*G37*\n",st->ob.ax1,st->ob.ax2);
+	  cap_begin(PRIM_REGION,st->aperture,st->ob.depth);
+	  cap_arc(st->ob.cx1,st->ob.cx2,st->ob.ax1,st->ob.ax2,st->ob.ex1,st->ob.ex2,
+		  st->ob.int15>0);
+	  if (st->ob.type==2) cap_point(st->ob.cx1,st->ob.cx2);
 	break;
 
       case 6: /* generate square pad */
@@ -981,12 +2393,20 @@ int do_parsing(int *layerlist, int filetype, FILE * target, int punchflag) {
 
 	if (padnum==0) { /* do it by hand...*/
 	  /* just a standard filled square */
-	  difx/=2; dify/=2; rs_plot(&difx, &dify); /* rescale differences */
+	  difx/=2; dify/=2; rs_scale(&difx, &dify); /* rescale differences */
+	  if (filetype==5) { /* stencil: shrink the half sides */
+	      difx=(int)(stencil_size(2.0*abs(difx))/2);
+	      dify=(int)(stencil_size(2.0*abs(dify))/2);
+	  }
+	  if (punchflag && st->clear_mode) { /* grow by the clearance */
+	      k=(int)floor(st->clear_mil[st->clear_class]+0.5);
+	      difx+=(difx<0)?-k:k; dify+=(dify<0)?-k:k;
+	  }
 	  /*    create aperture selection */
-	  aperture=ob.width+20;
-	  if (aperture>maxaperture+20) aperture=maxaperture+20;
-	  if (aperture<20) aperture=20;
-	  fprintf(target,"G54D%02d*\n",aperture);
+	  st->aperture=st->ob.width+20;
+	  if (st->aperture>maxaperture+20) st->aperture=maxaperture+20;
+	  if (st->aperture<20) st->aperture=20;
+	  fprintf(target,"G54D%02d*\n",st->aperture);
 	  /* create filled polygon */
 	  fprintf(target,"G36*G01X%05dY%05dD02*",x-difx,y-dify); /* start */
 	  fprintf(target,"X%05dY%05dD01*",x+difx,y-dify);
@@ -994,25 +2414,100 @@ int do_parsing(int *layerlist, int filetype, FILE * target, int punchflag) {
 	  fprintf(target,"X%05dY%05dD01*",x-difx,y+dify);
 	  fprintf(target,"X%05dY%05dD01*",x-difx,y-dify);
 	  fprintf(target,"X%05dY%05dD02*G37*\n",x-difx,y-dify);
+	  cap_begin(PRIM_REGION,st->aperture,st->ob.depth);
+	  cap_point(x-difx,y-dify); cap_point(x+difx,y-dify);
+	  cap_point(x+difx,y+dify); cap_point(x-difx,y+dify);
+	  if (st->place_collect && st->ob.depth==21 &&
+	      place_add_pad(x,y,2*abs(difx),2*abs(dify))) return ermsg(17);
 	  
 	  /* fprintf(stderr, "%d, %d, %d, %d\n",xmin,xmax,ymin,ymax);
 	     fprintf(stderr,"Cannot interpret black box.\n");exit(-1); */
+	} else if (filetype==5) { /* reduced stencil opening */
+	    stencil_flash(target,padnum,x,y,st->ob.depth);
 	} else { /* ...or use the found aperture */
+	    if (punchflag && st->clear_mode) padnum=clear_dcode(padnum);
 	    fprintf(target,"G54D%03d*G01*X%05dY%05dD02*D03*\n",padnum,x,y);
+	    cap_begin(PRIM_FLASH,padnum,st->ob.depth);
+	    cap_point(x,y);
+	    if (st->place_collect && st->ob.depth==21 &&
+		place_add_pad(x,y,rectap_tab[apindex].real_x*1000,
+			      rectap_tab[apindex].real_y*1000)) return ermsg(17);
 	}
 	break;
 
+      case 18: /* copper pour zone */
+	  rx=malloc(st->ob.int16*sizeof(int)); ry=malloc(st->ob.int16*sizeof(int));
+	  if (!rx || !ry) {free(rx); free(ry); return ermsg(17);}
+	  st->varp=NULL;
+	  for (k=0;k<st->ob.int16;k++) getpair(&rx[k],&ry[k]);
+	  rs_plot_n(rx,ry,st->ob.int16);
+	  if (pour_add_zone(pour_rule_of(st->ob.depth),st->obj_net,rx,ry,st->ob.int16))
+	      return ermsg(17);
+	  break;
+
+      case 15: /* rout polyline contour */
+	  bit=rout_select(target,st->ob.width,&actual_drill);
+	  rx=malloc(st->ob.int16*sizeof(int)); ry=malloc(st->ob.int16*sizeof(int));
+	  if (!rx || !ry) {free(rx); free(ry); return ermsg(17);}
+	  st->varp=NULL;
+	  for (k=0;k<st->ob.int16;k++) getpair(&rx[k],&ry[k]);
+	  rs_drill_n(rx,ry,st->ob.int16);
+	  k=st->ob.int16;
+	  /* polygons repeat the first point; such lines are closed, too */
+	  if (k>2 && rx[k-1]==rx[0] && ry[k-1]==ry[0]) {
+	      k--; x=1;
+	  } else {
+	      x=(st->ob.type>1);
+	  }
+	  if (rout_polyline(target,rx,ry,k,x,bit)) {
+	      free(rx); free(ry); return ermsg(17);
+	  }
+	  free(rx); free(ry);
+	  break;
+      case 16: /* rout circle contour */
+	  bit=rout_select(target,st->ob.width,&actual_drill);
+	  rs_drill(&st->ob.cx1,&st->ob.cx2);
+	  y=(20*st->ob.r1)/9; /* radius in drill units */
+	  if (rout_circle(target,st->ob.cx1,st->ob.cx2,y,bit)) return ermsg(17);
+	  break;
+      case 17: /* rout open arc */
+	  rout_select(target,st->ob.width,&actual_drill);
+	  st->ob.int15=
+	      (st->ob.mx1-st->ob.ax1)*(st->ob.ex2-st->ob.mx2)-
+	      (st->ob.mx2-st->ob.ax2)*(st->ob.ex1-st->ob.mx1);
+	  rs_drill(&st->ob.ax1,&st->ob.ax2);
+	  rs_drill(&st->ob.ex1,&st->ob.ex2);
+	  rs_drill(&st->ob.cx1,&st->ob.cx2);
+	  fprintf(target,"G00X%06dY%06d\nM15\n%sX%06dY%06dI%06dJ%06d\nM16\n",
+		  st->ob.ax1,st->ob.ax2,(st->ob.int15>0)?"G02":"G03",st->ob.ex1,st->ob.ex2,
+		  st->ob.cx1-st->ob.ax1,st->ob.cx2-st->ob.ax2);
+	  break;
+
       case 8: /* generate slot in drill file/tool count */
+	  if (filetype==1 && st->slot_mode) { /* written by tool at the end */
+	      st->varp=NULL;
+	      n=get_route_tool(st->ob.width);
+	      img_begin(&st->drill_buf,PRIM_HOLE,n,st->ob.depth);
+	      cap_begin(PRIM_HOLE,n,st->ob.depth);
+	      for (k=0;k<st->ob.int16;k++) {
+		  getpair(&x,&y);
+		  xmin=x; ymin=y; rs_plot(&xmin,&ymin); cap_point(xmin,ymin);
+		  rs_drill(&x,&y); img_point(&st->drill_buf,x,y);
+	      }
+	      break;
+	  }
 	  if (filetype==1 ) { /* drill file */
-	      if (actual_drill!=get_route_tool(ob.width)) {
-		  actual_drill=get_route_tool(ob.width);
+	      if (actual_drill!=get_route_tool(st->ob.width)) {
+		  actual_drill=get_route_tool(st->ob.width);
 		  fprintf(target,"T%01dC%05.3f\n",
 			  drilltab[actual_drill].tool_index,
 			  drilltab[actual_drill].diameter);
 	      };
-	      varp=NULL;
-	      k=ob.int16; /* point count */
+	      st->varp=NULL;
+	      k=st->ob.int16; /* point count */
 	      getpair(&x,&y);
+	      cap_begin(PRIM_HOLE,actual_drill,st->ob.depth);
+	      xmin=x; ymin=y; rs_plot(&xmin,&ymin); cap_point(xmin,ymin);
 	      rs_drill(&x,&y);
 	      if (k==1) {
 		  //fprintf(target,"G05\nX%05dY%05d\n",x,y);
@@ -1022,6 +2517,7 @@ int do_parsing(int *layerlist, int filetype, FILE * target, int punchflag) {
 		  //fprintf(target,"M15\n"); /* tool down */
 		  while (k>1) {
 		      getpair(&x,&y);
+		      xmin=x; ymin=y; rs_plot(&xmin,&ymin); cap_point(xmin,ymin);
 		      rs_drill(&x,&y);
 		      //this uses canned slot cycles only
 		      fprintf(target,"G85X%05dY%05d\n",x,y); /* linear move */
@@ -1034,20 +2530,34 @@ int do_parsing(int *layerlist, int filetype, FILE * target, int punchflag) {
 	      break;
 	  }
 	  /* update tool count - does this make sense for slots?*/
-	  actual_drill=get_route_tool(ob.width);
+	  actual_drill=get_route_tool(st->ob.width);
 	  if (actual_drill>=0 && actual_drill<drill_number) 
-	      tool_counts[drilltab[actual_drill].tool_index]++;
+	      st->tool_counts[drilltab[actual_drill].tool_index]++;
 	  break;
       };
+      if (st->stream_num && nroute) sj->drill=actual_drill;
+      if (++rt<nroute) { /* same object for the next inner layer */
+	st->ob=obsave; st->fp_pts=ptsave;
+	if (fseek(st->infile,contpos,SEEK_SET)) return ermsg(16);
+	goto next_route;
+      }
   
     };
   };
-  
+  if (st->drill_buf.num || st->drill_buf.failed) { /* hits and slots by tool */
+    for (k=0;k<st->stream_num;k++)
+      if (st->stream_tab[k].filetype==1) {target=st->stream_tab[k].f; break;}
+    if (drill_flush(target)) return ermsg(17);
+  }
+  for (k=0;k<st->stream_num;k++) /* bites belong to the rout job */
+    if (st->stream_tab[k].filetype==3) {target=st->stream_tab[k].f; break;}
+  if (st->stitch_num) stitch_flush(target); /* write out joined paths */
+  if (st->bite_num) rout_bites(target); /* mouse bites after contours */
 
   return 0;
 }
 
-char *emsg[]={"No error.",   /* 0 */
+static char *emsg[]={"No error.",   /* 0 */
 	      "Wrong filter mode.",
 	      "Error converting filename.",
 	      "Error opening input file.",
@@ -1064,72 +2574,5029 @@ char *emsg[]={"No error.",   /* 0 */
 	      "Cannot open layer file",
 	      "read in layer is negative", /* 15 */
 	      "Cannot create layered RS274X file because rewind failed",
+	      "Not enough memory.",
+	      "Spline tolerance too small",
+	      "Routing bit too small",
+	      "Wrong tab or mouse bite specification",
+	      "Preview resolution out of range (10..10000 dpi)",
+	      "Cannot create preview files",
+	      "Wrong design rule limits.",
+	      "Design rule violations found.",
+	      "Cannot create netlist.",
+	      "Wrong stencil parameters.",
+	      "Cannot create placement list.",
+	      "Copper pour needs the RS274X mode (-X).",
+	      "Wrong copper pour parameters.",
+	      "Wrong number of stackup layers (1..45).", /* 30 */
+	      "Cannot read footprint library.",
+	      "Cannot watch the source file.",
+	      "Cannot write the bundle.",
+	      "Cannot watch into a bundle.",
+	      "Streaming mode cannot merge, pour, flatten or mask layers.", /* 35 */
+	      "Wrong clearance rule.",
+	      "Wrong solder mask parameters.",
+	      "Boards differ.",
+	      "Cannot write the diff overlay.",
+	      "Wrong window.", /* 40 */
+	      "The window needs a source file.",
+	      "Wrong slot mode (g85 or rout).",
+	      "The design rule check needs a source file.",
 };
 
-int ermsg(int ern){
+static int ermsg(int ern){
   fprintf(stderr,"%s\n",emsg[ern]);  
   return -ern;
 }
 
 /* getpair function: give back a pair of values from input file */
-void getpair(int *x, int *y){
-  if (varp==NULL) {
-    fgets(constring,1000,infile);
-    varp=strtok(constring," \t");
+static void getpair(int *x, int *y){
+  if (st->fp_pts) { /* object of a cached footprint */
+    *x=*st->fp_pts++; *y=*st->fp_pts++;
+    return;
+  }
+  if (st->varp==NULL) {
+    fgets(st->constring,1000,st->infile);
+    st->varp=strtok_r(st->constring," \t",&st->varpos);
   } else {
-    if ((varp=strtok(NULL," \t"))==NULL) {
-      fgets(constring,1000,infile);
-      varp=strtok(constring," \t");
+    if ((st->varp=strtok_r(NULL," \t",&st->varpos))==NULL) {
+      fgets(st->constring,1000,st->infile);
+      st->varp=strtok_r(st->constring," \t",&st->varpos);
     };
   };
-  sscanf(varp,"%d",x);
-  varp=strtok(NULL," \t");sscanf(varp,"%d",y);
+  sscanf(st->varp,"%d",x);
+  st->varp=strtok_r(NULL," \t",&st->varpos);sscanf(st->varp,"%d",y);
 }
-/* rescaling function for xfig units to plot coordinates;
-   assumes 1cm(xfig)=100 mils */
-/* plot coordinates are put out in units of 1 mil */
-void rs_plot(int *x, int *y){
-  int a,b;
-  a=(2 * (*x))/9;b=(2 * (*y))/9;
-  *x=b;*y=a;
+/* getfloat function: same as getpair for a single float value */
+static void getfloat(double *x){
+  if (st->varp!=NULL) st->varp=strtok_r(NULL," \t\n",&st->varpos);
+  if (st->varp==NULL) {
+    fgets(st->constring,1000,st->infile);
+    st->varp=strtok_r(st->constring," \t\n",&st->varpos);
+  };
+  *x=0.0;
+  if (st->varp) sscanf(st->varp,"%lf",x);
 }
-/* rescaling function for drill coordinates; assumes 1cm(xfig)=100 mils */
-/* drill coordinates are in multiples of 0.1 mil */
-void rs_drill(int *x, int *y){
-  int a,b;
-  a=(20 * (*x))/9;b=(20 * (*y))/9;
-  *x=b;*y=a;
+
+/* X-spline evaluation, following the blending functions of Blanc and
+   Schlick as used by xfig. All xfig 3.2 splines are stored as X-splines
+   with shape factors (1: approximated, -1: interpolated, 0: corner). One
+   segment runs from p1 to p2 and is influenced by p0..p3 and the shape
+   factors s1, s2 of p1 and p2. */
+static inline double xs_f(double num, double den){
+    double p=2*den*den;
+    num/=den;
+    return num*num*num*(10-p+(2*p-15)*num+(6-p)*num*num);
 }
-void rs_single(int *x){
-  int a;
-  a=(2 * (*x))/9;
-  *x=a;
+static inline double xs_g(double u, double q){
+    return u*(q+u*(2*q+u*(8-12*q+u*(14*q-11+u*(4-5*q))))); /* p=2 */
 }
-int get_tool_number(int radius) {
-  int i=drill_number;
-  for (i=0;i<drill_number;i++) {
-    if (drilltab[i].graph_units==radius) break;
-  };
-  if (i==drill_number) i=0;  /* default drill tool */
-  return i;
+static inline double xs_h(double u, double q){
+    double u2=u*u;
+    return u*(q+u*(2*q+u2*(-2*q-u*q)));
 }
-
-/* convert line width into a tool index or return default tool  */
-int get_route_tool(int width) {
-    int i=drill_number;
-    for (i=0;i<drill_number;i++) {
-	if (drilltab[i].route_width==width) break;
-    };
-    if (i==drill_number) i=0;  /* default drill tool */
-    return i;
+#define SPLINE_PROBE 8      /* coarse samples to estimate the curvature */
+#define SPLINE_MAXSTEPS 512 /* maximum number of steps per segment */
+/* evaluate a spline segment at n ascending parameter values t[] (n<=
+   SPLINE_MAXSTEPS+1). The sign tests of the shape factors select one of
+   two loops for each end, and the blend of p0 (p3) which is zero after
+   (before) a parameter is cut off by index, so the loop bodies are
+   straight arithmetic the compiler can vectorise. */
+static void xs_eval(const double *px, const double *py, double s1, double s2,
+		    const double *t, double *x, double *y, int n){
+    double a0[SPLINE_MAXSTEPS+1], a1[SPLINE_MAXSTEPS+1];
+    double a2[SPLINE_MAXSTEPS+1], a3[SPLINE_MAXSTEPS+1], w;
+    int j, m;
+    if (s1<0) {
+	for (j=0;j<n;j++) {a0[j]=xs_h(-t[j],-s1); a2[j]=xs_g(t[j],-s1);}
+    } else {
+	for (m=0;m<n && t[m]<s1;m++); /* a0 is 0 from t=s1 on */
+	for (j=0;j<m;j++) a0[j]=xs_f(t[j]-s1,-1-s1);
+	for (;j<n;j++) a0[j]=0.0;
+	for (j=0;j<n;j++) a2[j]=xs_f(t[j]+s1,1+s1);
+    }
+    if (s2<0) {
+	for (j=0;j<n;j++) {a1[j]=xs_g(1-t[j],-s2); a3[j]=xs_h(t[j]-1,-s2);}
+    } else {
+	for (m=0;m<n && !(t[m]>1-s2);m++); /* a3 is 0 up to t=1-s2 */
+	for (j=0;j<m;j++) a3[j]=0.0;
+	for (;j<n;j++) a3[j]=xs_f(t[j]-1+s2,1+s2);
+	for (j=0;j<n;j++) a1[j]=xs_f(t[j]-1-s2,-1-s2);
+    }
+    for (j=0;j<n;j++) {
+	w=a0[j]+a1[j]+a2[j]+a3[j];
+	x[j]=(a0[j]*px[0]+a1[j]*px[1]+a2[j]*px[2]+a3[j]*px[3])/w;
+	y[j]=(a0[j]*py[0]+a1[j]*py[1]+a2[j]*py[2]+a3[j]*py[3])/w;
+    }
 }
 
-/* what to do with a specific graphical object? possible results:
-   0: skip entry; 1: output drill coordinate; 2: generate line; 
+/* tessellate the spline in the current object into the cache entry e. The
+   number of steps per segment follows from the largest second difference
+   of a coarse sampling, such that the chord error stays below the
+   tolerance. Returns 0 on success. */
+static int tessellate_spline(spline_entry *e, int closed, int npoints){
+    int *cx, *cy, k, j, m, n, nseg, idx[4];
+    double *sf, px[4], py[4], t[SPLINE_MAXSTEPS+1];
+    double x[SPLINE_MAXSTEPS+1], y[SPLINE_MAXSTEPS+1], d, dmax, tol;
+    void *p;
+
+    cx=malloc(npoints*sizeof(int)); cy=malloc(npoints*sizeof(int));
+    sf=malloc(npoints*sizeof(double));
+    if (!cx || !cy || !sf) {free(cx); free(cy); free(sf); return -1;}
+    /* arrow definitions come before the points */
+    if (st->ob.int12) fgets(st->constring,1000,st->infile);
+    if (st->ob.int13) fgets(st->constring,1000,st->infile);
+    st->varp=NULL;
+    for (k=0;k<npoints;k++) getpair(&cx[k],&cy[k]);
+    st->varp=NULL;
+    for (k=0;k<npoints;k++) getfloat(&sf[k]);
+
+    tol=st->spline_tolerance*4.5; /* 450 xfig units are 100 mil */
+    nseg=closed?npoints:npoints-1;
+    e->num=0; e->x=NULL; e->y=NULL;
+    for (m=0;m<nseg;m++) {
+	for (j=0;j<4;j++) { /* control points, open ends are repeated */
+	    idx[j]=closed?(m+j)%npoints:m+j-1;
+	    if (idx[j]<0) idx[j]=0;
+	    if (idx[j]>npoints-1) idx[j]=npoints-1;
+	    px[j]=cx[idx[j]]; py[j]=cy[idx[j]];
+	}
+	for (j=0;j<=SPLINE_PROBE;j++) t[j]=(double)j/SPLINE_PROBE;
+	xs_eval(px,py,sf[idx[1]],sf[idx[2]],t,x,y,SPLINE_PROBE+1);
+	dmax=0.0;
+	for (j=1;j<SPLINE_PROBE;j++) {
+	    d=hypot(x[j-1]-2*x[j]+x[j+1],y[j-1]-2*y[j]+y[j+1]);
+	    if (d>dmax) dmax=d;
+	}
+	/* chord error of n steps is about dmax*(probe/n)^2/8 */
+	n=(int)ceil(SPLINE_PROBE*sqrt(dmax/(8*tol)));
+	if (n<1) n=1;
+	if (n>SPLINE_MAXSTEPS) n=SPLINE_MAXSTEPS;
+	for (j=0;j<n;j++) t[j]=(double)j/n;
+	xs_eval(px,py,sf[idx[1]],sf[idx[2]],t,x,y,n);
+
+	if (!(p=realloc(e->x,(e->num+n+1)*sizeof(int)))) break;
+	e->x=p;
+	if (!(p=realloc(e->y,(e->num+n+1)*sizeof(int)))) break;
+	e->y=p;
+	for (j=0;j<n;j++) {
+	    e->x[e->num]=(int)floor(x[j]+0.5); e->y[e->num]=(int)floor(y[j]+0.5);
+	    if (e->num==0 || e->x[e->num]!=e->x[e->num-1] ||
+		e->y[e->num]!=e->y[e->num-1]) e->num++;
+	}
+    }
+    if (m<nseg) {free(cx); free(cy); free(sf); return -1;} /* no memory */
+    /* end point of open splines, or back to the start for closed ones */
+    e->x[e->num]=closed?e->x[0]:cx[npoints-1];
+    e->y[e->num]=closed?e->y[0]:cy[npoints-1];
+    e->num++;
+    free(cx); free(cy); free(sf);
+    return 0;
+}
+
+/* look up the tessellation of the spline starting at file position offset,
+   and create it from the point data following in the input if it is not in
+   the cache yet. The cache is an open addressing hash table. */
+static spline_entry *get_spline(long offset, int closed, int npoints){
+    spline_entry *e, *old;
+    int k, oldsize;
+    unsigned int h;
+
+    if (npoints<2) return NULL;
+    if (2*(st->spline_cache_num+1)>st->spline_cache_size) { /* grow table */
+	old=st->spline_cache; oldsize=st->spline_cache_size;
+	st->spline_cache_size=oldsize?2*oldsize:256;
+	st->spline_cache=calloc(st->spline_cache_size,sizeof(spline_entry));
+	if (!st->spline_cache) return NULL;
+	for (k=0;k<oldsize;k++) {
+	    if (!old[k].x) continue;
+	    h=(unsigned int)old[k].offset*2654435761u;
+	    for (h&=st->spline_cache_size-1;st->spline_cache[h].x;
+		 h=(h+1)&(st->spline_cache_size-1));
+	    st->spline_cache[h]=old[k];
+	}
+	free(old);
+    }
+    h=((unsigned int)offset*2654435761u)&(st->spline_cache_size-1);
+    for (;st->spline_cache[h].x;h=(h+1)&(st->spline_cache_size-1)) {
+	e=&st->spline_cache[h];
+	if (e->offset==offset) return e; /* already known */
+    }
+    e=&st->spline_cache[h];
+    if (tessellate_spline(e,closed,npoints)) {
+	free(e->x); free(e->y); e->x=NULL; e->y=NULL;
+	return NULL;
+    }
+    e->offset=offset;
+    st->spline_cache_num++;
+    return e;
+}
+
+/* build the stroke path of glyph c scaled to a font size (em) of size xfig
+   units into cache entry e. Returns 0 on success. */
+static int build_glyph(glyph_entry *e, int c, int size){
+    font_glyph *g=&stroke_font[c-32];
+    double u=0.72*size/FONT_CAPHEIGHT; /* grid unit, caps are 0.72 em */
+    char *p;
+    int n, gx, gy, pen;
+
+    for (n=1,p=g->strokes;*p;p++) if (*p==' ' || *p==';') n++;
+    e->x=malloc(n*sizeof(int)); e->y=malloc(n*sizeof(int));
+    e->pen=malloc(n);
+    if (!e->x || !e->y || !e->pen) return -1;
+    e->num=0;
+    for (p=g->strokes,pen=1;*p;) {
+	if (*p==';') {pen=1; p++; continue;}
+	if (*p==' ') {p++; continue;}
+	if (sscanf(p,"%d,%d",&gx,&gy)!=2) break;
+	e->x[e->num]=(int)floor(gx*u+0.5); e->y[e->num]=(int)floor(gy*u+0.5);
+	e->pen[e->num++]=pen; pen=0;
+	while (*p && *p!=' ' && *p!=';') p++;
+    }
+    e->advance=(int)floor((g->width+FONT_SPACING)*u+0.5);
+    e->c=c; e->size=size;
+    return 0;
+}
+
+/* look up a glyph for a font size in the hash table of scaled glyphs */
+static glyph_entry *get_glyph(int c, int size){
+    glyph_entry *e, *old;
+    int k, oldsize;
+    unsigned int h;
+
+    if (c<32 || c>126) c='?';
+    if (2*(st->glyph_cache_num+1)>st->glyph_cache_size) { /* grow table */
+	old=st->glyph_cache; oldsize=st->glyph_cache_size;
+	st->glyph_cache_size=oldsize?2*oldsize:256;
+	st->glyph_cache=calloc(st->glyph_cache_size,sizeof(glyph_entry));
+	if (!st->glyph_cache) return NULL;
+	for (k=0;k<oldsize;k++) {
+	    if (!old[k].x) continue;
+	    h=(unsigned int)(old[k].c*31+old[k].size)*2654435761u;
+	    for (h&=st->glyph_cache_size-1;st->glyph_cache[h].x;
+		 h=(h+1)&(st->glyph_cache_size-1));
+	    st->glyph_cache[h]=old[k];
+	}
+	free(old);
+    }
+    h=((unsigned int)(c*31+size)*2654435761u)&(st->glyph_cache_size-1);
+    for (;st->glyph_cache[h].x;h=(h+1)&(st->glyph_cache_size-1)) {
+	e=&st->glyph_cache[h];
+	if (e->c==c && e->size==size) return e;
+    }
+    e=&st->glyph_cache[h];
+    if (build_glyph(e,c,size)) {
+	free(e->x); free(e->y); free(e->pen); e->x=NULL;
+	return NULL;
+    }
+    st->glyph_cache_num++;
+    return e;
+}
+
+/* decode the string of a text object into str of size max. The text is
+   terminated by \001, and may contain octal escapes \ddd and \\.
+   Returns the length. */
+static int decode_text(char *str, char *text, int max){
+    int n;
+    for (n=0;*text && *text!='\001' && n<max-1;text++) {
+	if (text[0]=='\\' && text[1]>='0' && text[1]<='7' &&
+	    text[2]>='0' && text[2]<='7' && text[3]>='0' && text[3]<='7') {
+	    str[n]=(text[1]-'0')*64+(text[2]-'0')*8+(text[3]-'0');
+	    if (str[n++]=='\001') {n--; break;}
+	    text+=3;
+	} else if (text[0]=='\\' && text[1]=='\\') {
+	    str[n++]='\\'; text++;
+	} else {
+	    str[n++]=*text;
+	}
+    }
+    str[n]=0;
+    return n;
+}
+
+/* render the string of a text object with the stroke font */
+static int render_text(FILE *f, obstruct *ob, char *text){
+    char str[1000];
+    glyph_entry *g;
+    int n, j, k, size, x, y, px=0, py=0, width, ap;
+    double ca, sa, pos, gx, gy;
+
+    if (!(n=decode_text(str,text,sizeof(str)))) return 0;
+
+    size=(int)floor(ob->float1*1200/72+0.5); /* em in xfig units */
+    if (size<1) return 0;
+    /* pen width about 1/12 em, as line aperture (3.333 mil per step) */
+    ap=(int)floor(size*2.0/9/12/3.333+0.5);
+    if (ap<1) ap=1;
+    if (ap>maxaperture) ap=maxaperture;
+    ap+=20;
+
+    /* total width for justification */
+    for (width=0,k=0;k<n;k++) {
+	if (!(g=get_glyph((unsigned char)str[k],size))) return -1;
+	width+=g->advance;
+    }
+    width-=(int)floor(FONT_SPACING*0.72*size/FONT_CAPHEIGHT+0.5);
+    pos=(ob->type==1)?-width/2.0:((ob->type==2)?-width:0.0);
+
+    /* xfig has y pointing down, angles go counterclockwise */
+    ca=cos(ob->float2); sa=sin(ob->float2);
+    if (!st->stitchmode) fprintf(f,"G54D%02d*\n",ap);
+    for (k=0;k<n;k++) {
+	g=get_glyph((unsigned char)str[k],size);
+	for (j=0;j<g->num;j++) {
+	    gx=pos+g->x[j]; gy=g->y[j];
+	    x=(int)floor(ob->cx1+gx*ca-gy*sa+0.5);
+	    y=(int)floor(ob->cx2-gx*sa-gy*ca+0.5);
+	    rs_plot(&x,&y);
+	    if (g->pen[j]) cap_begin(PRIM_STROKE,ap,ob->depth);
+	    cap_point(x,y);
+	    if (st->stitchmode) {
+		if (!g->pen[j] && stitch_add(px,py,x,y,ap)) return -1;
+	    } else {
+		if (g->pen[j] && j) fprintf(f,"\n");
+		fprintf(f,g->pen[j]?"G01X%05dY%05dD02*":"X%05dY%05dD01*",x,y);
+	    }
+	    px=x; py=y;
+	}
+	if (!st->stitchmode && g->num) fprintf(f,"\n");
+	pos+=g->advance;
+    }
+    return 0;
+}
+/* rescaling function for xfig units to plot coordinates;
+   assumes 1cm(xfig)=100 mils */
+/* plot coordinates are put out in units of 1 mil */
+static void rs_plot(int *x, int *y){
+  rs_plot_n(x,y,1);
+}
+/* rescaling function for drill coordinates; assumes 1cm(xfig)=100 mils */
+/* drill coordinates are in multiples of 0.1 mil */
+static void rs_drill(int *x, int *y){
+  rs_drill_n(x,y,1);
+}
+/* same as rs_plot for sizes and differences, which are no extents */
+static void rs_scale(int *x, int *y){
+  int a,b;
+  a=(2 * (*x))/9;b=(2 * (*y))/9;
+  *x=b;*y=a;
+}
+
+static void ext_widen(int x0, int y0, int x1, int y1){
+  int d=(st->ext_depth>=0 && st->ext_depth<MAXDEPTH)?st->ext_depth:0;
+  if (x0<st->ext_x0[d]) st->ext_x0[d]=x0;
+  if (y0<st->ext_y0[d]) st->ext_y0[d]=y0;
+  if (x1>st->ext_x1[d]) st->ext_x1[d]=x1;
+  if (y1>st->ext_y1[d]) st->ext_y1[d]=y1;
+}
+
+/* bulk versions on the coordinate arrays x[] and y[]: the loops are
+   plain arithmetic with min/max reductions for the extents, which the
+   compiler can vectorise */
+static void rs_plot_n(int *restrict x, int *restrict y, int n){
+  int k, a, b, x0=INT_MAX, y0=INT_MAX, x1=INT_MIN, y1=INT_MIN;
+  int ox=st->org_x, oy=st->org_y;
+  for (k=0;k<n;k++) {
+    a=(2*y[k])/9-ox; b=(2*x[k])/9-oy;
+    x[k]=a; y[k]=b;
+    x0=(a<x0)?a:x0; x1=(a>x1)?a:x1;
+    y0=(b<y0)?b:y0; y1=(b>y1)?b:y1;
+  }
+  if (n>0) ext_widen(x0,y0,x1,y1);
+}
+static void rs_drill_n(int *restrict x, int *restrict y, int n){
+  int k, a, b, x0=INT_MAX, y0=INT_MAX, x1=INT_MIN, y1=INT_MIN;
+  int ox=10*st->org_x, oy=10*st->org_y;
+  for (k=0;k<n;k++) {
+    a=(20*y[k])/9-ox; b=(20*x[k])/9-oy;
+    x[k]=a; y[k]=b;
+    x0=(a<x0)?a:x0; x1=(a>x1)?a:x1;
+    y0=(b<y0)?b:y0; y1=(b>y1)?b:y1;
+  }
+  if (n>0) ext_widen(x0/10,y0/10,x1/10,y1/10);
+}
+
+static int pool_grow(int n){
+  if (n<=st->pool_max) return 0;
+  free(st->pool_x); free(st->pool_y);
+  st->pool_max=n+1024;
+  st->pool_x=malloc(st->pool_max*sizeof(int));
+  st->pool_y=malloc(st->pool_max*sizeof(int));
+  if (st->pool_x && st->pool_y) return 0;
+  free(st->pool_x); free(st->pool_y);
+  st->pool_x=st->pool_y=NULL; st->pool_max=0;
+  return 1;
+}
+
+/* read n points of the current object into the pool and scale them for
+   the plot. Returns 1 without memory. */
+static int get_points(int n){
+  int k;
+  if (pool_grow(n)) return 1;
+  st->varp=NULL;
+  for (k=0;k<n;k++) getpair(&st->pool_x[k],&st->pool_y[k]);
+  rs_plot_n(st->pool_x,st->pool_y,n);
+  return 0;
+}
+
+/* same for n points given in xfig units, as those of splines */
+static int pool_load(int *x, int *y, int n){
+  if (pool_grow(n)) return 1;
+  memcpy(st->pool_x,x,n*sizeof(int)); memcpy(st->pool_y,y,n*sizeof(int));
+  rs_plot_n(st->pool_x,st->pool_y,n);
+  return 0;
+}
+
+static void ext_reset(void){
+  int d;
+  for (d=0;d<MAXDEPTH;d++) {
+    st->ext_x0[d]=st->ext_y0[d]=INT_MAX; st->ext_x1[d]=st->ext_y1[d]=INT_MIN;
+  }
+}
+
+/* board extents as the union of all depths; with report each depth and
+   the board are listed on stderr. Returns 1 if coordinates do not fit
+   the output format, after a warning. */
+static int ext_report(int report){
+  int d, x0=INT_MAX, y0=INT_MAX, x1=INT_MIN, y1=INT_MIN;
+  for (d=0;d<MAXDEPTH;d++) {
+    if (st->ext_x0[d]>st->ext_x1[d]) continue;
+    if (report)
+      fprintf(stderr,"depth %3d: x %6d..%6d  y %6d..%6d mil\n",
+	      d,st->ext_x0[d],st->ext_x1[d],st->ext_y0[d],st->ext_y1[d]);
+    if (st->ext_x0[d]<x0) x0=st->ext_x0[d];
+    if (st->ext_y0[d]<y0) y0=st->ext_y0[d];
+    if (st->ext_x1[d]>x1) x1=st->ext_x1[d];
+    if (st->ext_y1[d]>y1) y1=st->ext_y1[d];
+  }
+  if (x0>x1) return 0; /* nothing drawn */
+  if (report)
+    fprintf(stderr,"board    : x %6d..%6d  y %6d..%6d mil, "
+	    "%.3f x %.3f inch\n",x0,x1,y0,y1,(x1-x0)/1000.0,(y1-y0)/1000.0);
+  if (x0<-EXT_LIMIT || y0<-EXT_LIMIT || x1>EXT_LIMIT || y1>EXT_LIMIT) {
+    fprintf(stderr,"Coordinates beyond %d mil do not fit the output "
+	    "format.\n",EXT_LIMIT);
+    return 1;
+  }
+  return 0;
+}
+static void rs_single(int *x){
+  int a;
+  a=(2 * (*x))/9;
+  *x=a;
+}
+static int get_tool_number(int radius) {
+  int i=drill_number;
+  for (i=0;i<drill_number;i++) {
+    if (drilltab[i].graph_units==radius) break;
+  };
+  if (i==drill_number) i=0;  /* default drill tool */
+  return i;
+}
+
+/* convert line width into a tool index or return default tool  */
+static int get_route_tool(int width) {
+    int i=drill_number;
+    for (i=0;i<drill_number;i++) {
+	if (drilltab[i].route_width==width) break;
+    };
+    if (i==drill_number) i=0;  /* default drill tool */
+    return i;
+}
+
+/* select the routing tool for a contour of a given line width, and emit a
+   tool change if necessary. The tool is found like for slots, unless a
+   bit is given with -b; that one gets the tool number after the drill
+   tools. A width without a tool of its own is routed with the default
+   tool, with a warning. Returns the bit diameter in drill units (0.1 mil). */
+static double rout_select(FILE *f, int width, int *actual_drill){
+    int t;
+    if (st->rout_bit>0.0) {
+	if (*actual_drill!=drill_number) {
+	    *actual_drill=drill_number;
+	    fprintf(f,"T%01dC%05.3f\n",tool_number+1,st->rout_bit/1000.0);
+	}
+	return st->rout_bit*10.0;
+    }
+    t=get_route_tool(width);
+    if (drilltab[t].route_width!=width && width!=st->rout_warned) {
+	fprintf(stderr,"No routing tool for outline width %d, routed with "
+		"T%d (%.3f\"). Use -b to give the bit.\n",width,
+		drilltab[t].tool_index,drilltab[t].diameter);
+	st->rout_warned=width;
+    }
+    if (*actual_drill!=t) {
+	*actual_drill=t;
+	fprintf(f,"T%01dC%05.3f\n",drilltab[t].tool_index,drilltab[t].diameter);
+    }
+    return drilltab[t].diameter*10000.0;
+}
+
+/* remember mouse bite holes across a tab centered at arc length c of a
+   contour; pos() gives the point at an arc length */
+static int add_bites(double c, void (*pos)(double s, int *x, int *y)){
+    int m, j, *p;
+    if (st->bite_pitch<=0.0) return 0;
+    m=(int)(st->tab_width/st->bite_pitch)+1;
+    for (j=0;j<m;j++) {
+	if (st->bite_num==st->bite_max) {
+	    st->bite_max=st->bite_max?2*st->bite_max:256;
+	    if (!(p=realloc(st->bite_x,st->bite_max*sizeof(int)))) return -1;
+	    st->bite_x=p;
+	    if (!(p=realloc(st->bite_y,st->bite_max*sizeof(int)))) return -1;
+	    st->bite_y=p;
+	}
+	pos(c+(j-(m-1)/2.0)*st->bite_pitch*10.0,
+	    &st->bite_x[st->bite_num],&st->bite_y[st->bite_num]);
+	st->bite_num++;
+    }
+    return 0;
+}
+
+/* point at arc length s along the closed polyline st->ct_* being routed */
+static void contour_pos(double s, int *x, int *y){
+    int i;
+    double t;
+    s=fmod(s,st->ct_len); if (s<0) s+=st->ct_len;
+    for (i=0;i<st->ct_n-1 && st->ct_s[i+1]<s;i++);
+    t=(st->ct_s[i+1]>st->ct_s[i])?
+      (s-st->ct_s[i])/(st->ct_s[i+1]-st->ct_s[i]):0.0;
+    *x=(int)floor(st->ct_x[i]+t*(st->ct_x[(i+1)%st->ct_n]-st->ct_x[i])+0.5);
+    *y=(int)floor(st->ct_y[i]+t*(st->ct_y[(i+1)%st->ct_n]-st->ct_y[i])+0.5);
+}
+
+/* rout a polyline given in drill units. Closed contours get tabs, which
+   are gaps in the path of tab width plus the bit diameter. */
+static int rout_polyline(FILE *f, int *x, int *y, int n, int closed,
+			 double bit){
+    int i, k, m, px, py;
+    double gap, s0, s1, v;
+
+    if (n<1) return 0;
+    if (!closed || st->tab_num<1 || n<2) {
+	fprintf(f,"G00X%06dY%06d\nM15\n",x[0],y[0]);
+	for (i=1;i<n;i++) fprintf(f,"G01X%06dY%06d\n",x[i],y[i]);
+	if (closed) fprintf(f,"G01X%06dY%06d\n",x[0],y[0]);
+	fprintf(f,"M16\n");
+	return 0;
+    }
+    st->ct_x=x; st->ct_y=y; st->ct_n=n;
+    if (!(st->ct_s=malloc((n+1)*sizeof(double)))) return -1;
+    for (st->ct_s[0]=0.0,i=0;i<n;i++)
+	st->ct_s[i+1]=st->ct_s[i]+hypot(x[(i+1)%n]-x[i],y[(i+1)%n]-y[i]);
+    st->ct_len=st->ct_s[n];
+    gap=st->tab_width*10.0+bit;
+    if (st->ct_len<=st->tab_num*gap) { /* all tabs */
+	fprintf(stderr,"Contour at X%.3f Y%.3f is shorter than its %d tabs "
+		"and is not routed.\n",x[0]/10000.0,y[0]/10000.0,st->tab_num);
+	free(st->ct_s); return 0;
+    }
+
+    /* pieces between tab k and tab k+1, tab centers at (k+0.5)*len/num */
+    for (k=0;k<st->tab_num;k++) {
+	s0=(k+0.5)*st->ct_len/st->tab_num+gap/2;
+	s1=(k+1.5)*st->ct_len/st->tab_num-gap/2;
+	contour_pos(s0,&px,&py);
+	fprintf(f,"G00X%06dY%06d\nM15\n",px,py);
+	/* vertices inside the piece, which may wrap around the start */
+	for (m=0;m<2;m++) {
+	    for (i=0;i<n;i++) {
+		v=st->ct_s[i]+m*st->ct_len;
+		if (v>s0 && v<s1) fprintf(f,"G01X%06dY%06d\n",x[i],y[i]);
+	    }
+	}
+	contour_pos(s1,&px,&py);
+	fprintf(f,"G01X%06dY%06d\nM16\n",px,py);
+	if (add_bites((k+0.5)*st->ct_len/st->tab_num,contour_pos)) {
+	    free(st->ct_s); return -1;
+	}
+    }
+    free(st->ct_s);
+    return 0;
+}
+
+/* point at arc length s along the circle st->cc_* being routed */
+static void circle_pos(double s, int *x, int *y){
+    *x=(int)floor(st->cc_x+st->cc_r*cos(s/st->cc_r)+0.5);
+    *y=(int)floor(st->cc_y+st->cc_r*sin(s/st->cc_r)+0.5);
+}
+
+/* rout a circle counterclockwise, with tabs if requested */
+static int rout_circle(FILE *f, int cx, int cy, int r, double bit){
+    int k, x0, y0, x1, y1;
+    double len, gap;
+
+    if (r<1) return 0;
+    st->cc_x=cx; st->cc_y=cy; st->cc_r=r;
+    len=2*M_PI*r; gap=st->tab_width*10.0+bit;
+    if (st->tab_num<1) {
+	fprintf(f,"G00X%06dY%06d\nM15\nG03X%06dY%06dI%06dJ%06d\nM16\n",
+		cx+r,cy,cx+r,cy,-r,0);
+	return 0;
+    }
+    if (len<=st->tab_num*gap) {
+	fprintf(stderr,"Circle at X%.3f Y%.3f is shorter than its %d tabs "
+		"and is not routed.\n",cx/10000.0,cy/10000.0,st->tab_num);
+	return 0;
+    }
+    for (k=0;k<st->tab_num;k++) {
+	circle_pos((k+0.5)*len/st->tab_num+gap/2,&x0,&y0);
+	circle_pos((k+1.5)*len/st->tab_num-gap/2,&x1,&y1);
+	fprintf(f,"G00X%06dY%06d\nM15\nG03X%06dY%06dI%06dJ%06d\nM16\n",
+		x0,y0,x1,y1,cx-x0,cy-y0);
+	if (add_bites((k+0.5)*len/st->tab_num,circle_pos)) return -1;
+    }
+    return 0;
+}
+
+/* drill the collected mouse bite holes with the tool closest to the
+   requested diameter. The contours leave the file in route mode, so
+   switch back to drill mode first or the hits are only moves. */
+static void rout_bites(FILE *f){
+    int i, t=0;
+    for (i=1;i<drill_number;i++)
+	if (fabs(drilltab[i].diameter*1000-st->bite_dia)<
+	    fabs(drilltab[t].diameter*1000-st->bite_dia)) t=i;
+    fprintf(f,"G05\n");
+    fprintf(f,"T%01dC%05.3f\n",drilltab[t].tool_index,drilltab[t].diameter);
+    for (i=0;i<st->bite_num;i++)
+	fprintf(f,"X%06dY%06d\n",st->bite_x[i],st->bite_y[i]);
+    st->bite_num=0;
+}
+
+/* drops repeated points of a slot and joins collinear segments running
+   on in the same direction; returns the remaining number of points */
+static int slot_merge(int *x, int *y, int n){
+    int k, m=1;
+    long long ax, ay, bx, by;
+    for (k=1;k<n;k++) {
+	if (x[k]==x[m-1] && y[k]==y[m-1]) continue;
+	if (m>=2) {
+	    ax=x[m-1]-x[m-2]; ay=y[m-1]-y[m-2];
+	    bx=x[k]-x[m-1]; by=y[k]-y[m-1];
+	    if (ax*by==ay*bx && ax*bx+ay*by>0) m--; /* goes on straight */
+	}
+	x[m]=x[k]; y[m++]=y[k];
+    }
+    return m;
+}
+static int drill_cmp(const void *a, const void *b){
+    int p=*(const int *)a, q=*(const int *)b;
+    int tp=drilltab[st->drill_buf.prim[p].aperture].tool_index;
+    int tq=drilltab[st->drill_buf.prim[q].aperture].tool_index;
+    return (tp!=tq)?tp-tq:p-q;
+}
+
+/* writes the hits and slots of drill_buf grouped by tool, in file order
+   within a tool, and empties it. Returns nonzero without memory. */
+static int drill_flush(FILE *f){
+    int *idx, k, m, n, t=-1, *x, *y;
+    primitive *p;
+    idx=malloc((st->drill_buf.num+1)*sizeof(int));
+    if (!idx || st->drill_buf.failed) {
+	free(idx); st->drill_buf.num=st->drill_buf.npts=st->drill_buf.failed=0;
+	return 1;
+    }
+    for (k=0;k<st->drill_buf.num;k++) idx[k]=k;
+    qsort(idx,st->drill_buf.num,sizeof(int),drill_cmp);
+    for (k=0;k<st->drill_buf.num;k++) {
+	p=&st->drill_buf.prim[idx[k]];
+	if (!p->num) continue;
+	if (drilltab[p->aperture].tool_index!=t) {
+	    t=drilltab[p->aperture].tool_index;
+	    fprintf(f,"T%01dC%05.3f\n",t,drilltab[p->aperture].diameter);
+	}
+	x=st->drill_buf.x+p->first; y=st->drill_buf.y+p->first;
+	n=slot_merge(x,y,p->num);
+	if (n==1) {
+	    fprintf(f,"X%06dY%06d\n",x[0],y[0]);
+	} else if (st->slot_mode==SLOT_G85) {
+	    for (m=1;m<n;m++)
+		fprintf(f,"X%06dY%06dG85X%06dY%06d\n",
+			x[m-1],y[m-1],x[m],y[m]);
+	} else { /* tool down, along the path, up and back to drilling */
+	    fprintf(f,"G00X%06dY%06d\nM15\n",x[0],y[0]);
+	    for (m=1;m<n;m++) fprintf(f,"G01X%06dY%06d\n",x[m],y[m]);
+	    fprintf(f,"M16\nG05\n");
+	}
+    }
+    free(idx);
+    st->drill_buf.num=st->drill_buf.npts=0;
+    return 0;
+}
+
+/* recording of primitives for previews. Nothing happens without an image
+   to capture into; on memory shortage the image is marked as failed. */
+static void img_begin(layer_image *im, int kind, int aperture, int depth){
+    primitive *p;
+    if (!im || im->failed) return;
+    if (im->num==im->max) {
+	p=realloc(im->prim,(im->max+256)*sizeof(primitive));
+	if (!p) {im->failed=1; return;}
+	im->prim=p; im->max+=256;
+    }
+    p=&im->prim[im->num++];
+    p->kind=kind; p->clear=st->capture_clear; p->aperture=aperture;
+    p->depth=depth; p->first=im->npts; p->num=0; p->net=st->obj_net;
+}
+static void img_point(layer_image *im, int x, int y){
+    int *nx, *ny;
+    if (!im || im->failed || !im->num) return;
+    if (im->npts==im->maxpts) {
+	nx=realloc(im->x,(im->maxpts+1024)*sizeof(int));
+	if (nx) im->x=nx;
+	ny=realloc(im->y,(im->maxpts+1024)*sizeof(int));
+	if (ny) im->y=ny;
+	if (!nx || !ny) {im->failed=1; return;}
+	im->maxpts+=1024;
+    }
+    im->x[im->npts]=x; im->y[im->npts++]=y;
+    im->prim[im->num-1].num++;
+}
+static void cap_begin(int kind, int aperture, int depth){
+    img_begin(st->capture,kind,aperture,depth);
+}
+static void cap_point(int x, int y){
+    img_point(st->capture,x,y);
+}
+/* arc around cx,cy from a to e as a chain of points within 0.1 mil of the
+   true arc; a coinciding start and end point gives a full circle */
+static void cap_arc(int cx, int cy, int ax, int ay, int ex, int ey, int cw){
+    double r, a0, d, step;
+    int k, n;
+    if (!st->capture) return;
+    r=hypot(ax-cx,ay-cy);
+    a0=atan2(ay-cy,ax-cx);
+    if (ax==ex && ay==ey) {
+	d=2*M_PI;
+    } else {
+	d=atan2(ey-cy,ex-cx)-a0;
+	if (d<=0) d+=2*M_PI;
+    }
+    if (cw) d-=2*M_PI;
+    step=(r>0.1)?2*acos(1-0.1/r):M_PI/2;
+    n=(int)ceil(fabs(d)/step);
+    if (n<4) n=4;
+    if (n>1024) n=1024;
+    for (k=0;k<=n;k++)
+	cap_point(cx+(int)floor(r*cos(a0+d*k/n)+0.5),
+		  cy+(int)floor(r*sin(a0+d*k/n)+0.5));
+}
+
+/* extent of the aperture of a primitive in mil; w==h for round ones */
+static void prim_size(primitive *p, double *w, double *h){
+    int k, a=p->aperture;
+    *w=*h=0.0;
+    if (p->kind==PRIM_HOLE) {
+	if (a>=0 && a<drill_number) *w=*h=drilltab[a].diameter*1000.0;
+	return;
+    }
+    if (a>=STENCIL_DCODE && a<2*STENCIL_DCODE &&
+	st->stencil_cache[a-STENCIL_DCODE].done) {
+	*w=st->stencil_cache[a-STENCIL_DCODE].w;
+	*h=st->stencil_cache[a-STENCIL_DCODE].h;
+	return;
+    }
+    if (clear_of(a)) {
+	*w=clear_of(a)->w; *h=clear_of(a)->h;
+	return;
+    }
+    if (a>=20 && a<=maxaperture+20) {
+	k=a-20;
+	*w=*h=(k==0?1.0:(k==2?8.0:k*3.333));
+	return;
+    }
+    for (k=0;k<num_round_apert;k++)
+	if (rnd_apt_tab[k].aperture_idx==a) {
+	    *w=*h=rnd_apt_tab[k].real_dia*1000.0; return;
+	}
+    for (k=0;k<num_rect_apert;k++)
+	if (rectap_tab[k].aperture_idx==a) {
+	    *w=rectap_tab[k].real_x*1000.0; *h=rectap_tab[k].real_y*1000.0;
+	    return;
+	}
+}
+static int prim_is_rect(primitive *p){
+    int k;
+    if (p->kind!=PRIM_FLASH) return 0;
+    if (p->aperture>=STENCIL_DCODE && p->aperture<2*STENCIL_DCODE)
+	return st->stencil_cache[p->aperture-STENCIL_DCODE].rect;
+    if (clear_of(p->aperture)) return clear_of(p->aperture)->rect;
+    for (k=0;k<num_rect_apert;k++)
+	if (rectap_tab[k].aperture_idx==p->aperture) return 1;
+    return 0;
+}
+
+/* reduced size of a pad side for the stencil, at least 1 mil */
+static double stencil_size(double s){
+    s=s*(1.0-st->stencil_percent/100.0)-2*st->stencil_shrink;
+    return (s<1.0)?1.0:s;
+}
+/* shrinks the n points in the pool for a stencil opening: each axis is
+   scaled about the center of the extents to the reduced size */
+static void stencil_pool(int n){
+    int k, x0=INT_MAX, y0=INT_MAX, x1=INT_MIN, y1=INT_MIN;
+    double fx, fy, cx, cy;
+    for (k=0;k<n;k++) {
+	if (st->pool_x[k]<x0) x0=st->pool_x[k];
+	if (st->pool_x[k]>x1) x1=st->pool_x[k];
+	if (st->pool_y[k]<y0) y0=st->pool_y[k];
+	if (st->pool_y[k]>y1) y1=st->pool_y[k];
+    }
+    if (n<2) return;
+    fx=(x1>x0)?stencil_size(x1-x0)/(x1-x0):1.0;
+    fy=(y1>y0)?stencil_size(y1-y0)/(y1-y0):1.0;
+    cx=(x0+x1)/2.0; cy=(y0+y1)/2.0;
+    for (k=0;k<n;k++) {
+	st->pool_x[k]=(int)floor(cx+(st->pool_x[k]-cx)*fx+0.5);
+	st->pool_y[k]=(int)floor(cy+(st->pool_y[k]-cy)*fy+0.5);
+    }
+}
+/* stencil aperture derived from a pad aperture, or NULL if there is none */
+static stencil_entry *get_stencil(int ap){
+    stencil_entry *e;
+    primitive p;
+    double w, h;
+    if (ap<0 || ap>=STENCIL_DCODE) return NULL;
+    e=&st->stencil_cache[ap];
+    if (e->done) return e;
+    p.kind=PRIM_FLASH; p.aperture=ap;
+    prim_size(&p,&w,&h);
+    if (w<=0) return NULL;
+    e->rect=prim_is_rect(&p);
+    w=stencil_size(w); h=stencil_size(h);
+    e->nx=e->ny=1; e->w=w; e->h=h; e->px=e->py=0;
+    if (e->rect && st->stencil_pane>0) { /* window panes */
+	if (w>st->stencil_pane) {
+	    e->nx=(int)ceil((w+st->stencil_web)/(st->stencil_pane+st->stencil_web));
+	    e->w=(w-(e->nx-1)*st->stencil_web)/e->nx; e->px=e->w+st->stencil_web;
+	}
+	if (h>st->stencil_pane) {
+	    e->ny=(int)ceil((h+st->stencil_web)/(st->stencil_pane+st->stencil_web));
+	    e->h=(h-(e->ny-1)*st->stencil_web)/e->ny; e->py=e->h+st->stencil_web;
+	}
+    }
+    e->done=1;
+    return e;
+}
+
+/* D code of the clearance aperture of pad aperture ap for the layer class
+   being written; ap itself if it has no size */
+static int clear_dcode(int ap){
+    clear_entry *e;
+    primitive p;
+    double w, h;
+    if (ap<CLEAR_PAD0 || ap>=CLEAR_PAD0+CLEAR_PADS) return ap;
+    e=&st->clear_cache[st->clear_class][ap-CLEAR_PAD0];
+    if (!e->done) {
+	p.kind=PRIM_FLASH; p.aperture=ap;
+	prim_size(&p,&w,&h);
+	if (w<=0) return ap;
+	e->rect=prim_is_rect(&p);
+	e->w=w+2*st->clear_mil[st->clear_class];
+	e->h=h+2*st->clear_mil[st->clear_class];
+	e->done=1;
+    }
+    return CLEAR_DCODE+st->clear_class*CLEAR_PADS+ap-CLEAR_PAD0;
+}
+
+/* clearance aperture of a D code, or NULL if it is none */
+static clear_entry *clear_of(int dcode){
+    int d=dcode-CLEAR_DCODE;
+    if (d<0 || d>=CLEAR_CLASSES*CLEAR_PADS) return NULL;
+    return st->clear_cache[d/CLEAR_PADS][d%CLEAR_PADS].done?
+	&st->clear_cache[d/CLEAR_PADS][d%CLEAR_PADS]:NULL;
+}
+
+/* clearance apertures of all pad apertures for the class of the file */
+static void clear_header(FILE *f){
+    clear_entry *e;
+    int k, d;
+    fprintf(f,"G04 Aperture definitions for pad clearances *\n");
+    for (k=0;k<num_round_apert+num_rect_apert;k++) {
+	d=(k<num_round_apert)?rnd_apt_tab[k].aperture_idx:
+	    rectap_tab[k-num_round_apert].aperture_idx;
+	if (!(e=clear_of(d=clear_dcode(d)))) continue;
+	if (e->rect) fprintf(f,"%%ADD%03dR,%05.4fX%05.4f*%%\n",d,
+			     e->w/1000.0,e->h/1000.0);
+	else fprintf(f,"%%ADD%03dC,%05.4f*%%\n",d,e->w/1000.0);
+    }
+}
+
+/* definitions of the stencil apertures of all pad apertures */
+static void stencil_header(FILE *f){
+    stencil_entry *e;
+    int k;
+    fprintf(f,"G04 Aperture definitions for stencil openings *\n");
+    for (k=0;k<num_round_apert;k++) {
+	if (!(e=get_stencil(rnd_apt_tab[k].aperture_idx))) continue;
+	fprintf(f,"%%ADD%03dC,%05.4f*%%\n",
+		rnd_apt_tab[k].aperture_idx+STENCIL_DCODE,e->w/1000.0);
+    }
+    for (k=0;k<num_rect_apert;k++) {
+	if (!(e=get_stencil(rectap_tab[k].aperture_idx))) continue;
+	fprintf(f,"%%ADD%03dR,%05.4fX%05.4f*%%\n",
+		rectap_tab[k].aperture_idx+STENCIL_DCODE,
+		e->w/1000.0,e->h/1000.0);
+    }
+}
+/* stencil opening for a flash of pad aperture ap at x,y */
+static void stencil_flash(FILE *f, int ap, int x, int y, int depth){
+    stencil_entry *e=get_stencil(ap);
+    int a, b, px, py;
+    if (!e) return;
+    for (a=0;a<e->nx;a++)
+	for (b=0;b<e->ny;b++) {
+	    px=x+(int)floor((a-(e->nx-1)/2.0)*e->px+0.5);
+	    py=y+(int)floor((b-(e->ny-1)/2.0)*e->py+0.5);
+	    fprintf(f,"G54D%03d*G01*X%05dY%05dD02*D03*\n",
+		    ap+STENCIL_DCODE,px,py);
+	    cap_begin(PRIM_FLASH,ap+STENCIL_DCODE,depth);
+	    cap_point(px,py);
+	}
+}
+
+/* raster previews: the board is cut into bands of TILE_ROWS pixel rows,
+   which are rendered by a pool of threads. The primitives are sorted into
+   the bands their rows meet once, and each row is filled span by span with
+   the primitives of its band in recording order, dark ones setting and
+   clear ones resetting pixels. */
+#define TILE_ROWS 64
+typedef struct {
+    layer_image *img; unsigned char *bits; /* packed 1 bit/pixel, 1=dark */
+    int *r0, *r1; /* row range of each primitive */
+    char *rect;   /* primitive is a rectangular flash */
+    double *w, *h;
+    int *bstart, *blist; /* band b: blist[bstart[b]..bstart[b+1]-1] */
+} preview_layer;
+typedef struct {
+    preview_layer *lay; int nlay;
+    int width, height, bands, next, maxpts;
+    double xmin, ymax, pitch; /* origin (mil) and mil per pixel */
+    pthread_mutex_t lock;
+} preview_job;
+
+/* x interval on row height y where a*x+b lies within [lo,hi] */
+static void lin_range(double a, double b, double lo, double hi,
+		      double *xa, double *xb){
+    double t;
+    if (a==0.0) {
+	if (b<lo || b>hi) {*xa=1; *xb=0;}
+	return;
+    }
+    lo=(lo-b)/a; hi=(hi-b)/a;
+    if (lo>hi) {t=lo; lo=hi; hi=t;}
+    if (lo>*xa) *xa=lo;
+    if (hi<*xb) *xb=hi;
+}
+static void fill_span(preview_job *j, unsigned char *row, double xa,
+		      double xb, int val){
+    int c0, c1;
+    if (xa>xb) return;
+    c0=(int)ceil((xa-j->xmin)/j->pitch-0.5);
+    c1=(int)floor((xb-j->xmin)/j->pitch-0.5);
+    if (c0<0) c0=0;
+    if (c1>=j->width) c1=j->width-1;
+    if (c0<=c1) memset(row+c0,val,c1-c0+1);
+}
+/* span of a disk of radius r at x,y on row height ym */
+static void disk_span(preview_job *j, unsigned char *row, double x, double y,
+		      double r, double ym, int val){
+    double d=r*r-(ym-y)*(ym-y);
+    if (d>=0) fill_span(j,row,x-sqrt(d),x+sqrt(d),val);
+}
+/* span of a line of width 2r from 0 to 1; the capsule is convex, so the
+   spans of its end disks and its straight part join to one interval */
+static void capsule_span(preview_job *j, unsigned char *row, double x0,
+			 double y0, double x1, double y1, double r, double ym,
+			 int val){
+    double dx=x1-x0, dy=y1-y0, l=hypot(dx,dy), xa, xb, d;
+    double lo=1e30, hi=-1e30;
+    if (l>0) {
+	xa=-1e30; xb=1e30; /* projection on and distance from the line */
+	lin_range(dx/l,((ym-y0)*dy-x0*dx)/l,0,l,&xa,&xb);
+	lin_range(dy/l,(-(ym-y0)*dx-x0*dy)/l,-r,r,&xa,&xb);
+	if (xa<=xb) {lo=xa; hi=xb;}
+    }
+    d=r*r-(ym-y0)*(ym-y0);
+    if (d>=0) {
+	if (x0-sqrt(d)<lo) lo=x0-sqrt(d);
+	if (x0+sqrt(d)>hi) hi=x0+sqrt(d);
+    }
+    d=r*r-(ym-y1)*(ym-y1);
+    if (d>=0) {
+	if (x1-sqrt(d)<lo) lo=x1-sqrt(d);
+	if (x1+sqrt(d)>hi) hi=x1+sqrt(d);
+    }
+    fill_span(j,row,lo,hi,val);
+}
+static int dbl_cmp(const void *a, const void *b){
+    double d=*(double *)a-*(double *)b;
+    return (d>0)-(d<0);
+}
+static void render_band(preview_job *j, preview_layer *pl, int band,
+			unsigned char *row, double *xs){
+    layer_image *img=pl->img;
+    primitive *p;
+    int r, b, k, n, c, val, bpr=(j->width+7)/8;
+    int *x, *y;
+    double ym, rad;
+    for (r=band*TILE_ROWS;r<(band+1)*TILE_ROWS && r<j->height;r++) {
+	memset(row,0,j->width);
+	ym=j->ymax-(r+0.5)*j->pitch;
+	for (b=pl->bstart[band];b<pl->bstart[band+1];b++) {
+	    k=pl->blist[b];
+	    if (r<pl->r0[k] || r>pl->r1[k]) continue;
+	    p=&img->prim[k]; val=!p->clear;
+	    x=&img->x[p->first]; y=&img->y[p->first];
+	    rad=pl->w[k]/2;
+	    switch (p->kind) {
+	    case PRIM_FLASH:
+		if (pl->rect[k]) {
+		    if (fabs(ym-y[0])<=pl->h[k]/2)
+			fill_span(j,row,x[0]-rad,x[0]+rad,val);
+		} else {
+		    disk_span(j,row,x[0],y[0],rad,ym,val);
+		}
+		break;
+	    case PRIM_STROKE: case PRIM_HOLE:
+		if (p->num==1) disk_span(j,row,x[0],y[0],rad,ym,val);
+		for (n=1;n<p->num;n++)
+		    capsule_span(j,row,x[n-1],y[n-1],x[n],y[n],rad,ym,val);
+		break;
+	    case PRIM_REGION: /* even-odd rule, closed implicitly */
+		for (n=0,c=0;n<p->num;n++) {
+		    int m=n?n-1:p->num-1;
+		    if ((y[n]<=ym)!=(y[m]<=ym))
+			xs[c++]=x[m]+(ym-y[m])*(x[n]-x[m])/(double)(y[n]-y[m]);
+		}
+		qsort(xs,c,sizeof(double),dbl_cmp);
+		for (n=0;n+1<c;n+=2) fill_span(j,row,xs[n],xs[n+1],val);
+		break;
+	    }
+	}
+	for (c=0;c<bpr;c++) { /* pack, most significant bit first */
+	    val=0;
+	    for (n=0;n<8;n++)
+		if (c*8+n<j->width && row[c*8+n]) val|=0x80>>n;
+	    pl->bits[(long)r*bpr+c]=val;
+	}
+    }
+}
+/* bands b0..b1 met by the rows of primitive k */
+static void preview_bands(preview_job *j, preview_layer *pl, int k,
+			  int *b0, int *b1){
+    *b0=(pl->r0[k]<0)?0:pl->r0[k]/TILE_ROWS;
+    *b1=(pl->r1[k]>=j->height)?j->bands-1:pl->r1[k]/TILE_ROWS;
+    if (pl->r1[k]<0) *b1=-1;
+}
+static void *preview_worker(void *arg){
+    preview_job *j=arg;
+    unsigned char *row=malloc(j->width);
+    double *xs=malloc((j->maxpts+1)*sizeof(double));
+    int t;
+    for (;;) {
+	pthread_mutex_lock(&j->lock);
+	t=j->next++;
+	pthread_mutex_unlock(&j->lock);
+	if (t>=j->bands*j->nlay) break;
+	if (row && xs) render_band(j,&j->lay[t/j->bands],t%j->bands,row,xs);
+    }
+    free(row); free(xs);
+    return (row && xs)?NULL:arg;
+}
+/* renders all captured drill and gerber layers on a common grid of dpi
+   pixels per inch and writes them as root.<suffix>.pbm. Copper area and
+   fill ratio per layer are reported on stderr. */
+static int preview_layers(layer_image *img, int num, char *root){
+    preview_job j;
+    preview_layer *lay;
+    pthread_t th[16];
+    int l, k, m, n, b, b0, b1, nth, bpr, ret=0;
+    long set, bytes;
+    double xmin=1e30, xmax=-1e30, ymin=1e30, ymax=-1e30, e, lo, hi;
+    char name[MAXFILNAMLEN+8];
+    FILE *f;
+    primitive *p;
+
+    lay=calloc(num,sizeof(preview_layer));
+    if (!lay) return 1;
+    memset(&j,0,sizeof(j));
+    /* common board extents */
+    for (l=0;l<num;l++) {
+	if (!img[l].num) continue;
+	lay[j.nlay].img=&img[l];
+	n=img[l].num;
+	lay[j.nlay].r0=malloc(n*sizeof(int)); lay[j.nlay].r1=malloc(n*sizeof(int));
+	lay[j.nlay].w=malloc(n*sizeof(double)); lay[j.nlay].h=malloc(n*sizeof(double));
+	lay[j.nlay].rect=malloc(n);
+	if (!lay[j.nlay].r0 || !lay[j.nlay].r1 || !lay[j.nlay].w ||
+	    !lay[j.nlay].h || !lay[j.nlay].rect) {j.nlay++; ret=1; goto done;}
+	for (k=0;k<n;k++) {
+	    p=&img[l].prim[k];
+	    prim_size(p,&lay[j.nlay].w[k],&lay[j.nlay].h[k]);
+	    lay[j.nlay].rect[k]=prim_is_rect(p);
+	    if (p->num>j.maxpts) j.maxpts=p->num;
+	    lo=lay[j.nlay].w[k]/2; e=lay[j.nlay].h[k]/2;
+	    for (m=p->first;m<p->first+p->num;m++) {
+		if (img[l].x[m]-lo<xmin) xmin=img[l].x[m]-lo;
+		if (img[l].x[m]+lo>xmax) xmax=img[l].x[m]+lo;
+		if (img[l].y[m]-e<ymin) ymin=img[l].y[m]-e;
+		if (img[l].y[m]+e>ymax) ymax=img[l].y[m]+e;
+	    }
+	}
+	j.nlay++;
+    }
+    if (!j.nlay) goto done;
+    j.pitch=1000.0/st->preview_dpi;
+    j.xmin=xmin; j.ymax=ymax;
+    j.width=(int)ceil((xmax-xmin)/j.pitch)+1;
+    j.height=(int)ceil((ymax-ymin)/j.pitch)+1;
+    j.bands=(j.height+TILE_ROWS-1)/TILE_ROWS;
+    bpr=(j.width+7)/8;
+    bytes=(long)bpr*j.height;
+    /* row ranges of all primitives */
+    for (l=0;l<j.nlay;l++) {
+	if (!(lay[l].bits=malloc(bytes))) {ret=1; goto done;}
+	for (k=0;k<lay[l].img->num;k++) {
+	    p=&lay[l].img->prim[k];
+	    e=lay[l].h[k]/2; lo=1e30; hi=-1e30;
+	    for (n=p->first;n<p->first+p->num;n++) {
+		if (lay[l].img->y[n]-e<lo) lo=lay[l].img->y[n]-e;
+		if (lay[l].img->y[n]+e>hi) hi=lay[l].img->y[n]+e;
+	    }
+	    lay[l].r0[k]=(int)floor((ymax-hi)/j.pitch-0.5);
+	    lay[l].r1[k]=(int)ceil((ymax-lo)/j.pitch-0.5);
+	}
+	/* bands of all primitives, counted first and then filled in */
+	if (!(lay[l].bstart=calloc(j.bands+1,sizeof(int)))) {ret=1; goto done;}
+	for (n=0,k=0;k<lay[l].img->num;k++) {
+	    preview_bands(&j,&lay[l],k,&b0,&b1);
+	    for (b=b0;b<=b1;b++) lay[l].bstart[b+1]++;
+	    n+=(b1>=b0)?b1-b0+1:0;
+	}
+	for (b=0;b<j.bands;b++) lay[l].bstart[b+1]+=lay[l].bstart[b];
+	if (!(lay[l].blist=malloc((n+1)*sizeof(int)))) {ret=1; goto done;}
+	for (k=0;k<lay[l].img->num;k++) { /* in recording order */
+	    preview_bands(&j,&lay[l],k,&b0,&b1);
+	    for (b=b0;b<=b1;b++) lay[l].blist[lay[l].bstart[b]++]=k;
+	}
+	for (b=j.bands;b>0;b--) lay[l].bstart[b]=lay[l].bstart[b-1];
+	lay[l].bstart[0]=0;
+    }
+    /* render in parallel */
+    j.lay=lay;
+    pthread_mutex_init(&j.lock,NULL);
+    nth=sysconf(_SC_NPROCESSORS_ONLN);
+    if (nth<1) nth=1;
+    if (nth>16) nth=16;
+    if (nth>j.bands*j.nlay) nth=j.bands*j.nlay;
+    for (k=0;k<nth;k++)
+	if (pthread_create(&th[k],NULL,preview_worker,&j)) break;
+    if (k==0) { /* no threads available; do it here */
+	if (preview_worker(&j)) ret=1;
+    }
+    for (nth=k,k=0;k<nth;k++) {
+	void *r;
+	pthread_join(th[k],&r);
+	if (r) ret=1;
+    }
+    pthread_mutex_destroy(&j.lock);
+    if (ret) goto done;
+    /* write out and report */
+    for (l=0;l<j.nlay;l++) {
+	snprintf(name,sizeof(name),"%s%s.pbm",root,
+		 suffixlist[lay[l].img->jobtype]);
+	if (!(f=out_open(name,-1))) {ret=1; goto done;}
+	fprintf(f,"P4\n# %s, %d dpi\n%d %d\n",
+		name,st->preview_dpi,j.width,j.height);
+	if (fwrite(lay[l].bits,1,bytes,f)!=(size_t)bytes) ret=1;
+	if (out_close(f)) ret=1;
+	for (set=0,k=0;k<bytes;k++) set+=__builtin_popcount(lay[l].bits[k]);
+	e=set*j.pitch*j.pitch*1e-6; /* square inches */
+	fprintf(stderr,"%s: %.4f in^2 (%.1f mm^2) copper, %.1f%% of %.3fx%.3f in\n",
+		name,e,e*645.16,100.0*set/((double)j.width*j.height),
+		j.width*j.pitch/1000.0,j.height*j.pitch/1000.0);
+    }
+ done:
+    for (l=0;l<j.nlay;l++) {
+	free(lay[l].r0); free(lay[l].r1); free(lay[l].w); free(lay[l].h);
+	free(lay[l].rect); free(lay[l].bits);
+	free(lay[l].bstart); free(lay[l].blist);
+    }
+    free(lay);
+    return ret;
+}
+
+/* design rule check. The copper jobs 2..5 and the drill job are parsed
+   again into memory; every primitive is split into items which are
+   segments or points with a radius (strokes, round flashes, holes) or
+   filled polygons (regions, rectangular flashes). Items are sorted into a
+   uniform grid, so only neighbours are compared. */
+typedef struct {
+    int prim, n;     /* owning primitive, number of points */
+    double r;        /* radius around the points */
+    int *x, *y;      /* points; a filled polygon if n>2 */
+    double bx0, by0, bx1, by1; /* bounding box including r */
+} drc_item;
+typedef struct {
+    double x0, y0, cell; int nx, ny;
+    int *start, *list; /* items of cell c: list[start[c]..start[c+1]-1] */
+} drc_grid;
+typedef struct {int job, type; double x, y, value;} drc_violation;
+#define DRC_WIDTH 1
+#define DRC_CLEARANCE 2
+#define DRC_RING 3
+#define DRC_HOLEGAP 4
+
+/* distance of p to segment a-b; foot point in q */
+static double pt_seg(double px, double py, double ax, double ay,
+		     double bx, double by, double *qx, double *qy){
+    double dx=bx-ax, dy=by-ay, l=dx*dx+dy*dy, t=0;
+    if (l>0) t=((px-ax)*dx+(py-ay)*dy)/l;
+    if (t<0) t=0;
+    if (t>1) t=1;
+    *qx=ax+t*dx; *qy=ay+t*dy;
+    return hypot(px-*qx,py-*qy);
+}
+static double cross3(double ax, double ay, double bx, double by,
+		     double cx, double cy){
+    return (bx-ax)*(cy-ay)-(by-ay)*(cx-ax);
+}
+/* distance of two segments; mx,my is the middle of the closest points */
+static double seg_seg(double ax, double ay, double bx, double by, double cx,
+		      double cy, double dx, double dy, double *mx, double *my){
+    double d, best, qx, qy;
+    double c1=cross3(ax,ay,bx,by,cx,cy), c2=cross3(ax,ay,bx,by,dx,dy);
+    double c3=cross3(cx,cy,dx,dy,ax,ay), c4=cross3(cx,cy,dx,dy,bx,by);
+    if (((c1>0 && c2<0) || (c1<0 && c2>0)) &&
+	((c3>0 && c4<0) || (c3<0 && c4>0))) { /* proper crossing */
+	*mx=ax+(bx-ax)*c3/(c3-c4); *my=ay+(by-ay)*c3/(c3-c4);
+	return 0;
+    }
+    best=pt_seg(ax,ay,cx,cy,dx,dy,&qx,&qy); *mx=(ax+qx)/2; *my=(ay+qy)/2;
+    if ((d=pt_seg(bx,by,cx,cy,dx,dy,&qx,&qy))<best) {
+	best=d; *mx=(bx+qx)/2; *my=(by+qy)/2;
+    }
+    if ((d=pt_seg(cx,cy,ax,ay,bx,by,&qx,&qy))<best) {
+	best=d; *mx=(cx+qx)/2; *my=(cy+qy)/2;
+    }
+    if ((d=pt_seg(dx,dy,ax,ay,bx,by,&qx,&qy))<best) {
+	best=d; *mx=(dx+qx)/2; *my=(dy+qy)/2;
+    }
+    return best;
+}
+/* even-odd point in polygon test */
+static int pt_in_poly(double px, double py, int *x, int *y, int n){
+    int k, m, in=0;
+    for (k=0,m=n-1;k<n;m=k++)
+	if (((y[k]>py)!=(y[m]>py)) &&
+	    (px<x[m]+(py-y[m])*(x[k]-x[m])/(double)(y[k]-y[m]))) in=!in;
+    return in;
+}
+/* gap between two items, negative if they overlap */
+static double item_dist(drc_item *a, drc_item *b, double *mx, double *my){
+    int k, m, ea, eb;
+    double d, best=1e30, x, y;
+    *mx=a->x[0]; *my=a->y[0];
+    if (a->n>2 && pt_in_poly(b->x[0],b->y[0],a->x,a->y,a->n)) {
+	*mx=b->x[0]; *my=b->y[0]; return -b->r;
+    }
+    if (b->n>2 && pt_in_poly(a->x[0],a->y[0],b->x,b->y,b->n)) {
+	*mx=a->x[0]; *my=a->y[0]; return -a->r;
+    }
+    ea=(a->n>2)?a->n:1; eb=(b->n>2)?b->n:1; /* number of edges */
+    for (k=0;k<ea;k++)
+	for (m=0;m<eb;m++) {
+	    d=seg_seg(a->x[k],a->y[k],a->x[(k+1)%a->n],a->y[(k+1)%a->n],
+		      b->x[m],b->y[m],b->x[(m+1)%b->n],b->y[(m+1)%b->n],&x,&y);
+	    if (d<best) {best=d; *mx=x; *my=y;}
+	}
+    return best-a->r-b->r;
+}
+
+/* split the dark or clear primitives of an image into items. Corners of
+   rectangular flashes are kept in *cx, *cy. */
+static drc_item *drc_items(layer_image *img, int clear, int *num,
+			   int **cx, int **cy){
+    drc_item *it;
+    primitive *p;
+    int k, m, n=0, nr=0;
+    double w, h;
+    *num=0; *cx=*cy=NULL;
+    for (k=0;k<img->num;k++) {
+	p=&img->prim[k];
+	if (p->clear!=clear || !p->num) continue;
+	n+=(p->kind==PRIM_STROKE || p->kind==PRIM_HOLE)?
+	    ((p->num>1)?p->num-1:1):1;
+	if (prim_is_rect(p)) nr++;
+    }
+    it=malloc((n+1)*sizeof(drc_item));
+    *cx=malloc((4*nr+1)*sizeof(int)); *cy=malloc((4*nr+1)*sizeof(int));
+    if (!it || !*cx || !*cy) {
+	free(it); free(*cx); free(*cy); *cx=*cy=NULL; return NULL;
+    }
+    for (n=nr=k=0;k<img->num;k++) {
+	p=&img->prim[k];
+	if (p->clear!=clear || !p->num) continue;
+	prim_size(p,&w,&h);
+	if (prim_is_rect(p)) {
+	    (*cx)[nr]=(*cx)[nr+3]=img->x[p->first]-w/2;
+	    (*cx)[nr+1]=(*cx)[nr+2]=img->x[p->first]+w/2;
+	    (*cy)[nr]=(*cy)[nr+1]=img->y[p->first]-h/2;
+	    (*cy)[nr+2]=(*cy)[nr+3]=img->y[p->first]+h/2;
+	    it[n].x=&(*cx)[nr]; it[n].y=&(*cy)[nr]; it[n].n=4; it[n].r=0;
+	    it[n++].prim=k; nr+=4;
+	} else if (p->kind==PRIM_REGION && p->num>2) {
+	    it[n].x=&img->x[p->first]; it[n].y=&img->y[p->first];
+	    it[n].n=p->num; it[n].r=0; it[n++].prim=k;
+	} else if (p->kind==PRIM_FLASH || p->num==1) {
+	    it[n].x=&img->x[p->first]; it[n].y=&img->y[p->first];
+	    it[n].n=1; it[n].r=w/2; it[n++].prim=k;
+	} else {
+	    for (m=0;m<p->num-1;m++) {
+		it[n].x=&img->x[p->first+m]; it[n].y=&img->y[p->first+m];
+		it[n].n=2; it[n].r=(p->kind==PRIM_REGION)?0:w/2;
+		it[n++].prim=k;
+	    }
+	}
+    }
+    for (k=0;k<n;k++) {
+	it[k].bx0=it[k].bx1=it[k].x[0]; it[k].by0=it[k].by1=it[k].y[0];
+	for (m=1;m<it[k].n;m++) {
+	    if (it[k].x[m]<it[k].bx0) it[k].bx0=it[k].x[m];
+	    if (it[k].x[m]>it[k].bx1) it[k].bx1=it[k].x[m];
+	    if (it[k].y[m]<it[k].by0) it[k].by0=it[k].y[m];
+	    if (it[k].y[m]>it[k].by1) it[k].by1=it[k].y[m];
+	}
+	it[k].bx0-=it[k].r; it[k].by0-=it[k].r;
+	it[k].bx1+=it[k].r; it[k].by1+=it[k].r;
+    }
+    *num=n;
+    return it;
+}
+
+static void grid_cell(drc_grid *g, double x, double y, int *cx, int *cy){
+    *cx=(int)((x-g->x0)/g->cell); *cy=(int)((y-g->y0)/g->cell);
+    if (*cx<0) *cx=0;
+    if (*cx>=g->nx) *cx=g->nx-1;
+    if (*cy<0) *cy=0;
+    if (*cy>=g->ny) *cy=g->ny-1;
+}
+/* sorts items, with bounding boxes grown by margin, into a grid with
+   about one item per cell */
+static int grid_build(drc_grid *g, drc_item *it, int n, double margin){
+    int k, a, b, cx0, cy0, cx1, cy1, pass;
+    double x1=-1e30, y1=-1e30, s=0;
+    g->x0=g->y0=1e30; g->start=g->list=NULL;
+    for (k=0;k<n;k++) {
+	if (it[k].bx0<g->x0) g->x0=it[k].bx0;
+	if (it[k].by0<g->y0) g->y0=it[k].by0;
+	if (it[k].bx1>x1) x1=it[k].bx1;
+	if (it[k].by1>y1) y1=it[k].by1;
+	s+=it[k].bx1-it[k].bx0+it[k].by1-it[k].by0;
+    }
+    g->x0-=margin; g->y0-=margin; x1+=margin; y1+=margin;
+    g->cell=(n?s/n:1)+2*margin;
+    if (g->cell<1) g->cell=1;
+    while (((x1-g->x0)/g->cell+1)*((y1-g->y0)/g->cell+1)>4.0*n+16)
+	g->cell*=1.5;
+    g->nx=(int)((x1-g->x0)/g->cell)+1; g->ny=(int)((y1-g->y0)/g->cell)+1;
+    g->start=calloc(g->nx*g->ny+1,sizeof(int));
+    if (!g->start) return 1;
+    /* count, then fill in a second pass */
+    for (pass=0;pass<2;pass++) {
+	for (k=0;k<n;k++) {
+	    grid_cell(g,it[k].bx0-margin,it[k].by0-margin,&cx0,&cy0);
+	    grid_cell(g,it[k].bx1+margin,it[k].by1+margin,&cx1,&cy1);
+	    for (b=cy0;b<=cy1;b++)
+		for (a=cx0;a<=cx1;a++) {
+		    if (pass) g->list[g->start[b*g->nx+a]++]=k;
+		    else g->start[b*g->nx+a+1]++;
+		}
+	}
+	if (pass) break;
+	for (k=0;k<g->nx*g->ny;k++) g->start[k+1]+=g->start[k];
+	if (!(g->list=malloc((g->start[g->nx*g->ny]+1)*sizeof(int))))
+	    return 1;
+    }
+    /* the fill has moved every start to the end of its cell */
+    for (k=g->nx*g->ny;k>0;k--) g->start[k]=g->start[k-1];
+    g->start[0]=0;
+    return 0;
+}
+
+/* state of a parallel clearance check of one layer. net[] holds the net
+   of each copper item; items of one net are not checked. */
+typedef struct {
+    drc_item *it; drc_grid *g; int *net; int job; double limit, margin;
+    int next; pthread_mutex_t lock;
+    drc_violation *v; int nv, maxv, failed;
+} drc_job;
+static void drc_add(drc_job *j, int type, double x, double y, double value){
+    drc_violation *v;
+    pthread_mutex_lock(&j->lock);
+    if (j->nv==j->maxv) {
+	v=realloc(j->v,(j->maxv+256)*sizeof(drc_violation));
+	if (!v) {j->failed=1; pthread_mutex_unlock(&j->lock); return;}
+	j->v=v; j->maxv+=256;
+    }
+    v=&j->v[j->nv++];
+    v->job=j->job; v->type=type; v->x=x; v->y=y; v->value=value;
+    pthread_mutex_unlock(&j->lock);
+}
+/* compares all pairs of items sharing a cell; a pair is only looked at in
+   the cell holding the lower left corner of their box overlap */
+static void *drc_worker(void *arg){
+    drc_job *j=arg;
+    drc_grid *g=j->g;
+    drc_item *a, *b;
+    int c, c0, k, m, cx, cy;
+    double d, x, y;
+    for (;;) {
+	pthread_mutex_lock(&j->lock);
+	c0=j->next; j->next+=64;
+	pthread_mutex_unlock(&j->lock);
+	if (c0>=g->nx*g->ny) break;
+	for (c=c0;c<c0+64 && c<g->nx*g->ny;c++)
+	    for (k=g->start[c];k<g->start[c+1];k++)
+		for (m=k+1;m<g->start[c+1];m++) {
+		    a=&j->it[g->list[k]]; b=&j->it[g->list[m]];
+		    if (a->prim==b->prim) continue;
+		    if (j->net && j->net[g->list[k]]==j->net[g->list[m]])
+			continue; /* connected copper */
+		    if (a->bx0>b->bx1+j->margin || b->bx0>a->bx1+j->margin ||
+			a->by0>b->by1+j->margin || b->by0>a->by1+j->margin)
+			continue;
+		    grid_cell(g,((a->bx0>b->bx0)?a->bx0:b->bx0)-j->margin,
+			      ((a->by0>b->by0)?a->by0:b->by0)-j->margin,
+			      &cx,&cy);
+		    if (cy*g->nx+cx!=c) continue;
+		    d=item_dist(a,b,&x,&y);
+		    if (j->job==1 && a->n==1 && b->n==1 && a->x[0]==b->x[0] &&
+			a->y[0]==b->y[0]) continue; /* repeated hits */
+		    if (d<j->limit)
+			drc_add(j,(j->job==1)?DRC_HOLEGAP:DRC_CLEARANCE,x,y,d);
+		}
+    }
+    return NULL;
+}
+static void drc_pairs(drc_job *j){
+    pthread_t th[16];
+    int k, nth=sysconf(_SC_NPROCESSORS_ONLN);
+    if (nth<1) nth=1;
+    if (nth>16) nth=16;
+    j->next=0;
+    for (k=0;k<nth;k++)
+	if (pthread_create(&th[k],NULL,drc_worker,j)) break;
+    if (k==0) drc_worker(j);
+    for (nth=k,k=0;k<nth;k++) pthread_join(th[k],NULL);
+}
+static int drc_cmp(const void *a, const void *b){
+    const drc_violation *u=a, *v=b;
+    if (u->job!=v->job) return u->job-v->job;
+    if (u->type!=v->type) return u->type-v->type;
+    if (u->x!=v->x) return (u->x>v->x)?1:-1;
+    if (u->y!=v->y) return (u->y>v->y)?1:-1;
+    return 0;
+}
+
+/* parses the drill job and the copper jobs 2..5 into img[1..5]; with
+   knockouts the punch layers are recorded as clear primitives. Returns
+   nonzero on failure. */
+static int copper_capture(layer_image *img, char *sourcename, int knockouts,
+			  int punchflag){
+    FILE *sink;
+    int job, ret=0;
+    if (!(sink=fopen("/dev/null","w"))) return 1;
+    for (job=1;job<=5;job++) {
+	if (!(st->infile=src_open(sourcename))) {ret=1; break;}
+	st->capture=&img[job]; st->capture->jobtype=job; st->capture_clear=0;
+	if (!fseek(st->infile,0L,SEEK_SET))
+	    do_parsing(readlayerlist[job],filetypetable[job],sink,0);
+	if (knockouts && job>1 && !fseek(st->infile,0L,SEEK_SET)) {
+	    st->capture_clear=1;
+	    do_parsing(punchlayerlist[job],filetypetable[job],sink,punchflag);
+	}
+	src_close(st->infile);
+	if (st->capture->failed) ret=1;
+    }
+    st->capture=NULL; st->capture_clear=0;
+    fclose(sink);
+    return ret;
+}
+static void copper_free(layer_image *img){
+    int job;
+    for (job=1;job<=5;job++) {
+	free(img[job].prim); free(img[job].x); free(img[job].y);
+	memset(&img[job],0,sizeof(layer_image));
+    }
+}
+
+/* items of the dark or clear primitives of a layer with their grid */
+typedef struct {drc_item *it; int n; int *cx, *cy; drc_grid g;} item_set;
+static int item_set_build(item_set *s, layer_image *img, int clear,
+			  double margin){
+    memset(s,0,sizeof(item_set));
+    if (!(s->it=drc_items(img,clear,&s->n,&s->cx,&s->cy))) return 1;
+    return grid_build(&s->g,s->it,s->n,margin);
+}
+static void item_set_free(item_set *s){
+    free(s->it); free(s->cx); free(s->cy); free(s->g.start); free(s->g.list);
+    memset(s,0,sizeof(item_set));
+}
+/* index of a round or rectangular item of s covering the box, or -1 */
+static int item_covering(item_set *s, double x0, double y0, double x1,
+			 double y1){
+    drc_item *a;
+    int m, u, w;
+    double dx, dy;
+    if (!s->n) return -1;
+    grid_cell(&s->g,(x0+x1)/2,(y0+y1)/2,&u,&w);
+    for (m=s->g.start[w*s->g.nx+u];m<s->g.start[w*s->g.nx+u+1];m++) {
+	a=&s->it[s->g.list[m]];
+	if (x0<a->bx0 || x1>a->bx1 || y0<a->by0 || y1>a->by1) continue;
+	if (a->n==4) return s->g.list[m];
+	if (a->n!=1) continue;
+	dx=(x1-a->x[0]>a->x[0]-x0)?x1-a->x[0]:a->x[0]-x0;
+	dy=(y1-a->y[0]>a->y[0]-y0)?y1-a->y[0]:a->y[0]-y0;
+	if (hypot(dx,dy)<=a->r) return s->g.list[m];
+    }
+    return -1;
+}
+/* drops copper items lying completely inside a knockout; they keep their
+   place in the grid but are compared with nobody */
+static void knockout_items(item_set *s, item_set *c){
+    int k;
+    for (k=0;k<s->n;k++) {
+	if (item_covering(c,s->it[k].bx0,s->it[k].by0,
+			  s->it[k].bx1,s->it[k].by1)<0) continue;
+	s->it[k].prim=-1-k;
+	s->it[k].bx0=s->it[k].by0=1e30; s->it[k].bx1=s->it[k].by1=-1e30;
+    }
+}
+
+/* union-find over item numbers, with path compression */
+static int uf_find(int *parent, int a){
+    int r=a, t;
+    while (parent[r]!=r) r=parent[r];
+    while (parent[a]!=r) {t=parent[a]; parent[a]=r; a=t;} /* compress */
+    return r;
+}
+static void uf_union(int *parent, int a, int b){
+    a=uf_find(parent,a); b=uf_find(parent,b);
+    if (a<b) parent[b]=a;
+    else if (b<a) parent[a]=b;
+}
+/* joins the items of s which touch, and the pieces of one primitive, in
+   the union-find parent[] from offset on */
+static void touch_union(item_set *s, int *parent, int offset){
+    drc_grid *g=&s->g;
+    drc_item *a, *b;
+    int k, m, cell, cx, cy;
+    double mx, my;
+    for (k=1;k<s->n;k++) /* pieces of one primitive */
+	if (s->it[k].prim>=0 && s->it[k].prim==s->it[k-1].prim)
+	    uf_union(parent,offset+k-1,offset+k);
+    for (cell=0;s->n && cell<g->nx*g->ny;cell++)
+	for (k=g->start[cell];k<g->start[cell+1];k++)
+	    for (m=k+1;m<g->start[cell+1];m++) {
+		a=&s->it[g->list[k]]; b=&s->it[g->list[m]];
+		if (a->prim<0 || b->prim<0 || a->prim==b->prim) continue;
+		if (a->bx0>b->bx1 || b->bx0>a->bx1 ||
+		    a->by0>b->by1 || b->by0>a->by1) continue;
+		grid_cell(g,(a->bx0>b->bx0)?a->bx0:b->bx0,
+			  (a->by0>b->by0)?a->by0:b->by0,&cx,&cy);
+		if (cy*g->nx+cx!=cell) continue;
+		if (uf_find(parent,offset+g->list[k])==
+		    uf_find(parent,offset+g->list[m])) continue;
+		if (item_dist(a,b,&mx,&my)<=1e-6)
+		    uf_union(parent,offset+g->list[k],offset+g->list[m]);
+	    }
+}
+
+/* runs the check on the source file and reports on stderr. knockouts
+   selects evaluation of the punch layers as in RS274X files, punchflag is
+   handed to do_parsing. Returns the number of violations or -1. */
+static int drc_layers(char *sourcename, int knockouts, int punchflag){
+    static char *drc_name[]={"", "trace width", "clearance",
+			     "annular ring", "hole spacing"};
+    layer_image img[6];
+    drc_job j;
+    item_set s, c;
+    drc_item *a;
+    int *net=NULL, job, k, m, u, w, ret=0;
+    primitive *p;
+    double d, hole, ring, x, y;
+
+    memset(&j,0,sizeof(j)); memset(img,0,sizeof(img));
+    pthread_mutex_init(&j.lock,NULL);
+    if (copper_capture(img,sourcename,knockouts,punchflag)) ret=-1;
+
+    for (job=1;job<=5 && ret>=0;job++) {
+	j.job=job;
+	j.margin=((job==1)?st->drc_holegap:st->drc_clearance)/2;
+	j.limit=2*j.margin;
+	if (item_set_build(&s,&img[job],0,j.margin)) {
+	    item_set_free(&s); ret=-1; break;
+	}
+	if (job>1 && knockouts) { /* drop copper covered by a knockout */
+	    if (item_set_build(&c,&img[job],1,0)) {
+		item_set_free(&s); item_set_free(&c); ret=-1; break;
+	    }
+	    knockout_items(&s,&c);
+	    item_set_free(&c);
+	}
+	j.net=NULL;
+	if (job>1) { /* nets of touching copper, checked against each other */
+	    if (!(net=malloc((s.n+1)*sizeof(int)))) {
+		item_set_free(&s); ret=-1; break;
+	    }
+	    for (k=0;k<s.n;k++) net[k]=k;
+	    touch_union(&s,net,0);
+	    for (k=0;k<s.n;k++) net[k]=uf_find(net,k);
+	    j.net=net;
+	}
+	j.it=s.it; j.g=&s.g;
+	drc_pairs(&j);
+	free(net); net=NULL; j.net=NULL;
+	if (job>1) { /* trace widths */
+	    for (k=0;k<img[job].num;k++) {
+		p=&img[job].prim[k];
+		if (p->kind!=PRIM_STROKE || p->clear) continue;
+		prim_size(p,&d,&x);
+		if (d<st->drc_width) drc_add(&j,DRC_WIDTH,img[job].x[p->first],
+					 img[job].y[p->first],d);
+	    }
+	}
+	if (job>1) { /* annular rings of the pads on holes */
+	    for (k=0;k<img[1].num;k++) {
+		p=&img[1].prim[k];
+		if (p->num!=1) continue; /* slots */
+		prim_size(p,&hole,&d);
+		x=img[1].x[p->first]; y=img[1].y[p->first];
+		grid_cell(&s.g,x,y,&u,&w);
+		for (m=s.g.start[w*s.g.nx+u];m<s.g.start[w*s.g.nx+u+1];m++) {
+		    a=&s.it[s.g.list[m]];
+		    if (a->prim<0 || img[job].prim[a->prim].kind!=PRIM_FLASH)
+			continue;
+		    if (a->n==1) {
+			ring=a->r-hypot(x-a->x[0],y-a->y[0]);
+		    } else { /* distance to the nearest rectangle side */
+			ring=x-a->bx0;
+			if (a->bx1-x<ring) ring=a->bx1-x;
+			if (y-a->by0<ring) ring=y-a->by0;
+			if (a->by1-y<ring) ring=a->by1-y;
+		    }
+		    if (ring<0) continue; /* hole not in this pad */
+		    ring-=hole/2;
+		    if (ring<st->drc_ring) drc_add(&j,DRC_RING,x,y,ring);
+		}
+	    }
+	}
+	item_set_free(&s);
+	if (j.failed) ret=-1;
+    }
+    pthread_mutex_destroy(&j.lock);
+    copper_free(img);
+    if (ret<0) {free(j.v); return -1;}
+    qsort(j.v,j.nv,sizeof(drc_violation),drc_cmp);
+    for (k=0;k<j.nv;k++)
+	fprintf(stderr,"DRC %s: %s %.1f mil at X%.3f Y%.3f\n",
+		suffixlist[j.v[k].job]+1,drc_name[j.v[k].type],
+		j.v[k].value,j.v[k].x/1000.0,j.v[k].y/1000.0);
+    fprintf(stderr,"DRC: %d violation%s\n",j.nv,(j.nv==1)?"":"s");
+    ret=j.nv;
+    free(j.v);
+    return ret;
+}
+
+/* netlist extraction: items of the copper layers are merged into nets with
+   a union-find over touching pairs from the grid, and holes join the items
+   of all layers whose copper covers them. Test points are the holes with
+   copper and the flashes on the outer layers; they are written in the
+   IPC-D-356 format. */
+/* dark item of s covering the point, starting after index *m of the cell
+   list; -1 if there is none */
+static int item_at(item_set *s, double x, double y, int *m){
+    drc_item pt, *a;
+    int px=x, py=y, u, w, cell;
+    double mx, my;
+    if (!s->n) return -1;
+    pt.n=1; pt.r=0; pt.x=&px; pt.y=&py;
+    grid_cell(&s->g,x,y,&u,&w);
+    cell=w*s->g.nx+u;
+    if (*m<s->g.start[cell]) *m=s->g.start[cell];
+    for (;*m<s->g.start[cell+1];(*m)++) {
+	a=&s->it[s->g.list[*m]];
+	if (a->prim<0 || x<a->bx0 || x>a->bx1 || y<a->by0 || y>a->by1)
+	    continue;
+	if (item_dist(a,&pt,&mx,&my)<=1e-6) return s->g.list[(*m)++];
+    }
+    return -1;
+}
+typedef struct {int net, node, job, x, y, w, h, dia;} test_point;
+static int tp_pos_cmp(const void *a, const void *b){
+    const test_point *u=a, *v=b;
+    if (u->x!=v->x) return u->x-v->x;
+    if (u->y!=v->y) return u->y-v->y;
+    return u->job-v->job;
+}
+static int tp_net_cmp(const void *a, const void *b){
+    const test_point *u=a, *v=b;
+    if (u->net!=v->net) return u->net-v->net;
+    return tp_pos_cmp(a,b);
+}
+/* writes the netlist of the source file to root.netlist.ipc; knockouts
+   and punchflag as for drc_layers(). Returns nonzero on failure. */
+static int netlist_write(char *sourcename, char *root, int knockouts,
+			 int punchflag){
+    layer_image img[6];
+    item_set s[6], c[6];
+    drc_item *a;
+    test_point *tp=NULL;
+    int *parent=NULL, *netof=NULL, *size=NULL;
+    char *onhole=NULL;
+    int offset[7], job, k, m, n=0, cx, node, ntp=0, nets, ret=1;
+    double w, h, mx, my;
+    char name[MAXFILNAMLEN+16], net[16];
+    FILE *f;
+    primitive *p;
+
+    memset(s,0,sizeof(s)); memset(c,0,sizeof(c)); memset(img,0,sizeof(img));
+    if (copper_capture(img,sourcename,knockouts,punchflag)) goto done;
+    /* node numbers: items of layers 2..5, then the holes */
+    offset[2]=0;
+    for (job=2;job<=5;job++) {
+	if (item_set_build(&s[job],&img[job],0,0)) goto done;
+	if (knockouts) {
+	    if (item_set_build(&c[job],&img[job],1,0)) goto done;
+	    knockout_items(&s[job],&c[job]);
+	}
+	offset[job+1]=offset[job]+s[job].n;
+    }
+    n=offset[6]+img[1].num;
+    parent=malloc((n+1)*sizeof(int)); netof=malloc((n+1)*sizeof(int));
+    onhole=calloc(n+1,1);
+    tp=malloc((img[1].num+s[2].n+s[3].n+1)*sizeof(test_point));
+    if (!parent || !netof || !onhole || !tp) goto done;
+    for (k=0;k<n;k++) {parent[k]=k; netof[k]=-1;}
+
+    /* touching items within each layer */
+    for (job=2;job<=5;job++) touch_union(&s[job],parent,offset[job]);
+
+    /* plated holes join all layers with copper around them */
+    for (k=0;k<img[1].num;k++) {
+	p=&img[1].prim[k];
+	node=offset[6]+k;
+	mx=img[1].x[p->first]; my=img[1].y[p->first];
+	tp[ntp].w=tp[ntp].h=0; tp[ntp].job=0;
+	for (job=2;job<=5;job++) {
+	    m=0;
+	    if (knockouts && item_at(&c[job],mx,my,&m)>=0) continue;
+	    m=0;
+	    while ((cx=item_at(&s[job],mx,my,&m))>=0) {
+		uf_union(parent,node,offset[job]+cx);
+		onhole[offset[job]+cx]=1; tp[ntp].job=1;
+		if (job<=3 && img[job].prim[s[job].it[cx].prim].kind==PRIM_FLASH) {
+		    prim_size(&img[job].prim[s[job].it[cx].prim],&w,&h);
+		    if (w>tp[ntp].w) tp[ntp].w=w+0.5;
+		    if (h>tp[ntp].h) tp[ntp].h=h+0.5;
+		}
+	    }
+	}
+	if (!tp[ntp].job) continue; /* no copper: mechanical hole */
+	prim_size(p,&w,&h);
+	tp[ntp].dia=w+0.5; tp[ntp].node=node; tp[ntp].x=mx; tp[ntp].y=my;
+	ntp++;
+    }
+    /* surface pads: flashes on the outer layers off the holes */
+    for (job=2;job<=3;job++)
+	for (k=0;k<s[job].n;k++) {
+	    a=&s[job].it[k];
+	    if (a->prim<0 || onhole[offset[job]+k]) continue;
+	    p=&img[job].prim[a->prim];
+	    if (p->kind!=PRIM_FLASH) continue;
+	    prim_size(p,&w,&h);
+	    tp[ntp].job=job; tp[ntp].node=offset[job]+k; tp[ntp].dia=0;
+	    tp[ntp].x=img[job].x[p->first]; tp[ntp].y=img[job].y[p->first];
+	    tp[ntp].w=w+0.5; tp[ntp].h=h+0.5;
+	    ntp++;
+	}
+
+    /* number the nets in the order of the test point positions */
+    qsort(tp,ntp,sizeof(test_point),tp_pos_cmp);
+    if (!(size=calloc(ntp+1,sizeof(int)))) goto done;
+    for (nets=k=0;k<ntp;k++) {
+	node=uf_find(parent,tp[k].node);
+	if (netof[node]<0) netof[node]=nets++;
+	tp[k].net=netof[node]; size[tp[k].net]++;
+    }
+    qsort(tp,ntp,sizeof(test_point),tp_net_cmp);
+
+    snprintf(name,sizeof(name),"%s.netlist.ipc",root);
+    if (!(f=out_open(name,-1))) goto done;
+    fprintf(f,"C  IPC-D-356 netlist generated by xfig2gerber\n");
+    fprintf(f,"P  JOB   %s\n",root);
+    fprintf(f,"P  UNITS CUST 0\n"); /* inch, 0.0001 inch resolution */
+    for (k=0;k<ntp;k++) {
+	if (size[tp[k].net]>1) snprintf(net,sizeof(net),"N%05d",tp[k].net+1);
+	else strcpy(net,"N/C"); /* single point */
+	fprintf(f,"%s%-14s   %-6s-%-4s ",tp[k].dia?"317":"327",net,
+		tp[k].dia?"VIA":"PAD","");
+	if (tp[k].dia) fprintf(f,"D%04dP",tp[k].dia*10);
+	else fprintf(f,"      ");
+	fprintf(f,"A%02dX%c%06dY%c%06dX%04dY%04dR000 S0\n",
+		tp[k].dia?0:tp[k].job-1, /* 1: top, 2: bottom */
+		(tp[k].x<0)?'-':'+',abs(tp[k].x)*10,
+		(tp[k].y<0)?'-':'+',abs(tp[k].y)*10,
+		tp[k].w*10,(tp[k].w==tp[k].h)?0:tp[k].h*10);
+    }
+    fprintf(f,"999\n");
+    ret=out_close(f);
+    fprintf(stderr,"%s: %d nets, %d test points\n",name,nets,ntp);
+ done:
+    free(parent); free(netof); free(onhole); free(tp); free(size);
+    for (job=2;job<=5;job++) {item_set_free(&s[job]); item_set_free(&c[job]);}
+    copper_free(img);
+    return ret;
+}
+
+/* placement list */
+static int place_add_pad(int x, int y, int w, int h){
+    place_pad *p;
+    if (!st->compound_level) return 0; /* loose pads belong to no part */
+    if (st->place_num==st->place_max) {
+	p=realloc(st->place_pads,(st->place_max+256)*sizeof(place_pad));
+	if (!p) return 1;
+	st->place_pads=p; st->place_max+=256;
+    }
+    p=&st->place_pads[st->place_num++];
+    p->group=st->compound_id; p->seq=st->place_num-1;
+    p->x=x; p->y=y; p->w=w; p->h=h;
+    return 0;
+}
+static int place_add_label(int x, int y, char *text){
+    place_label *l;
+    char str[1000];
+    if (!decode_text(str,text,sizeof(str))) return 0;
+    if (st->label_num==st->label_max) {
+	l=realloc(st->place_labels,(st->label_max+64)*sizeof(place_label));
+	if (!l) return 1;
+	st->place_labels=l; st->label_max+=64;
+    }
+    l=&st->place_labels[st->label_num];
+    if (!(l->text=strdup(str))) return 1;
+    l->x=x; l->y=y; st->label_num++;
+    return 0;
+}
+static int place_cmp(const void *a, const void *b){
+    const place_pad *p=a, *q=b;
+    if (p->group!=q->group) return p->group-q->group;
+    return p->seq-q->seq;
+}
+typedef struct {double d; int part, label;} place_pair;
+static int pair_cmp(const void *a, const void *b){
+    const place_pair *p=a, *q=b;
+    if (p->d!=q->d) return (p->d<q->d)?-1:1;
+    if (p->part!=q->part) return p->part-q->part;
+    return p->label-q->label;
+}
+/* writes one line per part: the center of the pad extents, the rotation
+   and the index label. The rotation is the direction of the main axis of
+   the pad centers (or of the part's frame, if it has none), turned in
+   steps of 90 deg until pin 1 lies left of the center. Labels are given
+   closest pairs first, each to one part only. Returns nonzero on failure. */
+static int place_write(char *root){
+    typedef struct {double x, y, rot; int n, label;} place_part;
+    char name[MAXFILNAMLEN+16], ref[32], *r;
+    FILE *f;
+    int k, m, l, n, u, w, u0, w0, u1, w1, parts=0, *used=NULL, ret=1;
+    int np, maxpr=0, i;
+    double x0, y0, x1, y1, cx, cy, mx, my, sxx, syy, sxy, a, phi, d, lim;
+    place_part *pt=NULL;
+    place_pair *pr=NULL;
+    drc_item *it=NULL;
+    drc_grid g;
+
+    qsort(st->place_pads,st->place_num,sizeof(place_pad),place_cmp);
+    if (st->place_num && !(pt=malloc(st->place_num*sizeof(place_part))))
+	return 1;
+    for (k=0;k<st->place_num;k=m) {
+	x0=y0=1e30; x1=y1=-1e30; mx=my=0;
+	for (m=k;m<st->place_num &&
+	     st->place_pads[m].group==st->place_pads[k].group;m++) {
+	    place_pad *p=&st->place_pads[m];
+	    if (p->x-p->w/2.0<x0) x0=p->x-p->w/2.0;
+	    if (p->x+p->w/2.0>x1) x1=p->x+p->w/2.0;
+	    if (p->y-p->h/2.0<y0) y0=p->y-p->h/2.0;
+	    if (p->y+p->h/2.0>y1) y1=p->y+p->h/2.0;
+	    mx+=p->x; my+=p->y;
+	}
+	n=m-k; mx/=n; my/=n;
+	cx=(x0+x1)/2; cy=(y0+y1)/2;
+	/* main axis of the pad centers */
+	sxx=syy=sxy=0;
+	for (l=k;l<m;l++) {
+	    sxx+=(st->place_pads[l].x-mx)*(st->place_pads[l].x-mx);
+	    syy+=(st->place_pads[l].y-my)*(st->place_pads[l].y-my);
+	    sxy+=(st->place_pads[l].x-mx)*(st->place_pads[l].y-my);
+	}
+	a=0;
+	if (fabs(sxx-syy)+fabs(sxy)>1e-6*(sxx+syy))
+	    a=0.5*atan2(2*sxy,sxx-syy)*180/M_PI;
+	/* the quarter turn which puts pin 1 (at 180 deg) nearest to it */
+	if (st->place_pads[k].x!=cx || st->place_pads[k].y!=cy) {
+	    phi=atan2(st->place_pads[k].y-cy,st->place_pads[k].x-cx)*180/M_PI;
+	    d=fmod(phi-180-a,360); if (d<0) d+=360;
+	    a+=90*floor(d/90+0.5);
+	}
+	a=fmod(a,360); if (a<0) a+=360;
+	if (a>=359.95) a=0;
+	pt[parts].x=cx; pt[parts].y=cy; pt[parts].rot=a;
+	pt[parts].n=n; pt[parts].label=-1; parts++;
+    }
+    /* exclusive labels, closest pairs first. The labels go into the grid
+       of the DRC, and the pairs are taken in rounds of growing distance
+       lim: a round holds all open pairs up to lim, so the order is that
+       of sorting all pairs, without having them all in memory. */
+    g.start=g.list=NULL;
+    if (parts && st->label_num) {
+	if (!(it=calloc(st->label_num,sizeof(drc_item))) ||
+	    !(used=calloc(st->label_num,sizeof(int)))) goto done;
+	x0=y0=1e30; x1=y1=-1e30;
+	for (l=0;l<st->label_num;l++) {
+	    it[l].prim=l; it[l].n=1;
+	    it[l].x=&st->place_labels[l].x; it[l].y=&st->place_labels[l].y;
+	    it[l].bx0=it[l].bx1=st->place_labels[l].x;
+	    it[l].by0=it[l].by1=st->place_labels[l].y;
+	    if (it[l].bx0<x0) x0=it[l].bx0;
+	    if (it[l].bx0>x1) x1=it[l].bx0;
+	    if (it[l].by0<y0) y0=it[l].by0;
+	    if (it[l].by0>y1) y1=it[l].by0;
+	}
+	for (k=0;k<parts;k++) {
+	    if (pt[k].x<x0) x0=pt[k].x;
+	    if (pt[k].x>x1) x1=pt[k].x;
+	    if (pt[k].y<y0) y0=pt[k].y;
+	    if (pt[k].y>y1) y1=pt[k].y;
+	}
+	if (grid_build(&g,it,st->label_num,0)) goto done;
+	for (n=0,lim=g.cell;;lim*=2) {
+	    for (np=k=0;k<parts;k++) {
+		if (pt[k].label>=0) continue;
+		grid_cell(&g,pt[k].x-lim,pt[k].y-lim,&u0,&w0);
+		grid_cell(&g,pt[k].x+lim,pt[k].y+lim,&u1,&w1);
+		for (w=w0;w<=w1;w++)
+		    for (u=u0;u<=u1;u++)
+			for (m=g.start[w*g.nx+u];m<g.start[w*g.nx+u+1];m++) {
+			    l=g.list[m];
+			    if (used[l]) continue;
+			    d=hypot(st->place_labels[l].x-pt[k].x,
+				    st->place_labels[l].y-pt[k].y);
+			    if (d>lim) continue;
+			    if (flat_grow(&pr,&maxpr,np+1,sizeof(place_pair)))
+				goto done;
+			    pr[np].d=d; pr[np].part=k; pr[np].label=l; np++;
+			}
+	    }
+	    qsort(pr,np,sizeof(place_pair),pair_cmp);
+	    for (i=0;i<np;i++) {
+		if (pt[pr[i].part].label>=0 || used[pr[i].label]) continue;
+		pt[pr[i].part].label=pr[i].label; used[pr[i].label]=1; n++;
+	    }
+	    /* done when all are paired or lim spans all of them */
+	    if (n==parts || n==st->label_num || lim>hypot(x1-x0,y1-y0)) break;
+	}
+    }
+    snprintf(name,sizeof(name),"%s.placement.%s",root,
+	     (st->place_format==1)?"csv":"xy");
+    if (!(f=out_open(name,-1))) goto done;
+    if (st->place_format==1)
+	fprintf(f,"Ref,X(mm),Y(mm),Rotation,Side,Pads\n");
+    else
+	fprintf(f,"# RefDes        X(in)      Y(in)  Rot Side\n");
+    for (k=0;k<parts;k++) {
+	if (pt[k].label>=0) {
+	    r=st->place_labels[pt[k].label].text;
+	} else {
+	    snprintf(ref,sizeof(ref),"P%d",k+1); r=ref;
+	}
+	if (st->place_format==1)
+	    fprintf(f,"%s,%.4f,%.4f,%.1f,Top,%d\n",
+		    r,pt[k].x*0.0254,pt[k].y*0.0254,pt[k].rot,pt[k].n);
+	else
+	    fprintf(f,"%-14s %10.4f %10.4f %5.1f T\n",
+		    r,pt[k].x/1000.0,pt[k].y/1000.0,pt[k].rot);
+    }
+    ret=out_close(f);
+ done:
+    free(pt); free(pr); free(used); free(it);
+    free(g.start); free(g.list);
+    return ret;
+}
+
+/* net numbers of the net tag names, starting at 1 */
+static int net_id(char *name){
+    char **n;
+    int k;
+    for (k=0;k<st->net_num;k++) if (!strcmp(st->net_names[k],name)) return k+1;
+    n=realloc(st->net_names,(st->net_num+1)*sizeof(char *));
+    if (!n) return -1;
+    st->net_names=n;
+    if (!(st->net_names[st->net_num]=strdup(name))) return -1;
+    return ++st->net_num;
+}
+
+/* copper pour */
+static int pour_rule_of(int depth){
+    int k;
+    for (k=0;k<st->pour_num;k++) if (st->pour_rules[k].depth==depth) return k;
+    return -1;
+}
+/* takes over the point arrays x, y of a zone outline */
+static int pour_add_zone(int rule, int net, int *x, int *y, int n){
+    pour_zone *z;
+    if (n>3 && x[n-1]==x[0] && y[n-1]==y[0]) n--; /* closing point */
+    if (n<3) {free(x); free(y); return 0;}
+    if (st->zone_num==st->zone_max) {
+	z=realloc(st->pour_zones,(st->zone_max+16)*sizeof(pour_zone));
+	if (!z) {free(x); free(y); return 1;}
+	st->pour_zones=z; st->zone_max+=16;
+    }
+    z=&st->pour_zones[st->zone_num++];
+    z->rule=rule; z->net=net; z->n=n; z->x=x; z->y=y;
+    return 0;
+}
+static int rnd(double v){
+    return (int)floor(v+0.5);
+}
+/* region of a circle */
+static void pour_circle(FILE *f, double cx, double cy, double r){
+    int x=rnd(cx), y=rnd(cy), ir=rnd(r);
+    fprintf(f,
+	    "G36*G75*G01*X%05dY%05dD02*G03X%05dY%05dI%06dJ%05dD01*G01*D02*G37*\n",
+	    x+ir,y,x+ir,y,-ir,0);
+    cap_begin(PRIM_REGION,20,0);
+    cap_arc(x,y,x+ir,y,x+ir,y,0);
+}
+/* region of a line with round ends, radius r */
+static void pour_capsule(FILE *f, double x0, double y0, double x1, double y1,
+			 double r){
+    double l=hypot(x1-x0,y1-y0), nx, ny;
+    int ax, ay, bx, by, px, py;
+    if (l<0.5) {pour_circle(f,x0,y0,r); return;}
+    nx=-(y1-y0)/l*r; ny=(x1-x0)/l*r; /* left of the direction */
+    ax=rnd(x0); ay=rnd(y0); bx=rnd(x1); by=rnd(y1); px=rnd(nx); py=rnd(ny);
+    fprintf(f,"G36*G75*G01*X%05dY%05dD02*X%05dY%05dD01*",
+	    ax+px,ay+py,bx+px,by+py);
+    fprintf(f,"G02X%05dY%05dI%05dJ%05dD01*G01*X%05dY%05dD01*",
+	    bx-px,by-py,-px,-py,ax-px,ay-py);
+    fprintf(f,"G02X%05dY%05dI%05dJ%05dD01*G01*D02*G37*\n",
+	    ax+px,ay+py,px,py);
+    cap_begin(PRIM_REGION,20,0);
+    cap_arc(bx,by,bx+px,by+py,bx-px,by-py,1);
+    cap_arc(ax,ay,ax-px,ay-py,ax+px,ay+py,1);
+}
+/* region of a polygon */
+static void region_polygon(FILE *f, int *x, int *y, int n){
+    int k;
+    cap_begin(PRIM_REGION,20,0);
+    for (k=0;k<=n;k++) {
+	fprintf(f,k?"X%05dY%05dD01*":"G36*G01X%05dY%05dD02*",x[k%n],y[k%n]);
+	if (k<n) cap_point(x[k],y[k]);
+    }
+    fprintf(f,"D02*G37*\n");
+}
+/* copper item grown by gap */
+static void pour_cutout(FILE *f, drc_item *a, double gap){
+    int k, x[4], y[4];
+    if (a->n==1) {
+	pour_circle(f,a->x[0],a->y[0],a->r+gap);
+    } else if (a->n==2) {
+	pour_capsule(f,a->x[0],a->y[0],a->x[1],a->y[1],a->r+gap);
+    } else if (a->n==4) { /* rectangular flash */
+	x[0]=x[3]=rnd(a->bx0-gap); x[1]=x[2]=rnd(a->bx1+gap);
+	y[0]=y[1]=rnd(a->by0-gap); y[2]=y[3]=rnd(a->by1+gap);
+	region_polygon(f,x,y,4);
+    } else { /* region and a margin along its edges */
+	region_polygon(f,a->x,a->y,a->n);
+	for (k=0;k<a->n;k++)
+	    pour_capsule(f,a->x[k],a->y[k],a->x[(k+1)%a->n],
+			 a->y[(k+1)%a->n],gap);
+    }
+}
+/* line aperture at least w mil wide */
+static int line_aperture(double w){
+    int k;
+    for (k=1;k<maxaperture;k++)
+	if ((k==2?8.0:k*3.333)>=w-0.01) break;
+    return k+20;
+}
+
+/* fills the zones on the pour depths of layerlist before the copper of
+   the layer is written to f, which is in dark polarity. The layer and the
+   holes are parsed from infile first; items near a zone are found with
+   the grid of the design rule check. Returns nonzero on failure. */
+static int pour_layer(FILE *f, int *layerlist){
+    layer_image img, holes;
+    layer_image *saved=st->capture;
+    item_set s, h;
+    pour_zone *z;
+    drc_item zi, *a;
+    FILE *sink;
+    long pos=ftell(st->infile);
+    int *seen=NULL, k, m, u, w, u0, w0, u1, w1, pass, net, ret=1;
+    double gap, half, mx, my, x, y, x0, y0, x1, y1;
+
+    memset(&s,0,sizeof(s)); memset(&h,0,sizeof(h));
+    memset(&img,0,sizeof(img)); memset(&holes,0,sizeof(holes));
+    for (k=0;k<st->zone_num;k++) {
+	free(st->pour_zones[k].x); free(st->pour_zones[k].y);
+    }
+    st->zone_num=0;
+    if (!(sink=fopen("/dev/null","w"))) return 1;
+    st->capture=&img; st->pour_collect=1;
+    if (!fseek(st->infile,0L,SEEK_SET)) do_parsing(layerlist,2,sink,0);
+    st->capture=&holes; st->pour_collect=0;
+    if (!fseek(st->infile,0L,SEEK_SET)) do_parsing(readlayerlist[1],1,sink,0);
+    st->capture=saved;
+    fclose(sink);
+    if (fseek(st->infile,pos,SEEK_SET)) goto done;
+    if (img.failed || holes.failed) goto done;
+    if (!st->zone_num) {ret=0; goto done;}
+
+    for (gap=0,k=0;k<st->pour_num;k++)
+	if (st->pour_rules[k].clearance>gap) gap=st->pour_rules[k].clearance;
+    if (item_set_build(&s,&img,0,gap) || item_set_build(&h,&holes,0,gap))
+	goto done;
+    if (!(seen=malloc((s.n+h.n+1)*sizeof(int)))) goto done;
+
+    /* zones, thermal gaps, spokes, and then the clearances around all
+       foreign copper in the polarity of the pass */
+    for (pass=0;pass<4;pass++) {
+	st->capture_clear=pass&1;
+	if (pass) fprintf(f,"%%LP%c*%%\n",st->capture_clear?'C':'D');
+	for (k=0;k<s.n+h.n;k++) seen[k]=-1;
+	for (k=0;k<st->zone_num;k++) {
+	    z=&st->pour_zones[k];
+	    gap=st->pour_rules[z->rule].clearance;
+	    if (pass==0) {region_polygon(f,z->x,z->y,z->n); continue;}
+	    if (pass==2) fprintf(f,"G54D%02d*\n",
+				 line_aperture(st->pour_rules[z->rule].spoke));
+	    zi.n=z->n; zi.x=z->x; zi.y=z->y; zi.r=0; zi.prim=-1;
+	    x0=y0=1e30; x1=y1=-1e30;
+	    for (m=0;m<z->n;m++) {
+		if (z->x[m]<x0) x0=z->x[m];
+		if (z->x[m]>x1) x1=z->x[m];
+		if (z->y[m]<y0) y0=z->y[m];
+		if (z->y[m]>y1) y1=z->y[m];
+	    }
+	    /* copper items near the zone */
+	    grid_cell(&s.g,x0-gap,y0-gap,&u0,&w0);
+	    grid_cell(&s.g,x1+gap,y1+gap,&u1,&w1);
+	    for (w=w0;s.n && w<=w1;w++)
+		for (u=u0;u<=u1;u++)
+		    for (m=s.g.start[w*s.g.nx+u];m<s.g.start[w*s.g.nx+u+1];m++) {
+			if (seen[s.g.list[m]]==k) continue;
+			seen[s.g.list[m]]=k;
+			a=&s.it[s.g.list[m]];
+			net=img.prim[a->prim].net;
+			if (net && net==z->net) { /* pads of the zone net */
+			    if (img.prim[a->prim].kind!=PRIM_FLASH ||
+				!pt_in_poly(a->x[0],a->y[0],z->x,z->y,z->n))
+				continue;
+			    if (a->n==4) {
+				x=a->x[0]+a->x[2]; x/=2; y=a->y[0]+a->y[2]; y/=2;
+			    } else {
+				x=a->x[0]; y=a->y[0];
+			    }
+			    if (pass==1) pour_cutout(f,a,gap);
+			    if (pass!=2) continue;
+			    half=(a->bx1-a->bx0)/2+gap+1;
+			    fprintf(f,"G01X%05dY%05dD02*X%05dY%05dD01*\n",
+				    rnd(x-half),rnd(y),rnd(x+half),rnd(y));
+			    cap_begin(PRIM_STROKE,line_aperture(
+					  st->pour_rules[z->rule].spoke),0);
+			    cap_point(rnd(x-half),rnd(y));
+			    cap_point(rnd(x+half),rnd(y));
+			    half=(a->by1-a->by0)/2+gap+1;
+			    fprintf(f,"G01X%05dY%05dD02*X%05dY%05dD01*\n",
+				    rnd(x),rnd(y-half),rnd(x),rnd(y+half));
+			    cap_begin(PRIM_STROKE,line_aperture(
+					  st->pour_rules[z->rule].spoke),0);
+			    cap_point(rnd(x),rnd(y-half));
+			    cap_point(rnd(x),rnd(y+half));
+			    continue;
+			}
+			if (pass!=3) continue;
+			if (item_dist(&zi,a,&mx,&my)<gap) pour_cutout(f,a,gap);
+		    }
+	    if (pass!=3) continue;
+	    /* holes, unless they are in a pad of the zone net */
+	    grid_cell(&h.g,x0-gap,y0-gap,&u0,&w0);
+	    grid_cell(&h.g,x1+gap,y1+gap,&u1,&w1);
+	    for (w=w0;h.n && w<=w1;w++)
+		for (u=u0;u<=u1;u++)
+		    for (m=h.g.start[w*h.g.nx+u];m<h.g.start[w*h.g.nx+u+1];m++) {
+			if (seen[s.n+h.g.list[m]]==k) continue;
+			seen[s.n+h.g.list[m]]=k;
+			a=&h.it[h.g.list[m]];
+			if (item_dist(&zi,a,&mx,&my)>=gap) continue;
+			if (z->net) {
+			    int c=0, b;
+			    while ((b=item_at(&s,a->x[0],a->y[0],&c))>=0)
+				if (img.prim[s.it[b].prim].net==z->net) break;
+			    if (b>=0) continue;
+			}
+			pour_cutout(f,a,gap);
+		    }
+	}
+    }
+    fprintf(f,"%%LPD*%%\n");
+    st->capture_clear=0;
+    ret=0;
+ done:
+    st->capture=saved;
+    free(seen);
+    item_set_free(&s); item_set_free(&h);
+    free(img.prim); free(img.x); free(img.y);
+    free(holes.prim); free(holes.x); free(holes.y);
+    return ret;
+}
+
+/* flattening of gerber layers: all primitives are turned into polygons in
+   0.1 mil and united in the order of their polarity. The board is cut
+   into tiles which are swept over y in parallel; between two event lines
+   no edges cross, so the covered spans are trapezoids. Their outline is
+   traced into rings, and holes are joined to the ring around them with a
+   cut-in. Flashes not touching anything else stay flashes. */
+#define FLAT_SCALE 10 /* units per mil */
+#define FLAT_TILE 16  /* grid cells per tile side */
+typedef struct {int x0, y0, x1, y1, wind, group;} flat_edge; /* y0<y1 */
+typedef struct {flat_edge *e; double xb, xt;} flat_cut;
+typedef struct {int lb, lt, rb, rt;} flat_span;
+typedef struct {int x0, y0, x1, y1;} flat_seg; /* copper on the left */
+typedef struct {int n, *x, *y, hole; double area;} flat_ring;
+typedef struct {
+    flat_edge *e; int ne, maxe;
+    int *ys, *act, *px, *py, *qx, *qy, maxp;
+    flat_cut *cut;
+    flat_span *sp, *sp2; int nsp, nsp2, maxsp, maxsp2, prevy;
+    int *wind;
+    flat_seg *b; int nb, maxb;
+    flat_ring *r; int nr, maxr;
+} flat_tile;
+typedef struct {
+    drc_item *poly; int npoly; drc_grid g;
+    int *group; char *dark; int ngroups; /* polarity runs of primitives */
+    int tx, ty, next, failed; pthread_mutex_t lock;
+    flat_tile *tile;
+} flat_job;
+
+/* makes room for need elements of size in *p */
+static int flat_grow(void *p, int *max, int need, size_t size){
+    void *n;
+    if (need<=*max) return 0;
+    if (need<2**max+64) need=2**max+64;
+    if (!(n=realloc(*(void **)p,need*size))) return 1;
+    *(void **)p=n; *max=need;
+    return 0;
+}
+/* is b of a,b,c not needed: on the line a-c, or the tip of a spike
+   going back along it no wider than one unit */
+static int flat_drop(int *x, int *y, int a, int b, int c){
+    double ux=x[b]-x[a], uy=y[b]-y[a], vx=x[c]-x[b], vy=y[c]-y[b];
+    double cr=ux*vy-uy*vx, lu=hypot(ux,uy), lv=hypot(vx,vy);
+    if (cr==0) return 1;
+    return ux*vx+uy*vy<0 && fabs(cr)<=((lu>lv)?lu:lv);
+}
+/* drops the points of ring x,y which lie within tol of the chord between
+   the points kept around them; returns the remaining number */
+static int flat_simplify(int *x, int *y, int n, double tol){
+    int a=0, e, k, m=1;
+    double qx, qy;
+    if (n<4) return n;
+    for (e=2;e<=n;e++) /* e==n closes the ring at point 0 */
+	for (k=a+1;k<e;k++)
+	    if (pt_seg(x[k],y[k],x[a],y[a],x[e%n],y[e%n],&qx,&qy)>tol) {
+		a=e-1; x[m]=x[a]; y[m++]=y[a];
+		break;
+	    }
+    if (m>=3 && pt_seg(x[0],y[0],x[m-1],y[m-1],x[1],y[1],&qx,&qy)<=tol) {
+	memmove(x,x+1,(m-1)*sizeof(int)); memmove(y,y+1,(m-1)*sizeof(int));
+	m--;
+    }
+    return m;
+}
+/* drops collinear points and thin spikes of a rounded outline without
+   repeated points; returns the remaining number, or 0 if nothing with an
+   area is left */
+static int flat_prune(int *x, int *y, int n){
+    int k, m;
+    double area=0;
+    for (m=k=0;k<n;k++) {
+	if (m && x[k]==x[m-1] && y[k]==y[m-1]) continue;
+	x[m]=x[k]; y[m++]=y[k];
+	while (m>=3 && flat_drop(x,y,m-3,m-2,m-1)) {
+	    x[m-2]=x[m-1]; y[m-2]=y[m-1]; m--;
+	    if (m>=2 && x[m-1]==x[m-2] && y[m-1]==y[m-2]) m--;
+	}
+    }
+    while (m>=3) { /* and around the start */
+	if ((x[m-1]==x[0] && y[m-1]==y[0]) || flat_drop(x,y,m-2,m-1,0)) {
+	    m--;
+	} else if (flat_drop(x,y,m-1,0,1)) {
+	    memmove(x,x+1,(m-1)*sizeof(int)); memmove(y,y+1,(m-1)*sizeof(int));
+	    m--;
+	} else break;
+    }
+    for (k=0;k<m;k++)
+	area+=(double)x[k]*y[(k+1)%m]-(double)x[(k+1)%m]*y[k];
+    return (m>=3 && area!=0)?m:0;
+}
+
+/* clips polygon x,y against one side of the tile into ox,oy. Crossings
+   are computed from the ordered end points, so both tiles at a seam get
+   the same point. */
+static int clip_half(int *x, int *y, int n, int *ox, int *oy, int axis,
+		     int c, int lower){
+    int k, m=0, s, e, ins, ine, px, py, qx, qy;
+    double t;
+    for (k=0;k<n;k++) {
+	s=(k+n-1)%n; e=k;
+	ins=lower?((axis?y[s]:x[s])>=c):((axis?y[s]:x[s])<=c);
+	ine=lower?((axis?y[e]:x[e])>=c):((axis?y[e]:x[e])<=c);
+	if (ins!=ine) {
+	    if (x[s]<x[e] || (x[s]==x[e] && y[s]<y[e])) {
+		px=x[s]; py=y[s]; qx=x[e]; qy=y[e];
+	    } else {
+		px=x[e]; py=y[e]; qx=x[s]; qy=y[s];
+	    }
+	    if (axis) {
+		t=(double)(c-py)/(qy-py);
+		ox[m]=(int)floor(px+t*(qx-px)+0.5); oy[m++]=c;
+	    } else {
+		t=(double)(c-px)/(qx-px);
+		ox[m]=c; oy[m++]=(int)floor(py+t*(qy-py)+0.5);
+	    }
+	}
+	if (ine) {ox[m]=x[e]; oy[m++]=y[e];}
+    }
+    return m;
+}
+/* cuts polygon x,y of n points at the edges of the window; x and y need
+   room for 16n points. Returns the remaining number. */
+static int window_cut(int *x, int *y, int n){
+    int x0=(int)floor((st->win_mx0-st->org_x)*FLAT_SCALE);
+    int x1=(int)ceil((st->win_mx1-st->org_x)*FLAT_SCALE);
+    int y0=(int)floor((st->win_my0-st->org_y)*FLAT_SCALE);
+    int y1=(int)ceil((st->win_my1-st->org_y)*FLAT_SCALE);
+    int *tx, *ty;
+    if (flat_grow(&st->win_tx,&st->win_maxx,16*n+8,sizeof(int)) ||
+	flat_grow(&st->win_ty,&st->win_maxy,16*n+8,sizeof(int))) return 0;
+    tx=st->win_tx; ty=st->win_ty;
+    n=clip_half(x,y,n,tx,ty,0,x0,1);
+    n=clip_half(tx,ty,n,x,y,0,x1,0);
+    n=clip_half(x,y,n,tx,ty,1,y0,1);
+    return clip_half(tx,ty,n,x,y,1,y1,0);
+}
+/* adds the edges of a polygon, oriented counterclockwise */
+static int tile_poly(flat_tile *t, int *x, int *y, int n, int group){
+    flat_edge *e;
+    double area=0;
+    int k, a, b, s;
+    for (k=0;k<n;k++)
+	area+=(double)x[k]*y[(k+1)%n]-(double)x[(k+1)%n]*y[k];
+    if (area==0) return 0;
+    s=(area>0)?1:-1;
+    if (flat_grow(&t->e,&t->maxe,t->ne+n,sizeof(flat_edge))) return 1;
+    for (k=0;k<n;k++) {
+	a=k; b=(k+1)%n;
+	if (y[a]==y[b]) continue;
+	e=&t->e[t->ne++];
+	if (y[a]>y[b]) {b=a; a=(k+1)%n;}
+	e->x0=x[a]; e->y0=y[a]; e->x1=x[b]; e->y1=y[b];
+	e->wind=(b==k)?s:-s; /* entering from the left counts up */
+	e->group=group;
+    }
+    return 0;
+}
+static int edge_y0_cmp(const void *a, const void *b){
+    return ((flat_edge *)a)->y0-((flat_edge *)b)->y0;
+}
+static int int_cmp(const void *a, const void *b){
+    return (*(int *)a>*(int *)b)-(*(int *)a<*(int *)b);
+}
+static int cut_cmp(const void *a, const void *b){
+    const flat_cut *p=a, *q=b;
+    if (p->xb!=q->xb) return (p->xb>q->xb)-(p->xb<q->xb);
+    return (p->xt>q->xt)-(p->xt<q->xt);
+}
+static int cut_mid_cmp(const void *a, const void *b){
+    const flat_cut *p=a, *q=b;
+    double u=p->xb+p->xt, v=q->xb+q->xt;
+    return (u>v)-(u<v);
+}
+static double edge_x(flat_edge *e, int y){
+    return e->x0+(double)(e->x1-e->x0)*(y-e->y0)/(e->y1-e->y0);
+}
+/* outline piece from x0,y0 to x1,y1 */
+static int seg_add(flat_tile *t, int x0, int y0, int x1, int y1){
+    flat_seg *s;
+    if (x0==x1 && y0==y1) return 0;
+    if (flat_grow(&t->b,&t->maxb,t->nb+1,sizeof(flat_seg))) return 1;
+    s=&t->b[t->nb++];
+    s->x0=x0; s->y0=y0; s->x1=x1; s->y1=y1;
+    return 0;
+}
+static int span_x(flat_span *s, int k, int top){
+    return top?((k&1)?s[k/2].rt:s[k/2].lt):((k&1)?s[k/2].rb:s[k/2].lb);
+}
+/* outline pieces on the line y where the tops of the spans lo below and
+   the bottoms of the spans hi above differ */
+static int flat_hline(flat_tile *t, flat_span *lo, int nlo, flat_span *hi,
+		      int nhi, int y){
+    int i=0, j=0, inlo=0, inhi=0, x, xn;
+    for (;;) {
+	x=(i<2*nlo)?span_x(lo,i,1):INT_MAX;
+	if (j<2*nhi && span_x(hi,j,0)<x) x=span_x(hi,j,0);
+	if (x==INT_MAX) return 0;
+	for (;i<2*nlo && span_x(lo,i,1)==x;i++) inlo+=(i&1)?-1:1;
+	for (;j<2*nhi && span_x(hi,j,0)==x;j++) inhi+=(j&1)?-1:1;
+	xn=(i<2*nlo)?span_x(lo,i,1):INT_MAX;
+	if (j<2*nhi && span_x(hi,j,0)<xn) xn=span_x(hi,j,0);
+	if (xn==INT_MAX) return 0;
+	if (inhi && !inlo && seg_add(t,x,y,xn,y)) return 1;
+	if (inlo && !inhi && seg_add(t,xn,y,x,y)) return 1;
+    }
+}
+/* spans of the slab ylo..yhi of na active edges; the slab is lowered
+   until no edges cross within it and its top is returned in *top.
+   Returns nonzero on failure. */
+static int flat_slab(flat_job *j, flat_tile *t, int na, int ylo, int *top){
+    flat_cut *c=t->cut;
+    flat_span *s;
+    double d0, d1, yc, ymin;
+    int k, g, on, now, lb=0, lt=0, rb, rt, yhi=*top;
+    for (k=0;k<na;k++) {
+	c[k].e=&t->e[t->act[k]]; c[k].xb=edge_x(c[k].e,ylo);
+    }
+    for (;;) {
+	for (k=0;k<na;k++) c[k].xt=edge_x(c[k].e,yhi);
+	qsort(c,na,sizeof(flat_cut),cut_cmp);
+	ymin=yhi;
+	for (k=0;k+1<na;k++) {
+	    if (c[k].xt<=c[k+1].xt) continue;
+	    d0=c[k+1].xb-c[k].xb; d1=c[k].xt-c[k+1].xt;
+	    yc=ylo+d0/(d0+d1)*(yhi-ylo);
+	    if (yc<ymin) ymin=yc;
+	}
+	if (ymin>=yhi || yhi-ylo<=1) break;
+	k=(int)floor(ymin+0.5);
+	yhi=(k<=ylo)?ylo+1:(k>=yhi)?yhi-1:k;
+    }
+    qsort(c,na,sizeof(flat_cut),cut_mid_cmp);
+    /* covered spans; a point is dark if the last polarity run around it
+       is dark */
+    memset(t->wind,0,j->ngroups*sizeof(int));
+    t->nsp=0; on=0;
+    for (k=0;k<na;k++) {
+	t->wind[c[k].e->group]+=c[k].e->wind;
+	for (now=0,g=j->ngroups-1;g>=0;g--)
+	    if (t->wind[g]) {now=j->dark[g]; break;}
+	if (now && !on) {
+	    lb=(int)floor(c[k].xb+0.5); lt=(int)floor(c[k].xt+0.5);
+	} else if (!now && on) {
+	    rb=(int)floor(c[k].xb+0.5); rt=(int)floor(c[k].xt+0.5);
+	    if (t->nsp && t->sp[t->nsp-1].rb==lb && t->sp[t->nsp-1].rt==lt) {
+		t->sp[t->nsp-1].rb=rb; t->sp[t->nsp-1].rt=rt;
+	    } else if (lb!=rb || lt!=rt) {
+		if (flat_grow(&t->sp,&t->maxsp,t->nsp+1,sizeof(flat_span)))
+		    return 1;
+		s=&t->sp[t->nsp++];
+		s->lb=lb; s->lt=lt; s->rb=rb; s->rt=rt;
+	    }
+	}
+	on=now;
+    }
+    /* outline: the line between the last slab and this one, the sides */
+    for (k=0;k<t->nsp;k++) { /* rounding must not make spans overlap */
+	s=&t->sp[k];
+	if (k && s->lb<s[-1].rb) s->lb=s[-1].rb;
+	if (k && s->lt<s[-1].rt) s->lt=s[-1].rt;
+	if (s->rb<s->lb) s->rb=s->lb;
+	if (s->rt<s->lt) s->rt=s->lt;
+    }
+    if (t->prevy!=ylo) {
+	if (flat_hline(t,t->sp2,t->nsp2,NULL,0,t->prevy)) return 1;
+	t->nsp2=0;
+    }
+    if (flat_hline(t,t->sp2,t->nsp2,t->sp,t->nsp,ylo)) return 1;
+    for (k=0;k<t->nsp;k++) {
+	s=&t->sp[k];
+	if (seg_add(t,s->lt,yhi,s->lb,ylo) || seg_add(t,s->rb,ylo,s->rt,yhi))
+	    return 1;
+    }
+    s=t->sp; t->sp=t->sp2; t->sp2=s;
+    k=t->maxsp; t->maxsp=t->maxsp2; t->maxsp2=k;
+    t->nsp2=t->nsp; t->prevy=yhi;
+    *top=yhi;
+    return 0;
+}
+static int seg_cmp(const void *a, const void *b){
+    const flat_seg *p=a, *q=b;
+    if (p->x0!=q->x0) return (p->x0>q->x0)-(p->x0<q->x0);
+    return (p->y0>q->y0)-(p->y0<q->y0);
+}
+/* keeps ring x,y of n points in mil */
+static int ring_add(flat_tile *t, int *x, int *y, int n){
+    flat_ring *r;
+    int k;
+    if (flat_grow(&t->r,&t->maxr,t->nr+1,sizeof(flat_ring))) return 1;
+    r=&t->r[t->nr];
+    r->x=malloc(n*sizeof(int)); r->y=malloc(n*sizeof(int));
+    if (!r->x || !r->y) {free(r->x); free(r->y); return 1;}
+    memcpy(r->x,x,n*sizeof(int)); memcpy(r->y,y,n*sizeof(int));
+    r->n=n; r->hole=0;
+    for (r->area=0,k=0;k<n;k++)
+	r->area+=(double)x[k]*y[(k+1)%n]-(double)x[(k+1)%n]*y[k];
+    t->nr++;
+    return 0;
+}
+/* links the outline pieces of a tile into rings in mil; where several
+   pieces go on from a point, the one turning most to the left is taken */
+static int flat_trace(flat_tile *t){
+    flat_seg *s, *e;
+    char *used;
+    int *x=NULL, *y=NULL, maxx=0, maxy=0, n, k, c, m, h, best, ret=1;
+    double a, ba=0;
+    if (!t->nb) return 0;
+    qsort(t->b,t->nb,sizeof(flat_seg),seg_cmp);
+    if (!(used=calloc(t->nb,1))) return 1;
+    for (k=0;k<t->nb;k++) {
+	if (used[k]) continue;
+	for (n=0,c=k;c>=0;c=best) {
+	    used[c]=1; s=&t->b[c];
+	    if (flat_grow(&x,&maxx,n+1,sizeof(int)) ||
+		flat_grow(&y,&maxy,n+1,sizeof(int))) goto done;
+	    x[n]=s->x0; y[n++]=s->y0;
+	    /* pieces starting at the end of this one */
+	    for (m=0,h=t->nb;m<h;) {
+		c=(m+h)/2;
+		if (t->b[c].x0<s->x1 || (t->b[c].x0==s->x1 && t->b[c].y0<s->y1))
+		    m=c+1;
+		else h=c;
+	    }
+	    for (best=-1;m<t->nb && t->b[m].x0==s->x1 && t->b[m].y0==s->y1;m++) {
+		if (used[m]) continue;
+		e=&t->b[m];
+		a=atan2((double)(s->x1-s->x0)*(e->y1-e->y0)-
+			(double)(s->y1-s->y0)*(e->x1-e->x0),
+			(double)(s->x1-s->x0)*(e->x1-e->x0)+
+			(double)(s->y1-s->y0)*(e->y1-e->y0));
+		if (best<0 || a>ba) {best=m; ba=a;}
+	    }
+	}
+	/* within the tolerance of the arcs, then rounded to mil and pruned */
+	n=flat_simplify(x,y,n,0.25*FLAT_SCALE);
+	for (m=0;m<n;m++) {
+	    x[m]=(int)floor((double)x[m]/FLAT_SCALE+0.5);
+	    y[m]=(int)floor((double)y[m]/FLAT_SCALE+0.5);
+	}
+	if ((n=flat_prune(x,y,n)) && ring_add(t,x,y,n)) goto done;
+    }
+    ret=0;
+ done:
+    free(used); free(x); free(y);
+    return ret;
+}
+/* joins hole h to ring o: a cut-in goes straight up from the top of the
+   hole to the nearest edge of o */
+static int cut_in(flat_ring *o, flat_ring *h){
+    int k, m, n=0, a, b, ih=0, best=-1, *x, *y, px, py;
+    double yv, by=1e30;
+    for (k=1;k<h->n;k++)
+	if (h->y[k]>h->y[ih] || (h->y[k]==h->y[ih] && h->x[k]<h->x[ih])) ih=k;
+    px=h->x[ih];
+    for (k=0;k<o->n;k++) {
+	a=k; b=(k+1)%o->n;
+	if (o->x[a]==o->x[b]) continue;
+	if (px<((o->x[a]<o->x[b])?o->x[a]:o->x[b]) ||
+	    px>=((o->x[a]>o->x[b])?o->x[a]:o->x[b])) continue;
+	yv=o->y[a]+(double)(px-o->x[a])*(o->y[b]-o->y[a])/(o->x[b]-o->x[a]);
+	if (yv>=h->y[ih] && yv<by) {by=yv; best=k;}
+    }
+    if (best<0) return 0; /* cannot be */
+    py=(int)floor(by+0.5);
+    x=malloc((o->n+h->n+3)*sizeof(int)); y=malloc((o->n+h->n+3)*sizeof(int));
+    if (!x || !y) {free(x); free(y); return 1;}
+    for (k=0;k<=best;k++) {x[n]=o->x[k]; y[n++]=o->y[k];}
+    x[n]=px; y[n++]=py;
+    for (k=0;k<=h->n;k++) {
+	m=(ih+k)%h->n; x[n]=h->x[m]; y[n++]=h->y[m];
+    }
+    x[n]=px; y[n++]=py;
+    for (k=best+1;k<o->n;k++) {x[n]=o->x[k]; y[n++]=o->y[k];}
+    free(o->x); free(o->y); o->x=x; o->y=y; o->n=n;
+    return 0;
+}
+static int ring_top(flat_ring *r){
+    int k, y=r->y[0];
+    for (k=1;k<r->n;k++) if (r->y[k]>y) y=r->y[k];
+    return y;
+}
+/* joins the holes (clockwise rings) of a tile to the smallest outer ring
+   around them, the upper holes first, so a cut-in never crosses a hole
+   which is still open */
+static int flat_holes(flat_tile *t){
+    flat_ring *h;
+    int k, m, n=0, own, *idx, *top;
+    double l, px, py;
+    idx=malloc((t->nr+1)*sizeof(int)); top=malloc((t->nr+1)*sizeof(int));
+    if (!idx || !top) {free(idx); free(top); return 1;}
+    for (k=0;k<t->nr;k++)
+	if (t->r[k].area<0) {top[n]=ring_top(&t->r[k]); idx[n++]=k;}
+    for (k=1;k<n;k++) /* by falling top */
+	for (m=k;m>0 && top[m-1]<top[m];m--) {
+	    own=top[m]; top[m]=top[m-1]; top[m-1]=own;
+	    own=idx[m]; idx[m]=idx[m-1]; idx[m-1]=own;
+	}
+    for (k=0;k<n;k++) {
+	h=&t->r[idx[k]];
+	h->hole=1;
+	/* a point just beside the first edge, in the copper */
+	l=hypot(h->x[1]-h->x[0],h->y[1]-h->y[0]);
+	px=(h->x[0]+h->x[1])/2.0-(h->y[1]-h->y[0])*0.25/l;
+	py=(h->y[0]+h->y[1])/2.0+(h->x[1]-h->x[0])*0.25/l;
+	for (own=-1,m=0;m<t->nr;m++)
+	    if (t->r[m].area>0 && (own<0 || t->r[m].area<t->r[own].area) &&
+		pt_in_poly(px,py,t->r[m].x,t->r[m].y,t->r[m].n)) own=m;
+	if (own>=0 && cut_in(&t->r[own],h)) break;
+    }
+    free(idx); free(top);
+    return k<n;
+}
+/* clips the polygons of tile tn to it and sweeps it */
+static int flat_tile_run(flat_job *j, int tn){
+    flat_tile *t=&j->tile[tn];
+    drc_grid *g=&j->g;
+    drc_item *a;
+    int u0=(tn%j->tx)*FLAT_TILE, w0=(tn/j->tx)*FLAT_TILE, u, w, m, k, n;
+    int x0, y0, x1, y1, *idx=NULL, ni=0, maxi=0, nys, na, p, y;
+    x0=(int)floor(g->x0+u0*g->cell); x1=(int)floor(g->x0+(u0+FLAT_TILE)*g->cell);
+    y0=(int)floor(g->y0+w0*g->cell); y1=(int)floor(g->y0+(w0+FLAT_TILE)*g->cell);
+    if ((tn+1)%j->tx==0) x1=INT_MAX/2;
+    if (tn/j->tx==j->ty-1) y1=INT_MAX/2;
+    if (tn%j->tx==0) x0=-INT_MAX/2;
+    if (tn<j->tx) y0=-INT_MAX/2;
+    /* polygons of the cells of the tile, once each */
+    for (w=w0;w<w0+FLAT_TILE && w<g->ny;w++)
+	for (u=u0;u<u0+FLAT_TILE && u<g->nx;u++)
+	    for (m=g->start[w*g->nx+u];m<g->start[w*g->nx+u+1];m++) {
+		if (flat_grow(&idx,&maxi,ni+1,sizeof(int))) goto fail;
+		idx[ni++]=g->list[m];
+	    }
+    qsort(idx,ni,sizeof(int),int_cmp);
+    for (k=0;k<ni;k++) {
+	if (k && idx[k]==idx[k-1]) continue;
+	a=&j->poly[idx[k]];
+	if (16*a->n+8>t->maxp) { /* each clip may double the points */
+	    n=16*a->n+8;
+	    free(t->px); free(t->py); free(t->qx); free(t->qy);
+	    t->px=malloc(n*sizeof(int)); t->py=malloc(n*sizeof(int));
+	    t->qx=malloc(n*sizeof(int)); t->qy=malloc(n*sizeof(int));
+	    t->maxp=n;
+	    if (!t->px || !t->py || !t->qx || !t->qy) goto fail;
+	}
+	if (a->bx0>=x0 && a->bx1<=x1 && a->by0>=y0 && a->by1<=y1) {
+	    if (tile_poly(t,a->x,a->y,a->n,j->group[a->prim])) goto fail;
+	    continue;
+	}
+	n=clip_half(a->x,a->y,a->n,t->px,t->py,0,x0,1);
+	n=clip_half(t->px,t->py,n,t->qx,t->qy,0,x1,0);
+	n=clip_half(t->qx,t->qy,n,t->px,t->py,1,y0,1);
+	n=clip_half(t->px,t->py,n,t->qx,t->qy,1,y1,0);
+	if (n>2 && tile_poly(t,t->qx,t->qy,n,j->group[a->prim])) goto fail;
+    }
+    free(idx); idx=NULL;
+    if (!t->ne) return 0;
+    /* sweep over the event lines */
+    qsort(t->e,t->ne,sizeof(flat_edge),edge_y0_cmp);
+    t->prevy=INT_MIN;
+    if (!(t->ys=malloc(2*t->ne*sizeof(int))) ||
+	!(t->act=malloc(t->ne*sizeof(int))) ||
+	!(t->cut=malloc(t->ne*sizeof(flat_cut))) ||
+	!(t->wind=malloc(j->ngroups*sizeof(int)))) goto fail;
+    for (k=0;k<t->ne;k++) {t->ys[2*k]=t->e[k].y0; t->ys[2*k+1]=t->e[k].y1;}
+    qsort(t->ys,2*t->ne,sizeof(int),int_cmp);
+    for (nys=k=0;k<2*t->ne;k++)
+	if (!nys || t->ys[nys-1]!=t->ys[k]) t->ys[nys++]=t->ys[k];
+    for (na=p=k=0;k+1<nys;k++) {
+	for (m=n=0;m<na;m++)
+	    if (t->e[t->act[m]].y1>t->ys[k]) t->act[n++]=t->act[m];
+	for (na=n;p<t->ne && t->e[p].y0<=t->ys[k];p++) t->act[na++]=p;
+	for (m=t->ys[k];m<t->ys[k+1];m=y)
+	    if (y=t->ys[k+1], flat_slab(j,t,na,m,&y)) goto fail;
+    }
+    if (flat_hline(t,t->sp2,t->nsp2,NULL,0,t->prevy) || flat_trace(t) ||
+	flat_holes(t)) goto fail;
+    return 0;
+ fail:
+    free(idx);
+    return 1;
+}
+static void *flat_worker(void *arg){
+    flat_job *j=arg;
+    int t;
+    for (;;) {
+	pthread_mutex_lock(&j->lock);
+	t=j->next++;
+	pthread_mutex_unlock(&j->lock);
+	if (t>=j->tx*j->ty) break;
+	if (flat_tile_run(j,t)) j->failed=1;
+    }
+    return NULL;
+}
+/* nonzero if item a touches an item of s from another primitive */
+static int item_touches(item_set *s, drc_item *a){
+    drc_item *b;
+    int m, u, w, u0, w0, u1, w1;
+    double mx, my;
+    if (!s->n) return 0;
+    grid_cell(&s->g,a->bx0,a->by0,&u0,&w0);
+    grid_cell(&s->g,a->bx1,a->by1,&u1,&w1);
+    for (w=w0;w<=w1;w++)
+	for (u=u0;u<=u1;u++)
+	    for (m=s->g.start[w*s->g.nx+u];m<s->g.start[w*s->g.nx+u+1];m++) {
+		b=&s->it[s->g.list[m]];
+		if (b->prim==a->prim || b->bx0>a->bx1 || b->bx1<a->bx0 ||
+		    b->by0>a->by1 || b->by1<a->by0) continue;
+		if (item_dist(a,b,&mx,&my)<=0) return 1;
+	    }
+    return 0;
+}
+/* outline of an item in FLAT_SCALE units into x,y, with arcs within a
+   quarter mil; returns the number of points, at most 1026 */
+static int item_outline(drc_item *a, int *x, int *y){
+    double r=a->r*FLAT_SCALE, th, ax, ay, bx, by;
+    int k, m, n=0;
+    if (a->n>2) {
+	for (k=0;k<a->n;k++) {x[k]=a->x[k]*FLAT_SCALE; y[k]=a->y[k]*FLAT_SCALE;}
+	return a->n;
+    }
+    if (r<1) return 0;
+    th=0.25*FLAT_SCALE;
+    m=(int)ceil(M_PI/acos(1-th/(r>2*th?r:2*th)));
+    if (m<8) m=8;
+    if (m>1024) m=1024;
+    ax=a->x[0]*FLAT_SCALE; ay=a->y[0]*FLAT_SCALE;
+    if (a->n==1) {
+	for (k=0;k<m;k++) {
+	    x[n]=(int)floor(ax+r*cos(2*M_PI*k/m)+0.5);
+	    y[n++]=(int)floor(ay+r*sin(2*M_PI*k/m)+0.5);
+	}
+	return n;
+    }
+    bx=a->x[1]*FLAT_SCALE; by=a->y[1]*FLAT_SCALE;
+    th=atan2(by-ay,bx-ax)-M_PI/2;
+    for (k=0;k<=m/2;k++) { /* around the end, then around the start */
+	x[n]=(int)floor(bx+r*cos(th+2*M_PI*k/m)+0.5);
+	y[n++]=(int)floor(by+r*sin(th+2*M_PI*k/m)+0.5);
+    }
+    for (k=0;k<=m/2;k++) {
+	x[n]=(int)floor(ax+r*cos(th+M_PI+2*M_PI*k/m)+0.5);
+	y[n++]=(int)floor(ay+r*sin(th+M_PI+2*M_PI*k/m)+0.5);
+    }
+    return n;
+}
+
+/* parses a gerber layer with its knockouts (if punchlist is given) from
+   infile and writes it to f as non-overlapping regions and the remaining
+   flashes. Returns nonzero on failure. */
+static int flatten_layer(FILE *f, int *layerlist, int *punchlist,
+			 int punchflag){
+    layer_image img;
+    layer_image *saved=st->capture;
+    item_set d, c;
+    flat_job j;
+    flat_tile *t;
+    drc_item *a;
+    primitive *p;
+    pthread_t th[16];
+    FILE *sink;
+    char *keep=NULL;
+    long pos=ftell(st->infile);
+    int *off=NULL, *px=NULL, *py=NULL, np=0, maxx=0, maxy=0;
+    int k, m, n, set, collect=st->place_collect, nth, ret=1;
+
+    memset(&d,0,sizeof(d)); memset(&c,0,sizeof(c)); memset(&j,0,sizeof(j));
+    memset(&img,0,sizeof(img));
+    if (!(sink=fopen("/dev/null","w"))) return 1;
+    st->capture=&img; st->capture_clear=0;
+    st->place_collect=0;
+    if (st->pour_num && pour_layer(sink,layerlist)) {fclose(sink); goto done;}
+    st->place_collect=collect;
+    if (!fseek(st->infile,pos,SEEK_SET)) do_parsing(layerlist,2,sink,0);
+    if (punchlist && !fseek(st->infile,pos,SEEK_SET)) {
+	st->capture_clear=1;
+	do_parsing(punchlist,2,sink,punchflag);
+    }
+    st->capture=saved; st->capture_clear=0;
+    fclose(sink);
+    if (img.failed) goto done;
+
+    /* polarity runs, and the flashes which stay */
+    j.group=malloc((img.num+1)*sizeof(int));
+    j.dark=malloc(img.num+1);
+    keep=calloc(img.num+1,1);
+    if (!j.group || !j.dark || !keep) goto done;
+    for (k=0;k<img.num;k++) {
+	if (!k || img.prim[k].clear!=img.prim[k-1].clear)
+	    j.dark[j.ngroups++]=!img.prim[k].clear;
+	j.group[k]=j.ngroups-1;
+    }
+    if (item_set_build(&d,&img,0,0) || item_set_build(&c,&img,1,0))
+	goto done;
+    for (k=0;k<d.n;k++) {
+	a=&d.it[k];
+	if (img.prim[a->prim].kind!=PRIM_FLASH) continue;
+	if (st->window_clip &&
+	    (a->bx0<st->win_mx0-st->org_x || a->bx1>st->win_mx1-st->org_x ||
+	     a->by0<st->win_my0-st->org_y || a->by1>st->win_my1-st->org_y))
+	    continue;
+	if (!item_touches(&d,a) && !item_touches(&c,a)) keep[a->prim]=1;
+    }
+    /* outlines of everything else */
+    if (!(j.poly=malloc((d.n+c.n+1)*sizeof(drc_item))) ||
+	!(off=malloc((d.n+c.n+1)*sizeof(int)))) goto done;
+    for (set=0;set<2;set++)
+	for (k=0;k<(set?c.n:d.n);k++) {
+	    a=set?&c.it[k]:&d.it[k];
+	    if (keep[a->prim]) continue;
+	    n=(a->n>1026)?a->n:1026;
+	    if (st->window_clip) n=16*n+8; /* room for the cut */
+	    if (flat_grow(&px,&maxx,np+n,sizeof(int)) ||
+		flat_grow(&py,&maxy,np+n,sizeof(int))) goto done;
+	    if (!(n=item_outline(a,&px[np],&py[np]))) continue;
+	    if (st->window_clip && (n=window_cut(&px[np],&py[np],n))<3) continue;
+	    off[j.npoly]=np;
+	    j.poly[j.npoly].prim=a->prim; j.poly[j.npoly++].n=n;
+	    np+=n;
+	}
+    for (k=0;k<j.npoly;k++) {
+	a=&j.poly[k]; a->x=&px[off[k]]; a->y=&py[off[k]]; a->r=0;
+	a->bx0=a->bx1=a->x[0]; a->by0=a->by1=a->y[0];
+	for (m=1;m<a->n;m++) {
+	    if (a->x[m]<a->bx0) a->bx0=a->x[m];
+	    if (a->x[m]>a->bx1) a->bx1=a->x[m];
+	    if (a->y[m]<a->by0) a->by0=a->y[m];
+	    if (a->y[m]>a->by1) a->by1=a->y[m];
+	}
+    }
+    /* sweep the tiles in parallel */
+    if (grid_build(&j.g,j.poly,j.npoly,0)) goto done;
+    j.tx=(j.g.nx+FLAT_TILE-1)/FLAT_TILE; j.ty=(j.g.ny+FLAT_TILE-1)/FLAT_TILE;
+    if (!(j.tile=calloc(j.tx*j.ty,sizeof(flat_tile)))) goto done;
+    pthread_mutex_init(&j.lock,NULL);
+    nth=sysconf(_SC_NPROCESSORS_ONLN);
+    if (nth<1) nth=1;
+    if (nth>16) nth=16;
+    if (nth>j.tx*j.ty) nth=j.tx*j.ty;
+    for (k=0;k<nth;k++)
+	if (pthread_create(&th[k],NULL,flat_worker,&j)) break;
+    if (k==0) flat_worker(&j); /* no threads available; do it here */
+    for (nth=k,k=0;k<nth;k++) pthread_join(th[k],NULL);
+    pthread_mutex_destroy(&j.lock);
+    if (j.failed) goto done;
+
+    /* regions in tile order, then the flashes */
+    for (k=0;k<j.tx*j.ty;k++)
+	for (m=0;m<j.tile[k].nr;m++)
+	    if (!j.tile[k].r[m].hole)
+		region_polygon(f,j.tile[k].r[m].x,j.tile[k].r[m].y,
+			       j.tile[k].r[m].n);
+    for (k=0;k<img.num;k++) {
+	if (!keep[k]) continue;
+	p=&img.prim[k];
+	fprintf(f,"G54D%03d*G01*X%05dY%05dD02*D03*\n",p->aperture,
+		img.x[p->first],img.y[p->first]);
+	cap_begin(PRIM_FLASH,p->aperture,p->depth);
+	cap_point(img.x[p->first],img.y[p->first]);
+    }
+    ret=0;
+ done:
+    st->capture=saved; st->capture_clear=0; st->place_collect=collect;
+    if (j.tile) {
+	for (k=0;k<j.tx*j.ty;k++) {
+	    t=&j.tile[k];
+	    for (m=0;m<t->nr;m++) {free(t->r[m].x); free(t->r[m].y);}
+	    free(t->r); free(t->b); free(t->e); free(t->ys); free(t->act);
+	    free(t->cut); free(t->px); free(t->py); free(t->qx); free(t->qy);
+	    free(t->sp); free(t->sp2); free(t->wind);
+	}
+	free(j.tile);
+    }
+    free(j.g.start); free(j.g.list);
+    free(j.poly); free(j.group); free(j.dark); free(keep); free(off);
+    free(px); free(py);
+    item_set_free(&d); item_set_free(&c);
+    free(img.prim); free(img.x); free(img.y);
+    return ret;
+}
+
+/* opening of a mask pad, for the bridges */
+typedef struct {int x0, y0, x1, y1;} mask_open;
+static int mask_cmp(const void *a, const void *b){
+    return ((const mask_open *)a)->x0-((const mask_open *)b)->x0;
+}
+
+/* join openings closer than mask_web by a bridge across the gap */
+static void mask_bridges(FILE *f, mask_open *o, int n){
+    int i, j, gx, gy, x[4], y[4];
+    qsort(o,n,sizeof(mask_open),mask_cmp);
+    for (i=0;i<n;i++)
+	for (j=i+1;j<n && o[j].x0<o[i].x1+st->mask_web;j++) {
+	    gx=o[j].x0-o[i].x1;
+	    gy=(o[j].y0>o[i].y0)?o[j].y0-o[i].y1:o[i].y0-o[j].y1;
+	    if (gx>0 && gy<0) { /* side by side */
+		x[0]=x[3]=o[i].x1; x[1]=x[2]=o[j].x0;
+		y[0]=y[1]=(o[i].y0>o[j].y0)?o[i].y0:o[j].y0;
+		y[2]=y[3]=(o[i].y1<o[j].y1)?o[i].y1:o[j].y1;
+	    } else if (gx<0 && gy>0 && gy<st->mask_web) { /* one above the other */
+		x[0]=x[3]=(o[i].x0>o[j].x0)?o[i].x0:o[j].x0;
+		x[1]=x[2]=(o[i].x1<o[j].x1)?o[i].x1:o[j].x1;
+		y[0]=y[1]=(o[j].y0>o[i].y0)?o[i].y1:o[j].y1;
+		y[2]=y[3]=(o[j].y0>o[i].y0)?o[j].y0:o[i].y0;
+	    } else continue;
+	    region_polygon(f,x,y,4);
+	}
+}
+
+/* write the solder mask of jobtype from the copper primitives in src[]
+   of the copper jobs cu[]: the dark primitives on depths of the mask.
+   Depths of the mask without copper are parsed from infile afterwards.
+   Returns nonzero without memory. */
+static int mask_layer(FILE *f, int jobtype, layer_image **src, int *cu, int n){
+    int *list=readlayerlist[jobtype], extra[MAXPRINTLAYERS];
+    int k, m, s, d, ap=-1, cur=-1, grow, no=0, maxo=0, ret=0;
+    mask_open *op=NULL;
+    primitive *p;
+    layer_image *img;
+    double w, h;
+
+    grow=(int)floor(st->clear_mil[2]+0.5);
+    for (s=0;s<n;s++) {
+	img=src[s];
+	for (k=0;k<img->num;k++) {
+	    p=&img->prim[k];
+	    if (p->clear || !p->num) continue;
+	    for (m=0;list[m]>=0 && list[m]!=p->depth;m++);
+	    if (list[m]<0) continue;
+	    if (s>0) { /* taken from the first copper job already */
+		for (m=0;readlayerlist[cu[0]][m]>=0 &&
+			 readlayerlist[cu[0]][m]!=p->depth;m++);
+		if (readlayerlist[cu[0]][m]>=0) continue;
+	    }
+	    if (p->kind==PRIM_FLASH || p->kind==PRIM_STROKE) {
+		prim_size(p,&w,&h);
+		ap=(p->aperture>=20 && p->aperture<=maxaperture+20)?
+		    line_aperture(w+2*st->clear_mil[2]):clear_dcode(p->aperture);
+		if (ap!=cur && p->kind==PRIM_STROKE)
+		    fprintf(f,"G54D%02d*\n",ap);
+		cur=ap;
+	    }
+	    if (p->kind==PRIM_FLASH) {
+		fprintf(f,"G54D%03d*G01*X%05dY%05dD02*D03*\n",ap,
+			img->x[p->first],img->y[p->first]);
+		cap_begin(PRIM_FLASH,ap,p->depth);
+		cap_point(img->x[p->first],img->y[p->first]);
+		if (st->mask_web<=0) continue;
+		if (no==maxo) {
+		    mask_open *q=realloc(op,(maxo+256)*sizeof(mask_open));
+		    if (!q) {ret=1; goto done;}
+		    op=q; maxo+=256;
+		}
+		w+=2*st->clear_mil[2]; h+=2*st->clear_mil[2]; /* opening */
+		op[no].x0=img->x[p->first]-(int)(w/2);
+		op[no].x1=img->x[p->first]+(int)(w/2);
+		op[no].y0=img->y[p->first]-(int)(h/2);
+		op[no++].y1=img->y[p->first]+(int)(h/2);
+		continue;
+	    }
+	    if (p->kind==PRIM_REGION) {
+		region_polygon(f,img->x+p->first,img->y+p->first,p->num);
+		if (grow<=0) continue;
+		/* grow the region by its outline */
+		ap=line_aperture(2*st->clear_mil[2]);
+		if (ap!=cur) fprintf(f,"G54D%02d*\n",ap);
+		cur=ap;
+		cap_begin(PRIM_STROKE,ap,p->depth);
+		for (m=0;m<=p->num;m++) {
+		    d=p->first+m%p->num;
+		    fprintf(f,m?"X%05dY%05dD01*":"G01X%05dY%05dD02*",
+			    img->x[d],img->y[d]);
+		    cap_point(img->x[d],img->y[d]);
+		}
+		fprintf(f,"\n");
+		continue;
+	    }
+	    cap_begin(PRIM_STROKE,ap,p->depth);
+	    for (m=0;m<p->num;m++) {
+		d=p->first+m;
+		fprintf(f,m?"X%05dY%05dD01*":"G01X%05dY%05dD02*",
+			img->x[d],img->y[d]);
+		cap_point(img->x[d],img->y[d]);
+	    }
+	    fprintf(f,"\n");
+	}
+    }
+    if (no) mask_bridges(f,op,no);
+
+    /* depths of the mask only, as additional openings */
+    for (k=m=0;list[k]>=0;k++) {
+	for (s=0;s<n;s++) {
+	    for (d=0;readlayerlist[cu[s]][d]>=0 &&
+		     readlayerlist[cu[s]][d]!=list[k];d++);
+	    if (readlayerlist[cu[s]][d]>=0) break;
+	}
+	if (s==n) extra[m++]=list[k];
+    }
+    extra[m]=-1;
+    if (m && !fseek(st->infile,0L,SEEK_SET)) do_parsing(extra,2,f,0);
+ done:
+    free(op);
+    return ret;
+}
+
+/* revision diff: the drill and copper jobs of the old and the new source
+   are parsed into memory, and each primitive gets a hash of its kind,
+   aperture size and points. Primitives with the same hash on both sides
+   are unchanged; of the rest, those with the same shape (the points
+   relative to the first one) are paired as moved, in the order of their
+   position. The changes are clustered into regions with a grid of
+   DIFF_CELL mil: changes sharing a cell are in the same region. */
+#define DIFF_CELL 100.0
+#define DIFF_ADDED 1
+#define DIFF_REMOVED 2
+#define DIFF_MOVED 3
+typedef struct {
+    unsigned long long key, shape; /* with and without the position */
+    int rx, ry;                    /* first point */
+    double x0, y0, x1, y1;         /* bounding box including the aperture */
+    int mark;                      /* nonzero if not found on the other side */
+} diff_item;
+typedef struct {int type; diff_item *a, *b; int root;} diff_change;
+
+static unsigned long long diff_mix(unsigned long long h, long v){
+    h=(h^(unsigned long long)v)*0x100000001b3ULL;
+    return h^(h>>29);
+}
+/* items of the primitives of img, or NULL without memory */
+static diff_item *diff_items(layer_image *img){
+    diff_item *it, *d;
+    primitive *p;
+    int k, m;
+    double w, h;
+    if (!(it=malloc((img->num+1)*sizeof(diff_item)))) return NULL;
+    for (k=0;k<img->num;k++) {
+	p=&img->prim[k]; d=&it[k];
+	prim_size(p,&w,&h);
+	d->shape=diff_mix(diff_mix(diff_mix(0xcbf29ce484222325ULL,p->kind),
+				   p->clear),prim_is_rect(p));
+	d->shape=diff_mix(diff_mix(diff_mix(d->shape,rnd(w*100)),rnd(h*100)),
+			  p->num);
+	d->rx=p->num?img->x[p->first]:0; d->ry=p->num?img->y[p->first]:0;
+	d->x0=d->x1=d->rx; d->y0=d->y1=d->ry;
+	for (m=p->first;m<p->first+p->num;m++) {
+	    d->shape=diff_mix(diff_mix(d->shape,img->x[m]-d->rx),
+			      img->y[m]-d->ry);
+	    if (img->x[m]<d->x0) d->x0=img->x[m];
+	    if (img->x[m]>d->x1) d->x1=img->x[m];
+	    if (img->y[m]<d->y0) d->y0=img->y[m];
+	    if (img->y[m]>d->y1) d->y1=img->y[m];
+	}
+	d->x0-=w/2; d->x1+=w/2; d->y0-=h/2; d->y1+=h/2;
+	d->key=diff_mix(diff_mix(d->shape,d->rx),d->ry);
+	d->mark=0;
+    }
+    return it;
+}
+static int diff_key_cmp(const void *a, const void *b){
+    const diff_item *p=a, *q=b;
+    if (p->key!=q->key) return (p->key<q->key)?-1:1;
+    return 0;
+}
+static int diff_shape_cmp(const void *a, const void *b){
+    const diff_item *p=*(diff_item * const *)a, *q=*(diff_item * const *)b;
+    if (p->shape!=q->shape) return (p->shape<q->shape)?-1:1;
+    if (p->rx!=q->rx) return p->rx-q->rx;
+    return p->ry-q->ry;
+}
+static int diff_root(diff_change *c, int k){
+    while (c[k].root!=k) k=c[k].root=c[c[k].root].root;
+    return k;
+}
+
+/* changes between the items o (old) and n (new), sorted by their key;
+   returns their number, or -1 without memory */
+static int diff_match(diff_item *o, int no, diff_item *n, int nn,
+		      diff_change **out){
+    diff_item **ro, **rn;
+    diff_change *c;
+    int i, j, k, a, b, num=0;
+
+    for (i=j=0;i<no || j<nn;) { /* unchanged items */
+	if (j==nn || (i<no && o[i].key<n[j].key)) o[i++].mark=1;
+	else if (i==no || n[j].key<o[i].key) n[j++].mark=1;
+	else {i++; j++;}
+    }
+    for (a=i=0;i<no;i++) a+=o[i].mark;
+    for (b=j=0;j<nn;j++) b+=n[j].mark;
+    ro=malloc((a+1)*sizeof(diff_item *)); rn=malloc((b+1)*sizeof(diff_item *));
+    c=malloc((a+b+1)*sizeof(diff_change));
+    if (!ro || !rn || !c) {free(ro); free(rn); free(c); return -1;}
+    for (a=i=0;i<no;i++) if (o[i].mark) ro[a++]=&o[i];
+    for (b=j=0;j<nn;j++) if (n[j].mark) rn[b++]=&n[j];
+    qsort(ro,a,sizeof(diff_item *),diff_shape_cmp);
+    qsort(rn,b,sizeof(diff_item *),diff_shape_cmp);
+    for (i=j=0;i<a || j<b;) {
+	if (j==b || (i<a && ro[i]->shape<rn[j]->shape)) {
+	    c[num].type=DIFF_REMOVED; c[num].a=ro[i++]; c[num].b=NULL;
+	} else if (i==a || rn[j]->shape<ro[i]->shape) {
+	    c[num].type=DIFF_ADDED; c[num].a=NULL; c[num].b=rn[j++];
+	} else {
+	    c[num].type=DIFF_MOVED; c[num].a=ro[i++]; c[num].b=rn[j++];
+	}
+	k=num++; c[k].root=k;
+    }
+    free(ro); free(rn);
+    *out=c;
+    return num;
+}
+
+/* joins the changes into regions: c[k].root is the region of change k.
+   Returns nonzero without memory. */
+static int diff_cluster(diff_change *c, int num){
+    double x0=1e30, y0=1e30, x1=-1e30, y1=-1e30, cell=DIFF_CELL;
+    diff_item *d[2];
+    int *own, k, s, u, v, u0, u1, v0, v1, nx, ny;
+
+    for (k=0;k<num;k++) {
+	d[0]=c[k].a; d[1]=c[k].b;
+	for (s=0;s<2;s++) {
+	    if (!d[s]) continue;
+	    if (d[s]->x0<x0) x0=d[s]->x0;
+	    if (d[s]->x1>x1) x1=d[s]->x1;
+	    if (d[s]->y0<y0) y0=d[s]->y0;
+	    if (d[s]->y1>y1) y1=d[s]->y1;
+	}
+    }
+    if (!num) return 0;
+    do {
+	nx=(int)((x1-x0)/cell)+1; ny=(int)((y1-y0)/cell)+1;
+	if ((double)nx*ny<=(1<<22)) break;
+	cell*=2;
+    } while (1);
+    if (!(own=malloc((long)nx*ny*sizeof(int)))) return 1;
+    for (k=0;k<nx*ny;k++) own[k]=-1;
+    for (k=0;k<num;k++) {
+	d[0]=c[k].a; d[1]=c[k].b;
+	for (s=0;s<2;s++) {
+	    if (!d[s]) continue;
+	    u0=(int)((d[s]->x0-x0)/cell); u1=(int)((d[s]->x1-x0)/cell);
+	    v0=(int)((d[s]->y0-y0)/cell); v1=(int)((d[s]->y1-y0)/cell);
+	    for (v=v0;v<=v1;v++)
+		for (u=u0;u<=u1;u++) {
+		    if (own[v*nx+u]<0) own[v*nx+u]=k;
+		    else c[diff_root(c,own[v*nx+u])].root=diff_root(c,k);
+		}
+	}
+    }
+    free(own);
+    for (k=0;k<num;k++) c[k].root=diff_root(c,k);
+    return 0;
+}
+
+/* outline of a box, grown by g */
+static void diff_box(FILE *f, diff_item *d, double g){
+    fprintf(f,"G01X%05dY%05dD02*X%05dY%05dD01*X%05dY%05dD01*"
+	    "X%05dY%05dD01*X%05dY%05dD01*\n",
+	    rnd(d->x0-g),rnd(d->y0-g),rnd(d->x1+g),rnd(d->y0-g),
+	    rnd(d->x1+g),rnd(d->y1+g),rnd(d->x0-g),rnd(d->y1+g),
+	    rnd(d->x0-g),rnd(d->y0-g));
+}
+/* overlay layer of the changes of job: added and moved items are filled,
+   the old places of removed and moved items outlined, moves are joined by
+   a line and each region gets a frame */
+static void diff_overlay(FILE *f, int job, diff_change *c, int num,
+			 diff_item *reg){
+    int k, x[4], y[4];
+    fprintf(f,"%%LNDIFF_%s*%%\n%%LPD*%%\n",
+	    file_interpretation[job][0]?file_interpretation[job]:"DRILL");
+    for (k=0;k<num;k++) {
+	if (!c[k].b) continue;
+	x[0]=x[3]=rnd(c[k].b->x0); x[1]=x[2]=rnd(c[k].b->x1);
+	y[0]=y[1]=rnd(c[k].b->y0); y[2]=y[3]=rnd(c[k].b->y1);
+	region_polygon(f,x,y,4);
+    }
+    fprintf(f,"G54D%02d*\n",line_aperture(2.0));
+    for (k=0;k<num;k++) {
+	if (!c[k].a) continue;
+	diff_box(f,c[k].a,0);
+	if (c[k].b)
+	    fprintf(f,"G01X%05dY%05dD02*X%05dY%05dD01*\n",
+		    c[k].a->rx,c[k].a->ry,c[k].b->rx,c[k].b->ry);
+    }
+    fprintf(f,"G54D%02d*\n",line_aperture(5.0));
+    for (k=0;k<num;k++)
+	if (c[k].root==k) diff_box(f,&reg[k],10.0);
+    fprintf(f,"D02*\n");
+}
+
+/* compares the drill and copper jobs of the source of c with those of
+   the old source c->diffname: the changes are reported on stderr and
+   drawn into root.diff.lgx. Returns 0 if the boards are the same, or an
+   error number. */
+static int diff_boards(x2g_context *c){
+    layer_image img[6];
+    diff_item *items[2][6], *r, *reg=NULL;
+    diff_change *ch[6];
+    int cnt[2][6], num[6], job, s, k, t[4], total=0, ret=0;
+    int knock=c->RS274Xmode, punch=c->Large_inner_insulation?1:0;
+    char root[MAXFILNAMLEN], name[MAXFILNAMLEN+10];
+    FILE *f;
+
+    memset(items,0,sizeof(items)); memset(ch,0,sizeof(ch));
+    memset(num,0,sizeof(num)); memset(img,0,sizeof(img));
+    /* new source first: x2g_convert has tokenized it. Both sources are
+       tokenized once, so the passes over their jobs do not parse again. */
+    for (s=1;s>=0 && !ret;s--) {
+	if (s==0) { /* the old one is always a file */
+	    body_free(); x2g_reset(c); x2g_cur=NULL;
+	    if (body_read(c->diffname)) ret=-17;
+	    else if (st->window_mode && window_select()) ret=-17;
+	}
+	if (!ret && copper_capture(img,s?c->sourcename:c->diffname,knock,
+				   punch)) ret=-17;
+	for (job=1;job<=5 && !ret;job++) {
+	    cnt[s][job]=img[job].num;
+	    if (!(items[s][job]=diff_items(&img[job]))) ret=-17;
+	    else qsort(items[s][job],cnt[s][job],sizeof(diff_item),
+		       diff_key_cmp);
+	}
+	copper_free(img);
+	x2g_cur=c;
+    }
+    for (job=1;job<=5 && !ret;job++) {
+	num[job]=diff_match(items[0][job],cnt[0][job],items[1][job],
+			    cnt[1][job],&ch[job]);
+	if (num[job]<0 || diff_cluster(ch[job],num[job])) {ret=-17; break;}
+	total+=num[job];
+    }
+    if (ret) goto done;
+
+    strncpy(root,c->outfilemode?c->outfileroot:c->sourcename,MAXFILNAMLEN-1);
+    root[MAXFILNAMLEN-1]=0;
+    if (!strncmp(root,"-",1)) strcpy(root,"stdin");
+    snprintf(name,sizeof(name),"%s.diff.lgx",root);
+    if (!(f=out_open(name,-1))) {ret=-39; goto done;}
+    st->stencil_defs=st->clear_defs=0;
+    RS274X_header_1(f,"REVISION_DIFF");
+    for (job=1;job<=5;job++) {
+	if (!num[job]) continue;
+	free(reg);
+	if (!(reg=malloc(num[job]*sizeof(diff_item)))) {ret=-17; break;}
+	t[DIFF_ADDED]=t[DIFF_REMOVED]=t[DIFF_MOVED]=0;
+	for (k=0;k<num[job];k++) { /* region boxes */
+	    reg[k].x0=1e30; reg[k].y0=1e30; reg[k].x1=-1e30; reg[k].y1=-1e30;
+	    reg[k].mark=0;
+	    t[ch[job][k].type]++;
+	}
+	for (k=0;k<num[job];k++) {
+	    r=&reg[ch[job][k].root]; r->mark++;
+	    for (s=0;s<2;s++) {
+		diff_item *d=s?ch[job][k].b:ch[job][k].a;
+		if (!d) continue;
+		if (d->x0<r->x0) r->x0=d->x0;
+		if (d->x1>r->x1) r->x1=d->x1;
+		if (d->y0<r->y0) r->y0=d->y0;
+		if (d->y1>r->y1) r->y1=d->y1;
+	    }
+	}
+	for (s=k=0;k<num[job];k++) s+=(ch[job][k].root==k);
+	fprintf(stderr,"DIFF %s: %d added, %d removed, %d moved in %d "
+		"region%s\n",suffixlist[job]+1,t[DIFF_ADDED],t[DIFF_REMOVED],
+		t[DIFF_MOVED],s,(s==1)?"":"s");
+	for (k=0;k<num[job];k++)
+	    if (ch[job][k].root==k)
+		fprintf(stderr,"DIFF %s: X%.3f Y%.3f to X%.3f Y%.3f, %d change%s\n",
+			suffixlist[job]+1,reg[k].x0/1000.0,reg[k].y0/1000.0,
+			reg[k].x1/1000.0,reg[k].y1/1000.0,reg[k].mark,
+			(reg[k].mark==1)?"":"s");
+	diff_overlay(f,job,ch[job],num[job],reg);
+    }
+    fprintf(f,"M02*\n");
+    if (out_close(f) && !ret) ret=-39;
+    fprintf(stderr,"DIFF: %d change%s\n",total,(total==1)?"":"s");
+ done:
+    free(reg);
+    for (job=1;job<=5;job++) {
+	free(items[0][job]); free(items[1][job]); free(ch[job]);
+    }
+    if (ret) return -ermsg(-ret);
+    return total?-ermsg(38):0;
+}
+
+/* routes of an object at depth for the stackup: entry 2*b is the dark
+   layer of inner layer b, 2*b+1 its clear stream. Returns their number. */
+static int stack_routes(int depth, int *route){
+    int b, n=0;
+
+    if (depth>=STACKBASE && (b=(depth-STACKBASE)/20)<st->stack_num) {
+	if ((depth-STACKBASE)%20) route[n++]=2*b;
+	else if (st->stack_knockout) route[n++]=2*b+1;
+    } else if (st->stack_transfer && (depth==15 || depth==16)) {
+	for (b=0;b<st->stack_num;b++) route[n++]=2*b;
+    } else if (st->stack_knockout && (depth==10 || depth==11)) {
+	for (b=0;b<st->stack_num;b++) route[n++]=2*b+1;
+    }
+    return n;
+}
+
+/* jobs of the stream an object of depth goes to: 2*k for the file of job
+   k, 2*k+1 for its punch content. Returns the number of routes. */
+static int stream_routes(int depth, int *route){
+    int k, n=0;
+    if (depth<0 || depth>=MAXDEPTH) return 0;
+    for (k=0;k<st->stream_num;k++) {
+	if (st->stream_tab[k].dark[depth]) route[n++]=2*k;
+	if (st->stream_tab[k].clear && st->stream_tab[k].knock[depth])
+	    route[n++]=2*k+1;
+    }
+    return n;
+}
+
+/* write num inner layers root.innerNN.lgx from depth 100 on in a single
+   pass. In RS274X mode the knockouts are collected in temporary files and
+   appended as clear layer afterwards. Returns 0 or an ermsg() code. */
+static int stackup_layers(char *sourcename, char *root, int num,
+			  int RS274Xmode, int transfer, int punchflag){
+    char name[MAXFILNAMLEN+20], title[20];
+    int list[20*MAXSTACK+5];
+    int b, c, n=0, ret=0, stitch=st->stitchmode;
+
+    for (b=0;b<20*num;b++) list[n++]=STACKBASE+b;
+    list[n++]=10; list[n++]=11; list[n++]=15; list[n++]=16; list[n]=-1;
+    memset(st->stack_layers,0,sizeof(st->stack_layers));
+    st->stencil_defs=0;
+    st->clear_defs=st->clear_mode && RS274Xmode; st->clear_class=1;
+    for (b=0;b<num;b++) {
+	snprintf(name,sizeof(name),"%s.inner%02d.lgx",root,b+1);
+	if (!(st->stack_layers[b].f=out_open(name,-1))) {ret=ermsg(4); goto done;}
+	if (RS274Xmode) {
+	    if (!(st->stack_layers[b].clear=tmpfile())) {ret=ermsg(4); goto done;}
+	    sprintf(title,"INNER%02d",b+1);
+	    RS274X_header_1(st->stack_layers[b].f,title);
+	} else {
+	    gerber_header(st->stack_layers[b].f);
+	}
+    }
+    if (!(st->infile=src_open(sourcename))) {ret=ermsg(3); goto done;}
+    if (fseek(st->infile,0L,SEEK_SET)) {
+	ret=ermsg(16);
+    } else {
+	/* joined paths and previews are kept per target: not here */
+	st->stack_num=num; st->stack_transfer=transfer;
+	st->stack_knockout=RS274Xmode; st->stack_punchflag=punchflag;
+	st->stitchmode=0; st->capture=NULL;
+	ret=do_parsing(list,2,st->stack_layers[0].f,0);
+	st->stack_num=0; st->stitchmode=stitch;
+    }
+    src_close(st->infile);
+    if (ret) goto done;
+
+    for (b=0;b<num;b++) {
+	if (RS274Xmode) {
+	    sprintf(title,"INNER%02d",b+1);
+	    RS274X_trailer_1(st->stack_layers[b].f);
+	    RS274X_header_2(st->stack_layers[b].f,title);
+	    rewind(st->stack_layers[b].clear);
+	    while ((c=getc(st->stack_layers[b].clear))!=EOF)
+		putc(c,st->stack_layers[b].f);
+	    RS274X_trailer_2(st->stack_layers[b].f);
+	} else {
+	    gerber_trailer(st->stack_layers[b].f);
+	}
+    }
+ done:
+    for (b=0;b<num;b++) {
+	if (st->stack_layers[b].f && out_close(st->stack_layers[b].f) && !ret)
+	    ret=ermsg(8);
+	if (st->stack_layers[b].clear) fclose(st->stack_layers[b].clear);
+    }
+    return ret;
+}
+
+static unsigned long long fp_hash(const void *p, size_t n,
+				  unsigned long long h){
+    const unsigned char *c=p;
+    while (n--) {h^=*c++; h*=1099511628211ULL;} /* FNV-1a */
+    return h;
+}
+
+/* hash of one object of a footprint with its points and text */
+static unsigned long long fp_obj_hash(footprint *fp, fp_object *o){
+    unsigned long long h;
+    h=fp_hash(&o->ob,sizeof(obstruct),14695981039346656037ULL);
+    h=fp_hash(fp->pts+2*o->pts,2*o->npts*sizeof(int),h);
+    if (o->text>=0) h=fp_hash(fp->text+o->text,strlen(fp->text+o->text),h);
+    return h;
+}
+
+/* move the coordinates of a cached object by dx,dy */
+static void fp_shift(fp_object *o, int *pts, int dx, int dy){
+    int k;
+    switch (o->ob.class) {
+	case 1: case 4: /* circles, text */
+	    o->ob.cx1+=dx; o->ob.cx2+=dy;
+	    break;
+	case 5: /* arcs */
+	    o->ob.ax1+=dx; o->ob.ax2+=dy; o->ob.mx1+=dx; o->ob.mx2+=dy;
+	    o->ob.ex1+=dx; o->ob.ex2+=dy;
+	    o->ob.fx1+=dx; o->ob.fx2+=dy;
+	    o->ob.cx1=(int)o->ob.fx1; o->ob.cx2=(int)o->ob.fx2;
+	    break;
+    }
+    for (k=0;k<o->npts;k++) {pts[2*k]+=dx; pts[2*k+1]+=dy;}
+}
+
+/* read the objects of a footprint from infile into fp: from a library
+   fig up to its end, or from the board up to the end of the top level
+   compound whose header was just read; end is the position after it.
+   Objects which cannot be cached (splines, pictures, arrows, comments
+   for nets) are left out. Returns 0, 1 if some were left out, -1 without
+   memory. */
+static int fp_collect(footprint *fp, int *max, int board, long *end){
+    fp_object *o;
+    obstruct ob;
+    char *t;
+    int level=board?1:0, ret=0, k, n;
+
+    while (fgets(st->inbuffer,10000,st->infile)) {
+	if (st->inbuffer[0]=='#') {
+	    if (board) ret=1;
+	    continue;
+	}
+	if (st->inbuffer[0]=='\n' || st->inbuffer[0]==' ' || st->inbuffer[0]=='\t')
+	    continue;
+	memset(&ob,0,sizeof(ob));
+	sscanf(st->inbuffer,"%d",&ob.class);
+	if (ob.class==6) {level++; continue;}
+	if (ob.class==-6) {
+	    if (--level==0 && board) break;
+	    continue;
+	}
+	if (ob.class==0) continue; /* color definitions */
+	if (ob.class==3 || parse_object(&ob,st->inbuffer) ||
+	    (ob.class==2 && (ob.type==5 || ob.int14 || ob.int15))) {
+	    ret=1;
+	    continue;
+	}
+	if (flat_grow(&fp->obj,&max[0],fp->nobj+1,sizeof(fp_object)))
+	    return -1;
+	o=&fp->obj[fp->nobj++];
+	memset(o,0,sizeof(*o));
+	o->ob=ob; o->pts=fp->npts; o->text=-1;
+	if (ob.class==2) {
+	    n=ob.int16;
+	    if (flat_grow(&fp->pts,&max[1],2*(fp->npts+n),sizeof(int)))
+		return -1;
+	    st->varp=NULL;
+	    for (k=0;k<n;k++) getpair(&fp->pts[2*fp->npts+2*k],
+				      &fp->pts[2*fp->npts+2*k+1]);
+	    o->npts=n; fp->npts+=n;
+	}
+	if (ob.class==4 && st->ibb) { /* keep the text */
+	    t=st->ibb; n=strlen(t)+1;
+	    if (flat_grow(&fp->text,&max[2],fp->ntext+n,1)) return -1;
+	    memcpy(fp->text+fp->ntext,t,n);
+	    o->text=fp->ntext; fp->ntext+=n;
+	}
+	for (k=1;k<6;k++) { /* classification for each file type */
+	    int list[2]={ob.depth,-1};
+	    o->kind[k]=whattodo(&ob,list,k);
+	}
+    }
+    *end=ftell(st->infile);
+    return ret;
+}
+
+/* move a footprint to the origin of its extent, which is returned in
+   dx,dy, and hash it independent of the object order */
+static void fp_normalize(footprint *fp, int *dx, int *dy){
+    fp_object *o;
+    int k, m, x=INT_MAX, y=INT_MAX;
+
+    for (k=0;k<fp->nobj;k++) {
+	o=&fp->obj[k];
+	if (o->ob.class==1 || o->ob.class==4) {
+	    if (o->ob.cx1<x) x=o->ob.cx1;
+	    if (o->ob.cx2<y) y=o->ob.cx2;
+	}
+	if (o->ob.class==5) {
+	    if (o->ob.ax1<x) x=o->ob.ax1;
+	    if (o->ob.ax2<y) y=o->ob.ax2;
+	    if (o->ob.ex1<x) x=o->ob.ex1;
+	    if (o->ob.ex2<y) y=o->ob.ex2;
+	}
+	for (m=0;m<o->npts;m++) {
+	    if (fp->pts[2*(o->pts+m)]<x) x=fp->pts[2*(o->pts+m)];
+	    if (fp->pts[2*(o->pts+m)+1]<y) y=fp->pts[2*(o->pts+m)+1];
+	}
+    }
+    if (!fp->nobj) x=y=0;
+    fp->hash=fp->nobj;
+    for (k=0;k<fp->nobj;k++) {
+	o=&fp->obj[k];
+	fp_shift(o,fp->pts+2*o->pts,-x,-y);
+	fp->hash+=fp_obj_hash(fp,o);
+    }
+    *dx=x; *dy=y;
+}
+
+typedef struct {unsigned long long h; int k;} fp_key;
+static int fp_key_cmp(const void *a, const void *b){
+    const fp_key *p=a, *q=b;
+    if (p->h!=q->h) return (p->h<q->h)?-1:1;
+    return p->k-q->k;
+}
+/* keys of the objects of fp, sorted by their hash; NULL without memory */
+static fp_key *fp_keys(footprint *fp){
+    fp_key *key=malloc((fp->nobj?fp->nobj:1)*sizeof(fp_key));
+    int k;
+    if (!key) return NULL;
+    for (k=0;k<fp->nobj;k++) {
+	key[k].h=fp_obj_hash(fp,&fp->obj[k]); key[k].k=k;
+    }
+    qsort(key,fp->nobj,sizeof(fp_key),fp_key_cmp);
+    return key;
+}
+/* nonzero if the normalized footprints a and b have the same members in
+   any order; the sum of the hashes alone may collide */
+static int fp_same(footprint *a, footprint *b){
+    fp_key *ka, *kb;
+    fp_object *p, *q;
+    int k, same=0;
+
+    if (a->nobj!=b->nobj || a->npts!=b->npts) return 0;
+    ka=fp_keys(a); kb=fp_keys(b);
+    if (!ka || !kb) goto done;
+    for (k=0;k<a->nobj;k++) {
+	p=&a->obj[ka[k].k]; q=&b->obj[kb[k].k];
+	if (ka[k].h!=kb[k].h || memcmp(&p->ob,&q->ob,sizeof(obstruct)) ||
+	    p->npts!=q->npts || (p->text<0)!=(q->text<0) ||
+	    memcmp(a->pts+2*p->pts,b->pts+2*q->pts,2*p->npts*sizeof(int)) ||
+	    (p->text>=0 && strcmp(a->text+p->text,b->text+q->text))) break;
+    }
+    same=(k==a->nobj);
+ done:
+    free(ka); free(kb);
+    return same;
+}
+
+/* index of the entry in fp_places for the top level compound at pos,
+   whose header line was just read; -1 if it is no cached footprint. The
+   members are looked at only the first time: a footprint of the same
+   hash is compared with them before the match is recorded. The position
+   of infile is kept unless there is a match. */
+static int fp_place_of(long pos){
+    footprint f;
+    fp_place *p;
+    long back=ftell(st->infile), end;
+    int lo=0, hi=st->fp_place_num, mid, k, r, max[3]={0,0,0}, dx=0, dy=0, m=-1;
+
+    while (lo<hi) {
+	mid=(lo+hi)/2;
+	if (st->fp_places[mid].pos==pos) return st->fp_places[mid].fp>=0?mid:-1;
+	if (st->fp_places[mid].pos<pos) lo=mid+1; else hi=mid;
+    }
+    memset(&f,0,sizeof(f));
+    r=fp_collect(&f,max,1,&end);
+    if (r==0 && f.nobj) {
+	fp_normalize(&f,&dx,&dy);
+	for (k=0;k<st->fp_num;k++) {
+	    if (st->fp_tag[0] && strcmp(st->fp_lib[k].name,st->fp_tag)) continue;
+	    if (st->fp_lib[k].hash==f.hash && fp_same(&st->fp_lib[k],&f)) {
+		m=k; break;
+	    }
+	}
+    }
+    if (m<0 && st->fp_tag[0])
+	fprintf(stderr,"Footprint %s differs from the library, parsed from "
+		"the source.\n",st->fp_tag);
+    free(f.obj); free(f.pts); free(f.text);
+    if (r<0 || flat_grow(&st->fp_places,&st->fp_place_max,st->fp_place_num+1,
+			 sizeof(fp_place))) m=-1;
+    else {
+	p=&st->fp_places[lo];
+	memmove(p+1,p,(st->fp_place_num-lo)*sizeof(fp_place));
+	st->fp_place_num++;
+	p->pos=pos; p->end=end; p->fp=m; p->dx=dx; p->dy=dy;
+    }
+    if (m<0) {fseek(st->infile,back,SEEK_SET); return -1;}
+    return lo;
+}
+
+/* next object of the footprint being spliced, moved into place; its
+   points are served to getpair */
+static int fp_load(obstruct *o){
+    fp_object c=st->fp_cur->obj[st->fp_next++];
+    int *pts=st->fp_cur->pts+2*c.pts;
+
+    if (flat_grow(&st->fp_buf,&st->fp_buf_max,2*c.npts+2,sizeof(int))) return 1;
+    memcpy(st->fp_buf,pts,2*c.npts*sizeof(int));
+    fp_shift(&c,st->fp_buf,st->fp_dx,st->fp_dy);
+    *o=c.ob;
+    st->fp_pts=c.npts?st->fp_buf:NULL;
+    st->ibb=(c.text>=0)?st->fp_cur->text+c.text:NULL;
+    return 0;
+}
+
+#ifndef X2G_LIBRARY
+/* compile the library figs in files into the footprint cache name.
+   Returns 0 or an ermsg() code. */
+static int fp_compile(char *name, int num, char **files){
+    FILE *f;
+    footprint fp;
+    char *b;
+    int k, n, r, max[3], dx, dy, written=0;
+    long end;
+
+    if (!(f=fopen(name,"wb"))) return ermsg(4);
+    n=sizeof(obstruct);
+    fwrite(FP_MAGIC,1,8,f); fwrite(&n,sizeof(int),1,f);
+    fwrite(&written,sizeof(int),1,f); /* number of entries, see below */
+    for (k=0;k<num;k++) {
+	if (!(st->infile=fopen(files[k],"r"))) {fclose(f); return ermsg(3);}
+	if (fgets(st->inbuffer,10000,st->infile)==NULL ||
+	    strncmp(st->inbuffer,"#FIG 3.2",8)) {
+	    fclose(st->infile); fclose(f); return ermsg(7);
+	}
+	for (n=0;n<8;n++) if (!fgets(st->inbuffer,10000,st->infile)) break;
+	memset(&fp,0,sizeof(fp)); max[0]=max[1]=max[2]=0;
+	r=fp_collect(&fp,max,0,&end);
+	fclose(st->infile);
+	if (r<0) {fclose(f); return ermsg(17);}
+	if (r>0 || !fp.nobj) {
+	    fprintf(stderr,"%s: not cached, it has objects which can only be "
+		    "parsed from the source.\n",files[k]);
+	} else {
+	    fp_normalize(&fp,&dx,&dy);
+	    b=strrchr(files[k],'/'); b=b?b+1:files[k];
+	    strncpy(fp.name,b,FP_NAMELEN-1); fp.name[FP_NAMELEN-1]=0;
+	    if ((b=strstr(fp.name,".fig")) && !b[4]) *b=0;
+	    fwrite(fp.name,1,FP_NAMELEN,f);
+	    fwrite(&fp.hash,sizeof(fp.hash),1,f);
+	    fwrite(&fp.nobj,sizeof(int),3,f); /* nobj, npts, ntext */
+	    fwrite(fp.obj,sizeof(fp_object),fp.nobj,f);
+	    fwrite(fp.pts,sizeof(int),2*fp.npts,f);
+	    fwrite(fp.text,1,fp.ntext,f);
+	    written++;
+	}
+	free(fp.obj); free(fp.pts); free(fp.text);
+    }
+    if (fseek(f,8+sizeof(int),SEEK_SET) ||
+	fwrite(&written,sizeof(int),1,f)!=1) {fclose(f); return ermsg(8);}
+    if (fclose(f)) return ermsg(8);
+    return 0;
+}
+#endif
+
+/* load a footprint cache made with fp_compile. Returns 0 or 1 on error. */
+static int fp_read(char *name){
+    FILE *f;
+    footprint *fp;
+    char magic[8];
+    int n, num, k;
+
+    if (!(f=fopen(name,"rb"))) return 1;
+    if (fread(magic,1,8,f)!=8 || memcmp(magic,FP_MAGIC,8) ||
+	fread(&n,sizeof(int),1,f)!=1 || n!=sizeof(obstruct) ||
+	fread(&num,sizeof(int),1,f)!=1 || num<0 ||
+	!(fp=realloc(st->fp_lib,(st->fp_num+num)*sizeof(footprint)+1))) {
+	fclose(f); return 1;
+    }
+    st->fp_lib=fp;
+    for (k=0;k<num;k++) {
+	fp=&st->fp_lib[st->fp_num];
+	memset(fp,0,sizeof(*fp));
+	if (fread(fp->name,1,FP_NAMELEN,f)!=FP_NAMELEN ||
+	    fread(&fp->hash,sizeof(fp->hash),1,f)!=1 ||
+	    fread(&fp->nobj,sizeof(int),3,f)!=3 ||
+	    fp->nobj<0 || fp->npts<0 || fp->ntext<0) break;
+	fp->obj=malloc(fp->nobj*sizeof(fp_object)+1);
+	fp->pts=malloc(2*fp->npts*sizeof(int)+1);
+	fp->text=malloc(fp->ntext+1);
+	if (!fp->obj || !fp->pts || !fp->text ||
+	    fread(fp->obj,sizeof(fp_object),fp->nobj,f)!=fp->nobj ||
+	    fread(fp->pts,sizeof(int),2*fp->npts,f)!=2*fp->npts ||
+	    fread(fp->text,1,fp->ntext,f)!=fp->ntext) {
+	    free(fp->obj); free(fp->pts); free(fp->text);
+	    break;
+	}
+	fp->name[FP_NAMELEN-1]=0;
+	st->fp_num++;
+    }
+    fclose(f);
+    return k<num;
+}
+
+/* output streams to a callback sink: data is handed on as it is written,
+   and a call without data marks the end of the file */
+static ssize_t out_cookie_write(void *cookie, const char *buf, size_t len){
+    out_entry *e=cookie;
+    if (e->sink.fn(e->sink.user,e->name,buf,len)) return -1;
+    return len;
+}
+
+static int out_cookie_close(void *cookie){
+    out_entry *e=cookie;
+    return e->sink.fn(e->sink.user,e->name,NULL,0)?-1:0;
+}
+
+static void bundle_put(const void *p, size_t n){
+    fwrite(p,1,n,st->bundle_f);
+    st->bundle_pos+=n;
+}
+
+/* little endian fields of zip headers */
+static void put_le(unsigned char *p, unsigned long v, int n){
+    for (;n--;v>>=8) *p++=v&255;
+}
+
+/* crc table, made once for all contexts */
+static unsigned long crc_tab[256];
+static pthread_once_t crc_once=PTHREAD_ONCE_INIT;
+static void crc32_table(void){
+    unsigned long c;
+    int k, j;
+    for (k=0;k<256;k++) {
+	for (c=k,j=0;j<8;j++) c=(c&1)?0xedb88320UL^(c>>1):c>>1;
+	crc_tab[k]=c;
+    }
+}
+static unsigned long crc32_update(unsigned long crc, const char *p,
+				  size_t n){
+    pthread_once(&crc_once,crc32_table);
+    crc^=0xffffffffUL;
+    while (n--) crc=crc_tab[(crc^(unsigned char)*p++)&255]^(crc>>8);
+    return crc^0xffffffffUL;
+}
+
+/* new member for the output file name of job; its role is the layer
+   for jobs and found from the name for reports */
+static int bundle_add(char *name, int job){
+    static char *roles[][2]={{".pbm","PREVIEW"},{".netlist.","NETLIST"},
+	{".placement.","PLACEMENT"},{".inner","INNER_LAYER"},
+	{".holes.","DRILL"},{".tools.","TOOL_LIST"},{".outline.","ROUT"}};
+    bundle_member *b;
+    char *base=strrchr(name,'/');
+    int k;
+
+    if (st->bundle_num==st->bundle_max) {
+	b=realloc(st->bundle_dir,(st->bundle_max+32)*sizeof(bundle_member));
+	if (!b) return -1;
+	st->bundle_dir=b; st->bundle_max+=32;
+    }
+    b=&st->bundle_dir[st->bundle_num];
+    memset(b,0,sizeof(bundle_member));
+    strncpy(b->name,base?base+1:name,MAXFILNAMLEN-1);
+    b->role="OTHER";
+    if (job>=0 && job<X2G_JOBS && file_interpretation[job][0])
+	b->role=file_interpretation[job];
+    else for (k=0;k<7;k++) if (strstr(b->name,roles[k][0])) {
+	b->role=roles[k][1]; break;
+    }
+    return st->bundle_num++;
+}
+
+/* time and date of the bundle in the DOS format of zip headers */
+static void zip_time(unsigned char *p){
+    struct tm t;
+    localtime_r(&st->bundle_time,&t);
+    put_le(p,(t.tm_hour<<11)|(t.tm_min<<5)|(t.tm_sec/2),2);
+    put_le(p+2,((t.tm_year-80)<<9)|((t.tm_mon+1)<<5)|t.tm_mday,2);
+}
+
+/* zip local header; with flags 8 crc and sizes follow the data */
+static void zip_local(bundle_member *b, int flags){
+    unsigned char h[30];
+    size_t n=strlen(b->name);
+
+    b->offset=st->bundle_pos; b->flags=flags;
+    put_le(h,0x04034b50UL,4); put_le(h+4,20,2); put_le(h+6,flags,2);
+    put_le(h+8,0,2); /* stored */
+    zip_time(h+10);
+    put_le(h+14,flags?0:b->crc,4);
+    put_le(h+18,flags?0:b->size,4); put_le(h+22,flags?0:b->size,4);
+    put_le(h+26,n,2); put_le(h+28,0,2);
+    bundle_put(h,30); bundle_put(b->name,n);
+}
+
+static void zip_descriptor(bundle_member *b){
+    unsigned char h[16];
+    put_le(h,0x08074b50UL,4); put_le(h+4,b->crc,4);
+    put_le(h+8,b->size,4); put_le(h+12,b->size,4);
+    bundle_put(h,16);
+    b->state=2;
+}
+
+static ssize_t bundle_cookie_write(void *cookie, const char *buf,
+				   size_t len){
+    bundle_member *b=&st->bundle_dir[((out_entry *)cookie)->member];
+    b->crc=crc32_update(b->crc,buf,len);
+    b->size+=len;
+    bundle_put(buf,len);
+    return ferror(st->bundle_f)?-1:len;
+}
+
+/* write the complete member k kept in memory */
+static void bundle_write(int k){
+    static char zero[512];
+    bundle_member *b=&st->bundle_dir[k];
+    char h[512];
+    unsigned int sum;
+    int j;
+
+    b->crc=crc32_update(0,b->buf,b->size);
+    if (st->bundle_zip) {
+	zip_local(b,0);
+    } else { /* ustar header */
+	memset(h,0,sizeof(h));
+	j=strlen(b->name);
+	memcpy(h,b->name,j<100?j:99);
+	sprintf(h+100,"%07o",0644); sprintf(h+108,"%07o",0);
+	sprintf(h+116,"%07o",0); sprintf(h+124,"%011lo",b->size);
+	sprintf(h+136,"%011lo",(unsigned long)st->bundle_time);
+	memset(h+148,' ',8); h[156]='0';
+	memcpy(h+257,"ustar",6); memcpy(h+263,"00",2);
+	for (sum=0,j=0;j<512;j++) sum+=(unsigned char)h[j];
+	sprintf(h+148,"%06o",sum); h[155]=' ';
+	b->offset=st->bundle_pos;
+	bundle_put(h,512);
+    }
+    bundle_put(b->buf,b->size);
+    if (!st->bundle_zip && b->size%512) bundle_put(zero,512-b->size%512);
+    free(b->buf); b->buf=NULL;
+    b->state=2;
+}
+
+/* start the archive name, or a tar on stdout for "-" */
+static int bundle_open(char *name){
+    size_t n=strlen(name);
+    FILE *f;
+
+    if (!strcmp(name,"-")) f=stdout;
+    else if (!(f=out_open(name,-1))) return 1;
+    st->bundle_zip=(n>4 && !strcmp(name+n-4,".zip"));
+    st->bundle_pos=0; st->bundle_num=0; st->bundle_stream=-1;
+    st->bundle_time=time(NULL);
+    st->bundle_f=f;
+    return 0;
+}
+
+/* finish the archive with the manifest and the zip directory, or drop it
+   when the conversion failed. Returns 0 or 1 on error. */
+static int bundle_close(int failed){
+    static char zero[1024];
+    FILE *f=st->bundle_f, *m;
+    unsigned char h[46];
+    unsigned long start;
+    int k, j, ret=0;
+    size_t n;
+
+    for (k=0;k<MAXOUTOPEN;k++) /* left open by a failed job */
+	if (st->out_tab[k].f && st->out_tab[k].sink.kind==X2G_SINK_BUNDLE) {
+	    fclose(st->out_tab[k].f); st->out_tab[k].f=NULL; free(st->out_tab[k].buf);
+	    failed=1;
+	}
+    for (k=0;k<st->bundle_num;k++) free(st->bundle_dir[k].buf);
+    if (failed) goto done;
+    if ((k=bundle_add("manifest.txt",-1))<0 ||
+	!(m=open_memstream(&st->bundle_dir[k].buf,&st->bundle_dir[k].size))) {
+	failed=1; goto done;
+    }
+    st->bundle_dir[k].role="MANIFEST";
+    fprintf(m,"# file role bytes crc32\n");
+    for (j=0;j<k;j++)
+	fprintf(m,"%s %s %lu %08lx\n",st->bundle_dir[j].name,
+		st->bundle_dir[j].role,st->bundle_dir[j].size,st->bundle_dir[j].crc);
+    if (fclose(m)) {failed=1; goto done;}
+    bundle_write(k);
+    if (!st->bundle_zip) { /* two empty blocks end a tar */
+	bundle_put(zero,1024);
+	goto done;
+    }
+    start=st->bundle_pos; /* central directory */
+    for (k=0;k<st->bundle_num;k++) {
+	n=strlen(st->bundle_dir[k].name);
+	put_le(h,0x02014b50UL,4); put_le(h+4,0x0314,2); /* made on unix */
+	put_le(h+6,20,2); put_le(h+8,st->bundle_dir[k].flags,2);
+	put_le(h+10,0,2); zip_time(h+12);
+	put_le(h+16,st->bundle_dir[k].crc,4);
+	put_le(h+20,st->bundle_dir[k].size,4); put_le(h+24,st->bundle_dir[k].size,4);
+	put_le(h+28,n,2); memset(h+30,0,8);
+	put_le(h+38,0100644UL<<16,4); put_le(h+42,st->bundle_dir[k].offset,4);
+	bundle_put(h,46); bundle_put(st->bundle_dir[k].name,n);
+    }
+    put_le(h,0x06054b50UL,4); put_le(h+4,0,4);
+    put_le(h+8,st->bundle_num,2); put_le(h+10,st->bundle_num,2);
+    put_le(h+12,st->bundle_pos-start,4); put_le(h+16,start,4);
+    put_le(h+20,0,2);
+    bundle_put(h,22);
+ done:
+    free(st->bundle_dir); st->bundle_dir=NULL; st->bundle_num=st->bundle_max=0;
+    st->bundle_f=NULL;
+    if (f==stdout) ret=fflush(f) || ferror(f);
+    else if (failed) out_discard(f);
+    else ret=out_close(f);
+    return failed || ret;
+}
+
+/* drop an output file that could not be completed */
+static void out_discard(FILE *f){
+    out_entry *e;
+    int k;
+
+    for (k=0;k<MAXOUTOPEN && st->out_tab[k].f!=f;k++);
+    fclose(f);
+    if (k==MAXOUTOPEN) return;
+    e=&st->out_tab[k];
+    e->f=NULL;
+    if (e->sink.kind==X2G_SINK_MEMORY) free(e->buf);
+    else if (e->sink.kind==X2G_SINK_FILE) unlink(e->tmp);
+}
+
+/* open the output file name of job (-1 for reports) on the sink the
+   current context has for it. Files are written under a temporary name. */
+static FILE *out_open(char *name, int job){
+    cookie_io_functions_t io={NULL,out_cookie_write,NULL,out_cookie_close};
+    cookie_io_functions_t bio={NULL,bundle_cookie_write,NULL,NULL};
+    out_entry *e;
+    int k, fd;
+
+    for (k=0;k<MAXOUTOPEN && st->out_tab[k].f;k++);
+    if (k==MAXOUTOPEN) return NULL;
+    e=&st->out_tab[k];
+    strncpy(e->name,name,sizeof(e->name)-1); e->name[sizeof(e->name)-1]=0;
+    memset(&e->sink,0,sizeof(e->sink));
+    if (x2g_cur) {
+	e->sink=x2g_cur->sinks[0];
+	if (job>=0 && job<X2G_JOBS && x2g_cur->sinks[job+1].kind!=X2G_SINK_FILE)
+	    e->sink=x2g_cur->sinks[job+1];
+    }
+    if (st->bundle_f && e->sink.kind==X2G_SINK_FILE)
+	e->sink.kind=X2G_SINK_BUNDLE;
+    e->buf=NULL; e->size=0;
+    switch (e->sink.kind) {
+	case X2G_SINK_BUNDLE:
+	    if ((e->member=bundle_add(name,job))<0) return NULL;
+	    if (st->bundle_zip && st->bundle_stream<0) { /* straight into the zip */
+		st->bundle_stream=e->member;
+		zip_local(&st->bundle_dir[e->member],8);
+		e->f=fopencookie(e,"w",bio);
+	    } else {
+		e->f=open_memstream(&e->buf,&e->size);
+	    }
+	    break;
+	case X2G_SINK_MEMORY:
+	    e->f=open_memstream(&e->buf,&e->size);
+	    break;
+	case X2G_SINK_FD:
+	    if ((fd=dup(e->sink.fd))<0) return NULL;
+	    if (!(e->f=fdopen(fd,"w"))) close(fd);
+	    break;
+	case X2G_SINK_CALLBACK:
+	    e->f=fopencookie(e,"w",io);
+	    break;
+	default:
+	    snprintf(e->tmp,sizeof(e->tmp),"%s.%d.tmp",name,(int)getpid());
+	    e->f=fopen(e->tmp,"w");
+    }
+    return e->f;
+}
+
+/* close an output file and move it into place, or keep a memory output
+   with the context. Returns 0 or 1 on error, when a file is left as it
+   was. */
+static int out_close(FILE *f){
+    out_entry *e;
+    out_memory *m;
+    bundle_member *b;
+    int k, ret;
+
+    for (k=0;k<MAXOUTOPEN && st->out_tab[k].f!=f;k++);
+    if (k==MAXOUTOPEN) return fclose(f)?1:0;
+    e=&st->out_tab[k];
+    e->f=NULL;
+    ret=ferror(f) | fclose(f);
+    switch (e->sink.kind) {
+	case X2G_SINK_MEMORY:
+	    for (k=0;k<x2g_cur->mem_num;k++) /* a rerun replaces it */
+		if (!strcmp(x2g_cur->mem[k].name,e->name)) break;
+	    if (!ret && k==x2g_cur->mem_num) {
+		m=realloc(x2g_cur->mem,(k+1)*sizeof(out_memory));
+		if (m) {
+		    x2g_cur->mem=m; m[k].name=strdup(e->name); m[k].data=NULL;
+		}
+		if (!m || !m[k].name) ret=1; else x2g_cur->mem_num++;
+	    }
+	    if (ret) {free(e->buf); return ret;}
+	    m=&x2g_cur->mem[k];
+	    free(m->data); m->data=e->buf; m->len=e->size;
+	    return 0;
+	case X2G_SINK_FD: case X2G_SINK_CALLBACK:
+	    return ret?1:0;
+	case X2G_SINK_BUNDLE:
+	    b=&st->bundle_dir[e->member];
+	    if (e->member==st->bundle_stream) {
+		st->bundle_stream=-1;
+		if (!ret) zip_descriptor(b);
+		for (k=0;k<st->bundle_num;k++) /* files that waited for it */
+		    if (st->bundle_dir[k].state==1) bundle_write(k);
+	    } else if (!ret) {
+		b->buf=e->buf; b->size=e->size; b->state=1;
+		if (st->bundle_stream<0) bundle_write(e->member);
+	    } else {
+		free(e->buf);
+	    }
+	    return ret?1:0;
+    }
+    ret=ret || rename(e->tmp,e->name);
+    if (ret) unlink(e->tmp);
+    return ret;
+}
+
+/* parallel tokenizer (--parallel) */
+typedef struct {
+    char *buf; long beg, end; /* the chunk is buf[beg..end) */
+    body_entry *ent; int nent, maxent;
+    int *pts; int npts, maxpts;
+    char *text; int ntext, maxtext;
+    int err;
+} body_chunk;
+
+/* length of the next line at p as fgets with 10000 bytes would read it */
+static long body_line(char *buf, long p, long end, int size){
+    char *q=memchr(buf+p,'\n',end-p);
+    long n=q?q-buf-p+1:end-p;
+    return (n>size-1)?size-1:n;
+}
+
+static int body_addtext(body_chunk *c, char *t){
+    int n=strlen(t)+1;
+    if (flat_grow(&c->text,&c->maxtext,c->ntext+n,1)) return -1;
+    memcpy(c->text+c->ntext,t,n);
+    c->ntext+=n;
+    return c->ntext-n;
+}
+
+/* tokenize the lines of a chunk, as do_parsing() and getpair() would */
+static void *body_scan(void *arg){
+    body_chunk *c=arg;
+    body_entry *e=NULL;
+    char line[10000], *t, *sp;
+    long p=c->beg, n;
+    int x, bad=0, need=0;
+
+    for (;p<c->end && !c->err;p+=n) {
+	n=body_line(c->buf,p,c->end,10000);
+	memcpy(line,c->buf+p,n); line[n]=0;
+	if (line[0]==' ' || line[0]=='\t') { /* points of a line object */
+	    if (!e || bad || need<=0) continue;
+	    if (n>999) {bad=1; continue;}
+	    for (t=strtok_r(line," \t",&sp);t && need>0;
+		 t=strtok_r(NULL," \t",&sp)) {
+		if (sscanf(t,"%d",&x)!=1) {bad=1; break;}
+		if (flat_grow(&c->pts,&c->maxpts,c->npts+1,sizeof(int)))
+		    {c->err=1; break;}
+		c->pts[c->npts++]=x; need--; e->npts++;
+	    }
+	    continue;
+	}
+	if (e && (bad || need>0)) e->npts=-1; /* left to the file */
+	e=NULL; bad=0; need=0;
+	if (line[0]=='#' && strncmp(line,"# net ",6) &&
+	    strncmp(line,"# footprint ",12)) continue;
+	if (flat_grow(&c->ent,&c->maxent,c->nent+1,sizeof(body_entry)))
+	    {c->err=1; break;}
+	e=&c->ent[c->nent++];
+	memset(e,0,sizeof(*e));
+	e->pos=p; e->cont=p+n; e->text=-1; e->pts=c->npts;
+	if (line[0]=='\n') {e->kind=BODY_BLANK; e=NULL; continue;}
+	if (line[0]=='#') {
+	    e->kind=BODY_COMMENT;
+	    if ((e->text=body_addtext(c,line))<0) c->err=1;
+	    e=NULL;
+	    continue;
+	}
+	e->kind=BODY_OBJECT;
+	sscanf(line,"%d",&e->ob.class);
+	if (e->ob.class==6) /* corners of a compound, for the window */
+	    sscanf(line,"%*d %d %d %d %d",&e->ob.cx1,&e->ob.cx2,
+		   &e->ob.ex1,&e->ob.ex2);
+	parse_object_r(&e->ob,line,&t);
+	if (e->ob.class==4 && t && (e->text=body_addtext(c,t))<0) c->err=1;
+	if (e->ob.class==2) need=2*e->ob.int16;
+	else e=NULL;
+    }
+    if (e && (bad || need>0)) e->npts=-1;
+    return NULL;
+}
+
+/* read the source and tokenize its body on all cores into body_tab.
+   Returns 0 or an ermsg() code; a source on stdin is left to do_parsing. */
+static int body_read(char *sourcename){
+    FILE *f;
+    body_chunk ch[16];
+    pthread_t th[16];
+    char *buf=NULL;
+    long len=0, max=0, p=0, q;
+    int k, n, nth, started=0, ret=0, pts=0, text=0;
+
+    if (!(x2g_cur && x2g_cur->src_data) && !strncmp(sourcename,"-",1))
+	return 0;
+    if (!(f=src_open(sourcename))) return ermsg(3);
+    do {
+	if (len+65536>max &&
+	    !(buf=realloc(buf,max=2*max+65536))) {src_close(f); return ermsg(17);}
+	len+=fread(buf+len,1,max-len,f);
+    } while (!feof(f) && !ferror(f));
+    src_close(f);
+    for (k=0;k<9 && p<len;k++) p+=body_line(buf,p,len,10000); /* header */
+    nth=sysconf(_SC_NPROCESSORS_ONLN);
+    if (nth<1) nth=1;
+    if (nth>16) nth=16;
+    if (len-p<nth*65536L) nth=(len-p)/65536+1;
+    memset(ch,0,sizeof(ch));
+    for (k=0;k<nth;k++) { /* chunks start at an object or comment */
+	ch[k].buf=buf; ch[k].beg=p;
+	q=(k==nth-1)?len:p+(len-p)/(nth-k);
+	while (q<len && q>p && buf[q-1]!='\n') q++;
+	while (q<len && (buf[q]==' ' || buf[q]=='\t')) {
+	    char *e=memchr(buf+q,'\n',len-q);
+	    q=e?e-buf+1:len;
+	}
+	ch[k].end=p=q;
+    }
+    for (k=0;k<nth;k++)
+	if (pthread_create(&th[k],NULL,body_scan,&ch[k])) break;
+    started=k;
+    for (;k<nth;k++) body_scan(&ch[k]);
+    for (k=0;k<started;k++) pthread_join(th[k],NULL);
+    free(buf);
+    body_free();
+    for (k=0;k<nth;k++) {
+	ret|=ch[k].err;
+	st->body_num+=ch[k].nent; pts+=ch[k].npts; text+=ch[k].ntext;
+    }
+    if (!ret) {
+	st->body_tab=malloc((st->body_num+1)*sizeof(body_entry));
+	st->body_pts=malloc((pts+1)*sizeof(int));
+	st->body_text=malloc(text+1);
+	ret=!st->body_tab || !st->body_pts || !st->body_text;
+    }
+    for (n=0,pts=text=0,k=0;k<nth;k++) { /* join in file order */
+	if (!ret) {
+	    body_entry *e=st->body_tab+n;
+	    memcpy(e,ch[k].ent,ch[k].nent*sizeof(body_entry));
+	    memcpy(st->body_pts+pts,ch[k].pts,ch[k].npts*sizeof(int));
+	    memcpy(st->body_text+text,ch[k].text,ch[k].ntext);
+	    for (q=0;q<ch[k].nent;q++) {
+		e[q].pts+=pts;
+		if (e[q].text>=0) e[q].text+=text;
+	    }
+	    n+=ch[k].nent; pts+=ch[k].npts; text+=ch[k].ntext;
+	}
+	free(ch[k].ent); free(ch[k].pts); free(ch[k].text);
+    }
+    if (ret) {body_free(); return ermsg(17);}
+    return 0;
+}
+
+/* index of the first entry at or after pos */
+static int body_find(long pos){
+    int lo=0, hi=st->body_num, mid;
+    while (lo<hi) {
+	mid=(lo+hi)/2;
+	if (st->body_tab[mid].pos<pos) lo=mid+1; else hi=mid;
+    }
+    return lo;
+}
+
+static void body_free(void){
+    free(st->body_tab); free(st->body_pts); free(st->body_text);
+    free(st->win_keep);
+    st->body_tab=NULL; st->body_pts=NULL; st->body_text=NULL; st->body_num=0;
+    st->win_keep=NULL;
+}
+
+/* box of an entry of the table in xfig units, grown by the half line
+   width; returns 0 if it has none (not an object, or its points are
+   read from the file) */
+static int body_box(body_entry *e, int *b){
+    obstruct *o=&e->ob;
+    int k, w=o->width*15/2, r, *p=st->body_pts+e->pts;
+    if (e->kind!=BODY_OBJECT) return 0;
+    switch (o->class) {
+    case 1: /* ellipses */
+	b[0]=o->cx1-o->r1-w; b[2]=o->cx1+o->r1+w;
+	b[1]=o->cx2-o->r2-w; b[3]=o->cx2+o->r2+w;
+	return 1;
+    case 2: /* polylines */
+	if (e->npts<2) return 0;
+	b[0]=b[2]=p[0]; b[1]=b[3]=p[1];
+	for (k=2;k+1<e->npts;k+=2) {
+	    if (p[k]<b[0]) b[0]=p[k];
+	    if (p[k]>b[2]) b[2]=p[k];
+	    if (p[k+1]<b[1]) b[1]=p[k+1];
+	    if (p[k+1]>b[3]) b[3]=p[k+1];
+	}
+	b[0]-=w; b[1]-=w; b[2]+=w; b[3]+=w;
+	return 1;
+    case 4: /* text, in any direction */
+	r=(int)(o->fx1+o->fx2)+1;
+	b[0]=o->cx1-r; b[2]=o->cx1+r; b[1]=o->cx2-r; b[3]=o->cx2+r;
+	return 1;
+    case 5: /* arcs */
+	r=(int)hypot(o->ax1-o->fx1,o->ax2-o->fx2)+1+w;
+	b[0]=o->cx1-r; b[2]=o->cx1+r; b[1]=o->cx2-r; b[3]=o->cx2+r;
+	return 1;
+    case 6: /* compounds */
+	b[0]=(o->cx1<o->ex1)?o->cx1:o->ex1; b[2]=(o->cx1<o->ex1)?o->ex1:o->cx1;
+	b[1]=(o->cx2<o->ex2)?o->cx2:o->ex2; b[3]=(o->cx2<o->ex2)?o->ex2:o->cx2;
+	return 1;
+    }
+    return 0;
+}
+
+/* window from x0,y0,x1,y1[,mil][,clip]; returns nonzero if wrong */
+static int window_parse(char *arg){
+    double w[4], t;
+    int n=0, mil=0;
+    char *p;
+    if (sscanf(arg,"%lf,%lf,%lf,%lf%n",&w[0],&w[1],&w[2],&w[3],&n)<4 || !n)
+	return 1;
+    st->window_clip=0;
+    for (p=arg+n;*p==',';) {
+	if (!strncmp(p,",mil",4)) {mil=1; p+=4;}
+	else if (!strncmp(p,",clip",5)) {st->window_clip=1; p+=5;}
+	else break;
+    }
+    if (*p) return 1;
+    if (w[0]>w[2]) {t=w[0]; w[0]=w[2]; w[2]=t;}
+    if (w[1]>w[3]) {t=w[1]; w[1]=w[3]; w[3]=t;}
+    if (mil) { /* plot x is xfig y, see rs_plot() */
+	st->win_mx0=w[0]; st->win_my0=w[1]; st->win_mx1=w[2]; st->win_my1=w[3];
+	st->win_x0=(int)floor(w[1]*4.5); st->win_x1=(int)ceil(w[3]*4.5);
+	st->win_y0=(int)floor(w[0]*4.5); st->win_y1=(int)ceil(w[2]*4.5);
+    } else {
+	st->win_x0=(int)floor(w[0]); st->win_y0=(int)floor(w[1]);
+	st->win_x1=(int)ceil(w[2]); st->win_y1=(int)ceil(w[3]);
+	st->win_mx0=w[1]/4.5; st->win_mx1=w[3]/4.5;
+	st->win_my0=w[0]/4.5; st->win_my1=w[2]/4.5;
+    }
+    st->window_mode=1;
+    return 0;
+}
+
+/* marks the entries of the table to be converted for the window in
+   win_keep. Returns 0 or an ermsg() code. */
+static int window_select(void){
+    int *box=NULL, *start=NULL, *list=NULL;
+    int k, m, u, v, nx, ny, n, depth, ret=0;
+    double x0=1e30, y0=1e30, x1=-1e30, y1=-1e30, cell, side=0;
+
+    if (!st->body_tab) return ermsg(41);
+    st->win_keep=malloc(st->body_num+1);
+    box=malloc((4*st->body_num+1)*sizeof(int));
+    if (!st->win_keep || !box) {ret=ermsg(17); goto done;}
+    for (n=k=0;k<st->body_num;k++) {
+	st->win_keep[k]=!body_box(&st->body_tab[k],box+4*k);
+	if (st->win_keep[k]) continue;
+	n++;
+	side+=box[4*k+2]-box[4*k]+box[4*k+3]-box[4*k+1];
+	if (box[4*k]<x0) x0=box[4*k];
+	if (box[4*k+1]<y0) y0=box[4*k+1];
+	if (box[4*k+2]>x1) x1=box[4*k+2];
+	if (box[4*k+3]>y1) y1=box[4*k+3];
+    }
+    if (!n) goto done;
+    /* square buckets of about four objects, but not smaller than the
+       objects are on average */
+    cell=sqrt((x1-x0+1)*(y1-y0+1)*4.0/n);
+    if (cell<side/(2*n)) cell=side/(2*n);
+    if ((x1-x0)/cell>1023) cell=(x1-x0)/1023;
+    if ((y1-y0)/cell>1023) cell=(y1-y0)/1023;
+    cell+=1;
+    nx=(int)((x1-x0)/cell)+1; ny=(int)((y1-y0)/cell)+1;
+    start=calloc(nx*ny+1,sizeof(int));
+    if (!start) {ret=ermsg(17); goto done;}
+    for (m=0;m<2;m++) { /* count, then fill */
+	for (k=0;k<st->body_num;k++) {
+	    if (st->win_keep[k]) continue;
+	    for (v=(box[4*k+1]-y0)/cell;v<=(int)((box[4*k+3]-y0)/cell);v++)
+		for (u=(box[4*k]-x0)/cell;u<=(int)((box[4*k+2]-x0)/cell);u++)
+		    if (m) list[--start[v*nx+u]]=k;
+		    else start[v*nx+u]++;
+	}
+	if (m) break;
+	for (u=1;u<nx*ny;u++) start[u]+=start[u-1];
+	start[nx*ny]=start[nx*ny-1];
+	if (!(list=malloc((start[nx*ny]+1)*sizeof(int)))) {
+	    ret=ermsg(17); goto done;
+	}
+    }
+    /* the buckets under the window */
+    for (v=0;v<ny;v++) {
+	if (y0+(v+1)*cell<st->win_y0 || y0+v*cell>st->win_y1) continue;
+	for (u=0;u<nx;u++) {
+	    if (x0+(u+1)*cell<st->win_x0 || x0+u*cell>st->win_x1) continue;
+	    for (m=start[v*nx+u];m<start[v*nx+u+1];m++) {
+		k=list[m];
+		if (box[4*k]<=st->win_x1 && box[4*k+2]>=st->win_x0 &&
+		    box[4*k+1]<=st->win_y1 && box[4*k+3]>=st->win_y0) st->win_keep[k]=1;
+	    }
+	}
+    }
+    /* compounds outside go with all they hold */
+    for (k=0;k<st->body_num;k++) {
+	if (st->body_tab[k].kind!=BODY_OBJECT || st->body_tab[k].ob.class!=6 ||
+	    st->win_keep[k]) continue;
+	for (depth=0;k<st->body_num;k++) {
+	    st->win_keep[k]=0;
+	    if (st->body_tab[k].kind!=BODY_OBJECT) continue;
+	    if (st->body_tab[k].ob.class==6) depth++;
+	    if (st->body_tab[k].ob.class==-6 && !--depth) break;
+	}
+    }
+ done:
+    free(box); free(start); free(list);
+    return ret;
+}
+
+/* board box from the boxes of the table, before any job is written: the
+   objects on the profile depth 5 if there are any, else all of them
+   (splines, which read their points from the file, have no box). With
+   --origin its lower left corner becomes 0,0 of the output. */
+static void board_setup(void){
+    int e[2][4]={{INT_MAX,INT_MAX,INT_MIN,INT_MIN},
+		 {INT_MAX,INT_MAX,INT_MIN,INT_MIN}};
+    int b[4], k, m, *p;
+    for (k=0;k<st->body_num;k++) {
+	if (!body_box(&st->body_tab[k],b) || st->body_tab[k].ob.class==6)
+	    continue;
+	for (m=0;m<2;m++) {
+	    if (m && st->body_tab[k].ob.depth!=5) continue;
+	    p=e[m];
+	    if (b[0]<p[0]) p[0]=b[0];
+	    if (b[1]<p[1]) p[1]=b[1];
+	    if (b[2]>p[2]) p[2]=b[2];
+	    if (b[3]>p[3]) p[3]=b[3];
+	}
+    }
+    p=(e[1][0]<=e[1][2])?e[1]:e[0];
+    if (p[0]>p[2]) return; /* nothing with a box */
+    /* plot x is xfig y, see rs_plot() */
+    st->board_x0=(int)floor(2.0*p[1]/9); st->board_x1=(int)ceil(2.0*p[3]/9);
+    st->board_y0=(int)floor(2.0*p[0]/9); st->board_y1=(int)ceil(2.0*p[2]/9);
+    if (st->origin_mode) {
+	st->org_x=st->board_x0; st->org_y=st->board_y0;
+	st->board_x1-=st->org_x; st->board_y1-=st->org_y;
+	st->board_x0=st->board_y0=0;
+    }
+    st->board_known=1;
+}
+
+/* open the source of the current conversion: the memory buffer of the
+   context, stdin for "-", or the file name */
+static FILE *src_open(char *name){
+    if (x2g_cur && x2g_cur->src_data)
+	return fmemopen(x2g_cur->src_data,x2g_cur->src_len,"r");
+    if (!strncmp(name,"-",1)) return stdin;
+    return fopen(name,"r");
+}
+
+static void src_close(FILE *f){
+    if (f!=stdin) fclose(f);
+}
+
+/* make c the context of the calling thread; the API functions which
+   work on the state start with it */
+static void x2g_use(x2g_context *c){
+    x2g_cur=c; st=c?&c->st:NULL;
+}
+
+x2g_context *x2g_new(void){
+    x2g_context *c=calloc(1,sizeof(x2g_context));
+    if (c) {x2g_use(c); options_default(c);}
+    return c;
+}
+
+/* drop the memory outputs of the last conversion */
+static void x2g_drop(x2g_context *c){
+    int k;
+    for (k=0;k<c->mem_num;k++) {free(c->mem[k].name); free(c->mem[k].data);}
+    free(c->mem); c->mem=NULL; c->mem_num=0;
+}
+
+/* free the images recorded for previews */
+static void x2g_images(x2g_context *c){
+    int k;
+    for (k=0;k<MAXOUTFILES;k++) {
+	free(c->images[k].prim); free(c->images[k].x); free(c->images[k].y);
+    }
+    memset(c->images,0,sizeof(c->images));
+}
+
+/* free the buffers the state keeps from one conversion to the next */
+static void state_free(void){
+    int k;
+    for (k=0;k<st->fp_num;k++) {
+	free(st->fp_lib[k].obj); free(st->fp_lib[k].pts);
+	free(st->fp_lib[k].text);
+    }
+    free(st->fp_lib); free(st->fp_places); free(st->fp_buf);
+    for (k=0;k<st->glyph_cache_size;k++) {
+	free(st->glyph_cache[k].x); free(st->glyph_cache[k].y);
+	free(st->glyph_cache[k].pen);
+    }
+    free(st->glyph_cache);
+    for (k=0;k<st->zone_num;k++) {
+	free(st->pour_zones[k].x); free(st->pour_zones[k].y);
+    }
+    free(st->pour_zones);
+    free(st->place_pads); free(st->place_labels); free(st->net_names);
+    free(st->stitch_segs); free(st->bite_x); free(st->bite_y);
+    free(st->pool_x); free(st->pool_y); free(st->win_tx); free(st->win_ty);
+    body_free();
+}
+
+void x2g_free(x2g_context *c){
+    if (!c) return;
+    x2g_use(c);
+    x2g_reset(c); state_free();
+    free(c->src_data);
+    free(c);
+    x2g_use(NULL);
+}
+
+/* convert the file name, or stdin for "-" */
+int x2g_source_file(x2g_context *c, const char *name){
+    free(c->src_data); c->src_data=NULL; c->src_len=0;
+    strncpy(c->sourcename,name,MAXFILNAMLEN-1);
+    c->sourcename[MAXFILNAMLEN-1]=0;
+    return 0;
+}
+
+/* convert a copy of len bytes of data; name is the root of the output
+   names unless -o is given */
+int x2g_source_memory(x2g_context *c, const char *name, const char *data,
+		      size_t len){
+    char *d;
+    if (!len || !(d=malloc(len))) return -ermsg(3);
+    memcpy(d,data,len);
+    x2g_source_file(c,name);
+    c->src_data=d; c->src_len=len;
+    return 0;
+}
+
+/* where the output of job goes; job -1 sets the sink for the jobs
+   without one of their own and for reports, previews and inner layers */
+int x2g_sink(x2g_context *c, int job, int kind, int fd, x2g_write_fn fn,
+	     void *user){
+    out_sink *s;
+    if (job<-1 || job>=X2G_JOBS || kind<X2G_SINK_FILE ||
+	kind>X2G_SINK_CALLBACK || (kind==X2G_SINK_CALLBACK && !fn))
+	return -ermsg(9);
+    s=&c->sinks[job+1];
+    s->kind=kind; s->fd=fd; s->fn=fn; s->user=user;
+    return 0;
+}
+
+int x2g_outputs(x2g_context *c){
+    return c->mem_num;
+}
+
+/* name and contents of memory output k. Returns 0, or 1 if there is no
+   such output. */
+int x2g_output(x2g_context *c, int k, const char **name, const char **data,
+	       size_t *len){
+    if (k<0 || k>=c->mem_num) return 1;
+    *name=c->mem[k].name; *data=c->mem[k].data; *len=c->mem[k].len;
+    return 0;
+}
+
+/* default options: the context and its state */
+static void options_default(x2g_context *c){
+    c->outfileroot[0]=0; c->libraryname[0]=0; c->bundlename[0]=0;
+    c->diffname[0]=0;
+    c->outfilenumber=0; /* start with no files */
+    c->playerlist[0]=-1; c->playerlist[1]=-1;
+    c->layerrange=DEFAULTRANGE; c->layerstart=-1;
+    c->transfermode_15=1; c->stackup=0;
+    c->RS274Xmode=0; c->joinmode=0; c->outfilemode=0;
+    c->Large_inner_insulation=0;
+    st->stitchmode=0; st->spline_tolerance=0.5;
+    st->rout_bit=0.0; st->tab_num=0; st->tab_width=0.0;
+    st->bite_pitch=0.0; st->bite_dia=0.0;
+    st->preview_dpi=0;
+    st->stencil_percent=0.0; st->stencil_shrink=0.0;
+    st->stencil_pane=0.0; st->stencil_web=0.0;
+    st->place_format=0; st->pour_num=0; st->flatten_mode=0; st->watch_mode=0;
+    st->stream_mode=0; st->parallel_mode=0; st->extents_mode=0;
+    st->origin_mode=0;
+    st->clear_mode=0; st->clear_mil[0]=st->clear_mil[1]=st->clear_mil[2]=0.0;
+    st->mask_mode=0; st->mask_web=0.0;
+    st->window_mode=0; st->window_clip=0; st->slot_mode=0;
+    st->drc_mode=0; st->netlist_mode=0;
+    st->drc_width=6.0; st->drc_clearance=6.0;
+    st->drc_ring=5.0; st->drc_holegap=10.0;
+    while (st->fp_num>0) { /* footprints of an earlier --library */
+	st->fp_num--;
+	free(st->fp_lib[st->fp_num].obj); free(st->fp_lib[st->fp_num].pts);
+	free(st->fp_lib[st->fp_num].text);
+    }
+}
+
+/* state kept between the passes of one conversion, but not beyond */
+static void x2g_reset(x2g_context *c){
+    int k;
+    ext_reset();
+    for (k=0;k<st->spline_cache_size;k++) {
+	free(st->spline_cache[k].x); free(st->spline_cache[k].y);
+    }
+    free(st->spline_cache); st->spline_cache=NULL;
+    st->spline_cache_num=0; st->spline_cache_size=0;
+    for (k=0;k<st->net_num;k++) free(st->net_names[k]);
+    st->net_num=0;
+    for (k=0;k<st->label_num;k++) free(st->place_labels[k].text);
+    st->place_num=0; st->label_num=0; st->place_collect=0;
+    st->compound_level=0; st->compound_id=0;
+    st->pending_net=0; st->obj_net=0; st->compound_net=0;
+    st->fp_place_num=0; st->fp_tag[0]=0; st->fp_cur=NULL; st->fp_pts=NULL;
+    st->stitch_num=0; st->bite_num=0; st->rout_warned=-1;
+    memset(st->stencil_cache,0,sizeof(st->stencil_cache)); st->stencil_defs=0;
+    memset(st->clear_cache,0,sizeof(st->clear_cache)); st->clear_defs=0;
+    free(st->drill_buf.prim); free(st->drill_buf.x); free(st->drill_buf.y);
+    memset(&st->drill_buf,0,sizeof(st->drill_buf));
+    st->capture=NULL; st->capture_clear=0;
+    x2g_drop(c); x2g_images(c);
+}
+
+#ifndef X2G_LIBRARY /* main() only */
+#define WATCH_DEPTHS 1000 /* xfig depths are 0..999 */
+
+static int watch_cmp(const void *a, const void *b){
+    const watch_obj *p=a, *q=b;
+    if (p->hash!=q->hash) return (p->hash<q->hash)?-1:1;
+    return p->depth-q->depth;
+}
+
+/* index of the objects of the source file name: each object line with its
+   continuation lines and the comments in front of it is hashed, with its
+   depth (-1 for compounds and colors). head is the hash of the header.
+   Returns 0, or 1 if the file cannot be read. */
+static int watch_index(char *name, watch_obj **o, int *n, int *max,
+		       unsigned long long *head){
+    char line[10000];
+    FILE *f;
+    obstruct ob;
+    unsigned long long h=14695981039346656037ULL;
+    int depth=-2, lines=0; /* -2: no object line yet */
+
+    if (!(f=fopen(name,"r"))) return 1;
+    *n=0; *head=h;
+    while (fgets(st->inbuffer,10000,f)) {
+	if (lines++<9) {
+	    *head=fp_hash(st->inbuffer,strlen(st->inbuffer),*head);
+	    continue;
+	}
+	if (st->inbuffer[0]=='\n') continue;
+	if (st->inbuffer[0]!=' ' && st->inbuffer[0]!='\t' && depth>-2) {
+	    /* a comment or an object line ends the object before */
+	    if (flat_grow(o,max,*n+1,sizeof(watch_obj))) {fclose(f); return 1;}
+	    (*o)[*n].hash=h; (*o)[(*n)++].depth=depth;
+	    h=14695981039346656037ULL; depth=-2;
+	}
+	h=fp_hash(st->inbuffer,strlen(st->inbuffer),h);
+	if (st->inbuffer[0]=='#' || st->inbuffer[0]==' ' || st->inbuffer[0]=='\t')
+	    continue;
+	memset(&ob,0,sizeof(ob));
+	sscanf(st->inbuffer,"%d",&ob.class);
+	strcpy(line,st->inbuffer);
+	depth=-1;
+	if (ob.class>0 && ob.class<6 && !parse_object(&ob,line) &&
+	    ob.depth>=0 && ob.depth<WATCH_DEPTHS) depth=ob.depth;
+    }
+    fclose(f);
+    if (depth>-2 || h!=14695981039346656037ULL) {
+	if (flat_grow(o,max,*n+1,sizeof(watch_obj))) return 1;
+	(*o)[*n].hash=h; (*o)[(*n)++].depth=(depth>-2)?depth:-1;
+    }
+    qsort(*o,*n,sizeof(watch_obj),watch_cmp);
+    return 0;
+}
+
+/* is one of the depths in list changed? */
+static int watch_hit(int *list, char *changed){
+    for (;*list>=0;list++) if (*list<WATCH_DEPTHS && changed[*list]) return 1;
+    return 0;
+}
+
+/* does one of the depths in list hold a pour zone? */
+static int watch_poured(int *list){
+    for (;*list>=0;list++) if (pour_rule_of(*list)>=0) return 1;
+    return 0;
+}
+
+/* stay resident and convert the source again whenever it is saved. Only
+   the child processes doing the conversions return from here, with the
+   jobs cut down to those with changed layers; the stackup and reports
+   are dropped if nothing of theirs changed. Returns nonzero if the
+   source cannot be watched. */
+static int watch_source(char *sourcename, int *jobs, int *num, int *layerlist,
+			int *playerlist, int *stackup){
+    watch_obj *old=NULL, *cur=NULL, *t;
+    int all[MAXOUTFILES], nall=*num, nold=0, ncur=0, maxold=0, maxcur=0;
+    int fd, k, m, n, all_changed, stk, reports, status, c, first=1;
+    unsigned long long head, oldhead=0;
+    char dir[MAXFILNAMLEN], changed[WATCH_DEPTHS], *base;
+    char ev[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event *e;
+    struct pollfd pfd;
+    pid_t pid;
+    ssize_t len;
+
+    memcpy(all,jobs,nall*sizeof(int));
+    /* watch the directory, as a save may replace the file */
+    strcpy(dir,sourcename);
+    if ((base=strrchr(dir,'/'))) {
+	*base=0; if (!dir[0]) strcpy(dir,"/");
+	base=strrchr(sourcename,'/')+1;
+    } else {
+	strcpy(dir,"."); base=sourcename;
+    }
+    if ((fd=inotify_init())<0) return 1;
+    if (inotify_add_watch(fd,dir,IN_CLOSE_WRITE|IN_MOVED_TO)<0) {
+	close(fd); return 1;
+    }
+    for (;;) {
+	if (watch_index(sourcename,&cur,&ncur,&maxcur,&head)) {
+	    if (first) {close(fd); return 1;}
+	    fprintf(stderr,"Cannot read %s.\n",sourcename);
+	    goto wait;
+	}
+	/* what has changed: objects in one index but not in the other */
+	memset(changed,0,sizeof(changed));
+	all_changed=first || head!=oldhead;
+	for (k=m=0;k<nold || m<ncur;) {
+	    c=(k==nold)?1:(m==ncur)?-1:watch_cmp(&old[k],&cur[m]);
+	    if (!c) {k++; m++; continue;}
+	    n=(c<0)?old[k++].depth:cur[m++].depth;
+	    if (n<0) all_changed=1; else changed[n]=1;
+	}
+	for (n=k=0;k<nall;k++) {
+	    /* pours are cut around the holes of depth 0 */
+	    if (!all_changed && !(changed[0] && watch_poured(all[k]?
+				  readlayerlist[all[k]]:layerlist)) &&
+		!(all[k]?
+		 ((filetypetable[all[k]]==1 || filetypetable[all[k]]==4)?
+		  changed[0]:(watch_hit(readlayerlist[all[k]],changed) ||
+			      watch_hit(punchlayerlist[all[k]],changed))):
+		 (watch_hit(layerlist,changed) ||
+		  watch_hit(playerlist,changed)))) continue;
+	    jobs[n++]=all[k];
+	}
+	for (stk=all_changed,k=STACKBASE;k<WATCH_DEPTHS;k++)
+	    if (changed[k]) stk=1;
+	stk|=changed[10]|changed[11]|changed[15]|changed[16];
+	for (reports=all_changed|changed[0]|changed[4],k=2;k<6;k++)
+	    reports|=watch_hit(readlayerlist[k],changed) |
+		watch_hit(punchlayerlist[k],changed);
+	if (n || (*stackup && stk) || reports) {
+	    fflush(NULL);
+	    if ((pid=fork())<0) {close(fd); return 1;}
+	    if (!pid) { /* the child converts */
+		close(fd);
+		*num=n;
+		if (!stk) *stackup=0;
+		if (!reports) st->place_format=st->netlist_mode=st->drc_mode=0;
+		return 0;
+	    }
+	    waitpid(pid,&status,0);
+	    if (WIFEXITED(status) && !WEXITSTATUS(status))
+		fprintf(stderr,"%s: %d of %d files rewritten.\n",
+			sourcename,n,nall);
+	}
+	t=old; old=cur; cur=t;
+	k=maxold; maxold=maxcur; maxcur=k;
+	nold=ncur; oldhead=head; first=0;
+    wait:
+	/* wait until the source is written, then for the writes to settle */
+	for (m=0;!m;) {
+	    if ((len=read(fd,ev,sizeof(ev)))<=0) {close(fd); return 1;}
+	    for (k=0;k<len;k+=sizeof(struct inotify_event)+e->len) {
+		e=(struct inotify_event *)(ev+k);
+		if (e->len && !strcmp(e->name,base)) m=1;
+	    }
+	}
+	pfd.fd=fd; pfd.events=POLLIN;
+	while (poll(&pfd,1,50)>0 && read(fd,ev,sizeof(ev))>0);
+    }
+}
+#endif
+
+/* track stitching. Segments are collected with stitch_add() while a layer
+   is parsed; stitch_flush() joins chains of segments with the same aperture
+   and coincident end points into paths and writes them out. End points are
+   found with a hash on the (already quantized) plot coordinates. */
+static int stitch_add(int x0, int y0, int x1, int y1, int aperture){
+    stitch_seg *s;
+    if (st->stitch_num==st->stitch_max) {
+	s=realloc(st->stitch_segs,(st->stitch_max+1024)*2*sizeof(stitch_seg));
+	if (!s) return -1;
+	st->stitch_segs=s; st->stitch_max=(st->stitch_max+1024)*2;
+    }
+    s=&st->stitch_segs[st->stitch_num++];
+    s->x0=x0; s->y0=y0; s->x1=x1; s->y1=y1; s->aperture=aperture; s->used=0;
+    return 0;
+}
+
+/* end point hash table st->sth_*: one slot per distinct (x,y,aperture),
+   with a chain of segment ends (2*segment+end) sharing that vertex */
+static unsigned int stitch_hashval(int x, int y, int ap){
+    return ((unsigned int)x*73856093u)^((unsigned int)y*19349663u)^
+	((unsigned int)ap*83492791u);
+}
+/* end point coordinates of a segment end e=2*segment+end */
+static void stitch_end(int e, int *x, int *y){
+    stitch_seg *s=&st->stitch_segs[e>>1];
+    if (e&1) {*x=s->x1; *y=s->y1;} else {*x=s->x0; *y=s->y0;}
+}
+/* find the hash slot of a vertex */
+static int stitch_lookup(int x, int y, int ap){
+    unsigned int h=stitch_hashval(x,y,ap)&st->sth_mask;
+    int px,py;
+    while (st->sth_slot[h]>=0) {
+	stitch_end(st->sth_slot[h],&px,&py);
+	if (px==x && py==y && st->stitch_segs[st->sth_slot[h]>>1].aperture==ap) break;
+	h=(h+1)&st->sth_mask;
+    }
+    return h;
+}
+/* append a point to the path, dropping repeated and collinear points */
+static void stitch_point(int x, int y){
+    int *px=st->stp_x, *py=st->stp_y, n=st->stp_num;
+    long long cr, dt;
+    if (n>0 && px[n-1]==x && py[n-1]==y) return;
+    if (n>1) {
+	cr=(long long)(px[n-1]-px[n-2])*(y-py[n-1])-
+	    (long long)(py[n-1]-py[n-2])*(x-px[n-1]);
+	dt=(long long)(px[n-1]-px[n-2])*(x-px[n-1])+
+	    (long long)(py[n-1]-py[n-2])*(y-py[n-1]);
+	if (cr==0 && dt>0) n--; /* interior point on a straight run */
+    }
+    px[n]=x; py[n]=y; st->stp_num=n+1;
+}
+/* follow unused segments starting at segment end e, appending points */
+static void stitch_walk(int e){
+    int x,y,h,f;
+    for (;;) {
+	stitch_end(e,&x,&y);
+	h=stitch_lookup(x,y,st->stitch_segs[e>>1].aperture);
+	for (f=st->sth_head[h];f>=0;f=st->sth_next[f])
+	    if (!st->stitch_segs[f>>1].used) break;
+	if (f<0) return;
+	st->stitch_segs[f>>1].used=1;
+	e=f^1;  /* continue at the other end of that segment */
+	stitch_end(e,&x,&y);
+	stitch_point(x,y);
+    }
+}
+static int stitch_cmp(const void *a, const void *b){
+    return ((stitch_seg *)a)->aperture-((stitch_seg *)b)->aperture;
+}
+
+static void stitch_flush(FILE *f){
+    int n, m, e, h, k, x, y, tsize, pass, ap=-1;
+    stitch_seg *s;
+
+    /* sort by aperture to keep aperture changes at a minimum */
+    qsort(st->stitch_segs,st->stitch_num,sizeof(stitch_seg),stitch_cmp);
+    for (tsize=1024;tsize<4*st->stitch_num;tsize*=2);
+    st->sth_mask=tsize-1;
+    st->sth_slot=malloc(tsize*sizeof(int));
+    st->sth_head=malloc(tsize*sizeof(int));
+    st->sth_deg=malloc(tsize*sizeof(int));
+    st->sth_next=malloc(2*st->stitch_num*sizeof(int));
+    st->stp_x=malloc((2*st->stitch_num+1)*sizeof(int));
+    st->stp_y=malloc((2*st->stitch_num+1)*sizeof(int));
+    if (!st->sth_slot || !st->sth_head || !st->sth_deg || !st->sth_next ||
+	!st->stp_x || !st->stp_y) {
+	ermsg(17); st->stitch_num=0; goto cleanup;
+    }
+    for (h=0;h<tsize;h++) {
+	st->sth_slot[h]=-1; st->sth_head[h]=-1; st->sth_deg[h]=0;
+    }
+    for (e=0;e<2*st->stitch_num;e++) {
+	stitch_end(e,&x,&y);
+	h=stitch_lookup(x,y,st->stitch_segs[e>>1].aperture);
+	st->sth_slot[h]=e; st->sth_next[e]=st->sth_head[h]; st->sth_head[h]=e;
+	st->sth_deg[h]++;
+    }
+
+    /* first start paths at chain ends and junctions, then pick up the
+       remaining closed loops */
+    for (pass=0;pass<2;pass++) {
+	for (n=0;n<st->stitch_num;n++) {
+	    s=&st->stitch_segs[n];
+	    if (s->used) continue;
+	    e=2*n;
+	    if (pass==0) {
+		if (st->sth_deg[stitch_lookup(s->x0,s->y0,s->aperture)]==2) {
+		    e=2*n+1;
+		    if (st->sth_deg[stitch_lookup(s->x1,s->y1,s->aperture)]==2)
+			continue;
+		}
+	    }
+	    s->used=1;
+	    st->stp_num=0;
+	    stitch_end(e,&x,&y); stitch_point(x,y);
+	    stitch_end(e^1,&x,&y); stitch_point(x,y);
+	    stitch_walk(e^1);
+	    /* reverse and extend at the start point as well */
+	    for (k=0;k<st->stp_num/2;k++) {
+		m=st->stp_num-1-k;
+		x=st->stp_x[k]; st->stp_x[k]=st->stp_x[m]; st->stp_x[m]=x;
+		y=st->stp_y[k]; st->stp_y[k]=st->stp_y[m]; st->stp_y[m]=y;
+	    }
+	    stitch_walk(e);
+
+	    if (s->aperture!=ap) {
+		ap=s->aperture;
+		fprintf(f,"G54D%02d*\n",ap);
+	    }
+	    fprintf(f,"G01X%05dY%05dD02*",st->stp_x[0],st->stp_y[0]);
+	    if (st->stp_num==1) /* zero length segment */
+		fprintf(f,"X%05dY%05dD01*",st->stp_x[0],st->stp_y[0]);
+	    for (k=1;k<st->stp_num;k++)
+		fprintf(f,"X%05dY%05dD01*",st->stp_x[k],st->stp_y[k]);
+	    fprintf(f,"\n");
+	}
+    }
+    st->stitch_num=0;
+ cleanup:
+    free(st->sth_slot); free(st->sth_head);
+    free(st->sth_deg); free(st->sth_next);
+    free(st->stp_x); free(st->stp_y);
+}
+
+/* parse the header line of an object into o; the rest of a circle or
+   text line is left in *rest. Reentrant, for the parallel tokenizer.
+   Returns nonzero for unknown objects. */
+static int parse_object_r(obstruct *o, char *line, char **rest){
+  int cls;
+  char *sp;
+
+  *rest=line;
+  switch (o->class){
+  case 1:
+    /* circles */
+    sscanf(strtok_r(line," ",&sp),"%d",&cls);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->type);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->type2);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->width);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->pencolor);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->fillcolor);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->depth);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->utype1);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->fillmode);
+    sscanf(strtok_r(NULL," ",&sp),"%f",&o->float1);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->int11);
+    sscanf(strtok_r(NULL," ",&sp),"%f",&o->float2);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->cx1);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->cx2);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->r1);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->r2);
+    *rest=strtok_r(NULL,"\n",&sp);   /* get rest... */
+    break;
+    
+  case 2:
+    /* lines */
+    sscanf(strtok_r(line," ",&sp),"%d",&cls);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->type);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->type2);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->width);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->pencolor);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->fillcolor);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->depth);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->utype1);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->fillmode);
+    sscanf(strtok_r(NULL," ",&sp),"%f",&o->float1);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->int11);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->int12);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->int13);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->int14);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->int15);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->int16);
+    /* ibb=strtok(NULL,"\n"); */  /* get rest... */
+    break;
+
+  case 3:
+    /* splines */
+    sscanf(strtok_r(line," ",&sp),"%d",&cls);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->type);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->type2);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->width);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->pencolor);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->fillcolor);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->depth);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->utype1);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->fillmode);
+    sscanf(strtok_r(NULL," ",&sp),"%f",&o->float1);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->int11);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->int12); /* forward arrow */
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->int13); /* backward arrow */
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->int16); /* point count */
+    break;
+
+  case 4:
+    /* text */
+    sscanf(strtok_r(line," ",&sp),"%d",&cls);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->type); /* justification */
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->pencolor);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->depth);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->utype1);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->int11); /* font */
+    sscanf(strtok_r(NULL," ",&sp),"%f",&o->float1); /* font size */
+    sscanf(strtok_r(NULL," ",&sp),"%f",&o->float2); /* angle */
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->int12); /* font flags */
+    sscanf(strtok_r(NULL," ",&sp),"%f",&o->fx1); /* height */
+    sscanf(strtok_r(NULL," ",&sp),"%f",&o->fx2); /* length */
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->cx1);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->cx2);
+    *rest=strtok_r(NULL,"\n",&sp);   /* get rest... */
+    break;
+
+  case 5:
+    /* arcs */
+    sscanf(strtok_r(line," ",&sp),"%d",&cls);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->type);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->type2);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->width);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->pencolor);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->fillcolor);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->depth);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->utype1);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->fillmode);
+    sscanf(strtok_r(NULL," ",&sp),"%f",&o->float1);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->int11);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->int12);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->int13);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->int14);
+    sscanf(strtok_r(NULL," ",&sp),"%f",&o->fx1);
+    sscanf(strtok_r(NULL," ",&sp),"%f",&o->fx2);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->ax1);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->ax2);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->mx1);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->mx2);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->ex1);
+    sscanf(strtok_r(NULL," ",&sp),"%d",&o->ex2);
+    /* ibb=strtok(NULL,"\n"); */  /* get rest... */
+    /* convert center position into int */
+    o->cx1=(int)o->fx1; o->cx2=(int)o->fx2;
+    break;
+
+  default: /* unknown objects */
+    return 1;
+  }
+  return 0;
+}
+
+/* same, with the rest in ibb */
+static int parse_object(obstruct *o, char *line){
+  return parse_object_r(o,line,&st->ibb);
+}
+
+/* what to do with a specific graphical object? possible results:
+   0: skip entry; 1: output drill coordinate; 2: generate line; 
    3: generate polygon; 4: generate circle; 5: filled circle;
-   6: filled square pad; 7: open arc; 8: generate slot
+   6: filled square pad; 7: open arc or pie wedge; 8: generate slot;
+   10: spline as line; 11: filled spline; 12: text; 13: filled arc;
+   15: rout polyline; 16: rout circle; 17: rout arc
    */
-int whattodo(obstruct *ob, int *layerlist, int filetype){
+static int whattodo(obstruct *ob, int *layerlist, int filetype){
   int val=0;
   int i;
 
@@ -1146,14 +7613,21 @@ int whattodo(obstruct *ob, int *layerlist, int filetype){
 	  };
 	  
 	  break;
-      case 2: /* gerber file */
+      case 2: case 5: /* gerber file, stencil */
 	  /* check correct layer */
 	  for (i=0;layerlist[i]>=0;i++) 
 	      if (layerlist[i]==ob->depth) break;
 	  if (layerlist[i]<0) break; /* not right layer */
 	  /* check for arcs */
-	  if ((ob->class==5)&&(ob->type==1)) {/* no check for filling yet */
-	      val=7;break; /* open arc */
+	  if ((ob->class==5)&&((ob->type==1)||(ob->type==2))) {
+	      val=(ob->fillmode==20)?13:7;break; /* filled or stroked arc */
+	  }
+	  /* check for splines */
+	  if (ob->class==3) {
+	      val=(ob->fillmode==20)?11:10;break;
+	  }
+	  if (ob->class==4) {
+	      val=12;break;
 	  }
 	  /* check for lines, polygons, circles, filled circles */
 	  if (((ob->class==2)&&(ob->type>0)&&(ob->type<4))||
@@ -1166,24 +7640,44 @@ int whattodo(obstruct *ob, int *layerlist, int filetype){
 	  };
 	  break;
 
+      case 3: /* rout file: contours on the outline layer */
+	  for (i=0;layerlist[i]>=0;i++) 
+	      if (layerlist[i]==ob->depth) break;
+	  if (layerlist[i]<0) break; /* not right layer */
+	  if ((ob->class==2)&&(ob->type>0)&&(ob->type<4)) val=15;
+	  if ((ob->class==1)&&(ob->type==3)) val=16;
+	  if ((ob->class==5)&&(ob->type==1)) val=17;
+	  break;
+
       default: /* dont know... */
 	  val=0;
   };
+  /* stencils only take filled shapes */
+  if (filetype==5 && val!=3 && val!=5 && val!=6 && val!=11 && val!=13)
+      val=0;
   return val;
     
 }
 /* generate header files */
-void drill_header(FILE *f){
+static void drill_header(FILE *f, char *format){
   time_t ti;
+  char date[32];
   ti=time(NULL);
   fprintf(f,"\n\n");
   fprintf(f,";%%********************************************************\n");
   fprintf(f,";%%\n;%%\n");
   fprintf(f,";%%   Program: xfig2gerber, (c) 1998-2019 Christian Kurtsiefer\n");
-  fprintf(f,";%%   Date          : %s",ctime(&ti));
+  fprintf(f,";%%   Date          : %s",ctime_r(&ti,date));
   fprintf(f,";%%   Source file   : %s \n",ifn);
   fprintf(f,";%%   Dest file     : %s \n",ofn);
-  fprintf(f,";%%   Format        : Drill file \n");
+  fprintf(f,";%%   Format        : %s \n",format);
+  if (st->board_known) {
+    fprintf(f,";%%   Image size    : %.3f x %.3f inch \n",
+	    (st->board_x1-st->board_x0)/1000.0,
+	    (st->board_y1-st->board_y0)/1000.0);
+    fprintf(f,";%%   Offset        : X%06dY%06d \n",
+	    10*st->board_x0,10*st->board_y0);
+  }
   fprintf(f,";%%\n;%%\n");
   fprintf(f,";%%********************************************************\n");
   fprintf(f,"\n\n");
@@ -1192,24 +7686,24 @@ void drill_header(FILE *f){
   fprintf(f,"M72\n");
 
 }
-void tool_trailer(FILE *f){
+static void tool_trailer(FILE *f){
   int i2,j;
   /* output drill file */
   /* printf("hit tool trailer prog\n"); */
   fprintf(f,"TOOL\tCOUNT\tSIZE (inch)\n");
   for (i2=1;i2<tool_number+1;i2++) {
-    if (tool_counts[i2]>0) {
+    if (st->tool_counts[i2]>0) {
       for (j=0;j<drill_number;j++) if (drilltab[j].tool_index==i2) break;
       if (j==0 || j>=drill_number) j=0;
-      fprintf(f,"%d\t%d\t%06.4f\n",i2,tool_counts[i2],drilltab[j].diameter);
+      fprintf(f,"%d\t%d\t%06.4f\n",i2,st->tool_counts[i2],drilltab[j].diameter);
       /* printf("i2=%d, tc: %d\n",i2,tool_counts[i2]); */
     };
   };
 }
-void drill_trailer(FILE *f){
+static void drill_trailer(FILE *f){
       fprintf(f,"M30\n");
 }
-void aperture_header(FILE *f){
+static void aperture_header(FILE *f){
   int i;
   /* aperture macro definitions */
   /* Aperture size(outer diameter) = 3.333 mils/line thickness units */
@@ -1229,33 +7723,46 @@ void aperture_header(FILE *f){
 	      rectap_tab[i].aperture_idx,
 	      rectap_tab[i].real_x, rectap_tab[i].real_y);
   }
+  if (st->stencil_defs) stencil_header(f); /* reduced pads */
+  if (st->clear_defs) clear_header(f); /* knockouts with clearance */
 
 }
 
-void gerber_header(FILE *f){
+/* size and lower left corner of the board, if known before the body */
+static void board_header(FILE *f){
+  if (!st->board_known) return;
+  fprintf(f,"G04 Image size %.3f x %.3f inch at X%05dY%05d *\n",
+	  (st->board_x1-st->board_x0)/1000.0,(st->board_y1-st->board_y0)/1000.0,
+	  st->board_x0,st->board_y0);
+}
+static void gerber_header(FILE *f){
   fprintf(f,"%%FSLAX23Y23*%%\n"); /* format definition */
   fprintf(f,"%%MOIN*%%\n"); /* inch as base unit */
+  board_header(f);
   aperture_header(f);  /* define all the apertures */
 }
-void gerber_trailer(FILE *f){
+static void gerber_trailer(FILE *f){
   fprintf(f,"D02*M02*\n");
 }
 
-void RS274X_header_1(FILE *f, char *imagename){ /* layer 1 of 274X file */
+/* layer 1 of 274X file */
+static void RS274X_header_1(FILE *f, char *imagename){
   fprintf(f,"%%FSLAX23Y23*%%\n"); /* format definition */
   fprintf(f,"%%MOIN*%%\n"); /* inch as base unit */
   fprintf(f,"%%IN%s*%%\n",imagename); /* name of file */
+  board_header(f);
   aperture_header(f);  /* define all the apertures */
   fprintf(f,"%%LN%s1*%%\n%%LPD*%%\n",imagename); /* first (dark) layer */
 }
-void RS274X_trailer_1(FILE *f){
+static void RS274X_trailer_1(FILE *f){
   fprintf(f,"D02*\n");
 }
 
-void RS274X_header_2(FILE *f, char *imagename){ /* layer 2 of 274X file */
+/* layer 2 of 274X file */
+static void RS274X_header_2(FILE *f, char *imagename){
   fprintf(f,"%%LN%s2*%%\n%%LPC*%%\n",imagename); /* first (dark) layer */
 }
-void RS274X_trailer_2(FILE *f){
+static void RS274X_trailer_2(FILE *f){
   fprintf(f,"D02*M02*\n");
 }
 
@@ -0,0 +1,63 @@
+/* xfig2gerber.h: library interface of xfig2gerber.
+
+ Copyright (C) 1998-2009, 2019 Christian Kurtsiefer,
+                         <christian.kurtsiefer@gmail.com>
+
+ This source code is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Public License as published
+ by the Free Software Foundation; either version 3 of the License,
+ or (at your option) any later version.
+
+   A context holds the options, the source and the output sinks of one
+   conversion. Options are given as on the command line (argv[0] is
+   ignored); a remaining argument is the source file. Outputs go to files
+   by default, or to memory, a file descriptor or a callback, either for
+   all files (job -1) or per job type (the numbers of the -l..-9 options,
+   see the file list in xfig2gerber.c). Each context keeps its own
+   converter state, so different contexts may convert at the same time on
+   different threads; a context is used by one thread at a time.
+   Functions return 0 or an error number, which is also printed on
+   stderr.
+
+   usage:
+     x2g_context *c=x2g_new();
+     x2g_options(c,argc,argv);
+     x2g_source_memory(c,"board",data,len);
+     x2g_sink(c,-1,X2G_SINK_MEMORY,0,NULL,NULL);
+     x2g_convert(c);
+     for (k=0;k<x2g_outputs(c);k++) x2g_output(c,k,&name,&data,&len);
+     x2g_free(c);
+*/
+#ifndef XFIG2GERBER_H
+#define XFIG2GERBER_H
+
+#include <stddef.h>
+
+typedef struct x2g_context x2g_context;
+
+#define X2G_SINK_FILE 0     /* file named after the source, the default */
+#define X2G_SINK_MEMORY 1   /* kept with the context, see x2g_output */
+#define X2G_SINK_FD 2       /* written to an open file descriptor */
+#define X2G_SINK_CALLBACK 3 /* handed to a function as it is written */
+
+/* callback sink: receives the data of the output file name in pieces,
+   and once with data NULL when the file is complete. A nonzero return
+   fails the output. */
+typedef int (*x2g_write_fn)(void *user, const char *name, const char *data,
+			    size_t len);
+
+x2g_context *x2g_new(void);
+void x2g_free(x2g_context *c);
+/* returns -1 if the options only asked for help */
+int x2g_options(x2g_context *c, int argc, char **argv);
+int x2g_source_file(x2g_context *c, const char *name);
+int x2g_source_memory(x2g_context *c, const char *name, const char *data,
+		      size_t len);
+int x2g_sink(x2g_context *c, int job, int kind, int fd, x2g_write_fn fn,
+	     void *user);
+int x2g_convert(x2g_context *c);
+int x2g_outputs(x2g_context *c);
+int x2g_output(x2g_context *c, int k, const char **name, const char **data,
+	       size_t *len);
+
+#endif